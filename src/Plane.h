@@ -3,7 +3,7 @@
 #include "ray.h"
 #include "hittable.h"
 
-class Plane : public hittable {
+class Plane : public hittableShape<Plane> {
 public:
     glm::vec3 point;     
     glm::vec3 normal;    
@@ -12,7 +12,8 @@ public:
     Plane(const glm::vec3& p, const glm::vec3& n, const glm::vec3& c)
         : point(p), normal(glm::normalize(n)), color(c) {}
 
-    virtual bool hit(const Ray& r, float tMin, float tMax, hit_record& rec) const override {
+    template <HitQuery Q>
+    bool intersect(const Ray& r, float tMin, float tMax, hit_record& rec) const {
         float denom = glm::dot(normal, r.direction());
 
          if (fabs(denom) < 1e-6f)
@@ -23,10 +24,15 @@ public:
         if (t < tMin || t > tMax)
             return false;
 
+        if (Q == HitQuery::Occlusion)
+            return true;
+
         rec.t = t;
-        rec.p = r.at(t);
-        rec.normal = normal;
-        rec.color = color;
+        if (Q == HitQuery::Closest) {
+            rec.p = r.at(t);
+            rec.normal = normal;
+            rec.color = color;
+        }
         return true;
     }
 };
@@ -0,0 +1,308 @@
+#include "aovOutput.h"
+#include "renderJob.h"
+#include "parallel.h"
+#include "ofMain.h"
+#include <filesystem>
+#include <fstream>
+#include <regex>
+#include <map>
+#include <cstring>
+
+namespace fs = std::filesystem;
+
+static const char* AOV_NAMES[AOV_COUNT] = { "direct", "bolt", "cloudnear", "cloudfar", "cloudtrans", "aura", "core" };
+
+const char* aovName(int layer) {
+	return AOV_NAMES[layer];
+}
+
+int aovChannels(int layer) {
+	return layer == AOV_CLOUD_TRANSMITTANCE ? 1 : 3;
+}
+
+static void putRgb(std::vector<float>& layer, int i, const glm::vec3& v) {
+	layer[i * 3 + 0] = v.r;
+	layer[i * 3 + 1] = v.g;
+	layer[i * 3 + 2] = v.b;
+}
+
+static glm::vec3 getRgb(const std::vector<float>& layer, int i) {
+	return glm::vec3(layer[i * 3 + 0], layer[i * 3 + 1], layer[i * 3 + 2]);
+}
+
+void AovFrame::fromSamples(const std::vector<ShadeSample>& samples, int w, int h) {
+	width = w;
+	height = h;
+	for (int l = 0; l < AOV_COUNT; ++l)
+		layers[l].assign(w * h * aovChannels(l), 0.0f);
+
+	for (int i = 0; i < w * h; ++i) {
+		const ShadeSample& s = samples[i];
+		putRgb(layers[AOV_DIRECT], i, s.direct);
+		putRgb(layers[AOV_BOLT], i, s.bolt);
+		putRgb(layers[AOV_CLOUD_NEAR], i, s.volumeNear);
+		putRgb(layers[AOV_CLOUD_FAR], i, s.volumeFar);
+		layers[AOV_CLOUD_TRANSMITTANCE][i] = 1.0f - s.volumeOpacity;
+		putRgb(layers[AOV_AURA], i, s.glowAura);
+		putRgb(layers[AOV_CORE], i, s.glowCore);
+	}
+}
+
+bool AovFrame::save(const std::string& dir, const std::string& baseName) const {
+	std::error_code ec;
+	fs::create_directories(dir, ec);
+	bool ok = true;
+	for (int l = 0; l < AOV_COUNT; ++l) {
+		fs::path path = fs::path(dir) / (std::string(aovName(l)) + "_" + baseName + ".pfm");
+		ok = writePfm(path.string(), width, height, aovChannels(l), layers[l].data()) && ok;
+	}
+	return ok;
+}
+
+bool AovFrame::load(const std::string& dir, const std::string& baseName) {
+	for (int l = 0; l < AOV_COUNT; ++l) {
+		fs::path path = fs::path(dir) / (std::string(aovName(l)) + "_" + baseName + ".pfm");
+		int w, h, channels;
+		if (!readPfm(path.string(), w, h, channels, layers[l]))
+			return false;
+		if (channels != aovChannels(l) || (l > 0 && (w != width || h != height))) {
+			ofLogError() << "AOV: " << path.string() << " doesn't match the other layers";
+			return false;
+		}
+		width = w;
+		height = h;
+	}
+	return true;
+}
+
+bool AovFrame::loadGroups(const std::string& dir, const std::string& baseName) {
+	hasGroups = loadLightGroups(dir, baseName, width, height, groups);
+	return hasGroups;
+}
+
+void AovFrame::composite(const GradeSettings& grade, unsigned char* rgb, const float* groupWeight) const {
+	bool relight = groupWeight && hasGroups;
+	parallelRows(height, [&](int yStart, int yEnd) {
+		for (int i = yStart * width; i < yEnd * width; ++i) {
+			glm::vec3 direct = getRgb(layers[AOV_DIRECT], i);
+			glm::vec3 bolt = getRgb(layers[AOV_BOLT], i);
+			glm::vec3 volumeNear = getRgb(layers[AOV_CLOUD_NEAR], i);
+			glm::vec3 volumeFar = getRgb(layers[AOV_CLOUD_FAR], i);
+			glm::vec3 glow = getRgb(layers[AOV_AURA], i) * grade.aura + getRgb(layers[AOV_CORE], i) * grade.core;
+
+			// Each group adds (weight - 1) times what it contributed to the render
+			if (relight) {
+				for (int g = 0; g < LIGHT_GROUPS; ++g) {
+					float dw = groupWeight[g] - 1.0f;
+					if (dw == 0.0f) continue;
+					direct += dw * getRgb(groups[0 * LIGHT_GROUPS + g], i);
+					bolt += dw * getRgb(groups[1 * LIGHT_GROUPS + g], i);
+					volumeNear += dw * getRgb(groups[2 * LIGHT_GROUPS + g], i);
+					volumeFar += dw * getRgb(groups[3 * LIGHT_GROUPS + g], i);
+					glow += dw * getRgb(groups[4 * LIGHT_GROUPS + g], i);
+				}
+			}
+
+			float transmittance = layers[AOV_CLOUD_TRANSMITTANCE][i];
+			float shadow = 1.0f - grade.cloudShadow * (1.0f - transmittance);
+
+			glm::vec3 c = glm::clamp(direct * (grade.direct * shadow), 0.0f, 1.0f);
+			c += bolt * grade.bolt;
+			c = glm::clamp(c + volumeNear * grade.cloud, 0.0f, 1.0f);
+
+			// Tone curve from GlowKernel::glow, applied to the regraded linear glow
+			glow = glm::min(glm::pow(glm::max(glow, glm::vec3(0.0f)), glm::vec3(0.6f)), glm::vec3(1.0f));
+
+			c += volumeFar * grade.cloud + glow;
+			c = glm::clamp(c * grade.exposure, 0.0f, 1.0f);
+
+			rgb[i * 3 + 0] = (unsigned char)(c.r * 255.0f);
+			rgb[i * 3 + 1] = (unsigned char)(c.g * 255.0f);
+			rgb[i * 3 + 2] = (unsigned char)(c.b * 255.0f);
+		}
+	});
+}
+
+bool writePfm(const std::string& path, int width, int height, int channels, const float* data) {
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	// Negative scale = little endian, which is all this runs on
+	file << (channels == 1 ? "Pf" : "PF") << "\n" << width << " " << height << "\n-1.0\n";
+	size_t rowFloats = (size_t)width * channels;
+	for (int y = height - 1; y >= 0; --y)
+		file.write(reinterpret_cast<const char*>(data + y * rowFloats), rowFloats * sizeof(float));
+	if (!file) {
+		ofLogError() << "AOV: could not write " << path;
+		return false;
+	}
+	return true;
+}
+
+bool readPfm(const std::string& path, int& width, int& height, int& channels, std::vector<float>& data) {
+	std::ifstream file(path, std::ios::binary);
+	std::string magic;
+	float scale = 0.0f;
+	file >> magic >> width >> height >> scale;
+	file.get();  // the single whitespace before the data
+	if (!file || (magic != "PF" && magic != "Pf") || width <= 0 || height <= 0) {
+		ofLogError() << "AOV: " << path << " is not a PFM file";
+		return false;
+	}
+	channels = magic == "PF" ? 3 : 1;
+
+	size_t rowFloats = (size_t)width * channels;
+	data.resize(rowFloats * height);
+	for (int y = height - 1; y >= 0; --y)
+		file.read(reinterpret_cast<char*>(data.data() + y * rowFloats), rowFloats * sizeof(float));
+	if (!file) {
+		ofLogError() << "AOV: " << path << " is truncated";
+		return false;
+	}
+
+	// Positive scale = big endian
+	if (scale > 0.0f) {
+		for (float& f : data) {
+			uint32_t u;
+			std::memcpy(&u, &f, 4);
+			u = (u >> 24) | ((u >> 8) & 0xFF00u) | ((u << 8) & 0xFF0000u) | (u << 24);
+			std::memcpy(&f, &u, 4);
+		}
+	}
+	return true;
+}
+
+int compositeAovs(const std::string& outDir, const GradeSettings& grade, const RelightKeys& keys) {
+	fs::path aovDir = fs::path(outDir) / "aov";
+	if (!fs::exists(aovDir)) {
+		ofLogError() << "No AOVs found in " << aovDir.string();
+		return 0;
+	}
+
+	// Every frame has a direct layer, the rest are found from its name
+	std::vector<std::string> baseNames;
+	std::regex pattern("direct_(.+)\\.pfm");
+	for (const auto& entry : fs::directory_iterator(aovDir)) {
+		std::smatch m;
+		std::string name = entry.path().filename().string();
+		if (std::regex_match(name, m, pattern))
+			baseNames.push_back(m[1]);
+	}
+	std::sort(baseNames.begin(), baseNames.end());
+
+	fs::path gradedDir = fs::path(outDir) / "graded";
+	std::error_code ec;
+	fs::create_directories(gradedDir, ec);
+
+	// What to write: every frame as it is, or the keyed range relit from the rendered frames
+	struct Job { std::string source; std::string name; int frame; };
+	std::vector<Job> jobs;
+	if (keys.empty()) {
+		for (const std::string& base : baseNames)
+			jobs.push_back({ base, base, -1 });
+	}
+	else {
+		std::map<int, std::string> rendered;
+		std::regex framePattern("output(\\d{5})");
+		for (const std::string& base : baseNames) {
+			std::smatch m;
+			if (std::regex_match(base, m, framePattern))
+				rendered[std::stoi(m[1])] = base;
+		}
+		if (rendered.empty()) {
+			ofLogError() << "Relight: no full frames in " << aovDir.string() << ", merge the tiles first";
+			return 0;
+		}
+		for (int f = keys.keys.front().frame; f <= keys.keys.back().frame; ++f) {
+			auto it = rendered.upper_bound(f);
+			if (it != rendered.begin()) --it;
+			jobs.push_back({ it->second, fs::path(frameFileName(f)).stem().string(), f });
+		}
+	}
+
+	int written = 0;
+	AovFrame frame;
+	std::string loaded;
+	ofPixels pixels;
+	for (const Job& job : jobs) {
+		auto t0 = std::chrono::high_resolution_clock::now();
+		if (job.source != loaded) {
+			loaded.clear();
+			if (!frame.load(aovDir.string(), job.source))
+				continue;
+			if (job.frame >= 0 && !frame.loadGroups(aovDir.string(), job.source)) {
+				ofLogError() << "Relight: " << job.source << " has no light group layers, render it with --light-groups";
+				continue;
+			}
+			loaded = job.source;
+		}
+		auto t1 = std::chrono::high_resolution_clock::now();
+
+		float weight[LIGHT_GROUPS];
+		keys.weightsAt(job.frame, weight);
+		pixels.allocate(frame.width, frame.height, OF_IMAGE_COLOR);
+		frame.composite(grade, pixels.getData(), job.frame >= 0 ? weight : nullptr);
+		auto t2 = std::chrono::high_resolution_clock::now();
+
+		ofSaveImage(pixels, (gradedDir / (job.name + ".png")).string());
+		written++;
+
+		double loadMs = std::chrono::duration<double>(t1 - t0).count() * 1000.0;
+		double compositeMs = std::chrono::duration<double>(t2 - t1).count() * 1000.0;
+		ofLog() << "Composited " << job.name << " (load " << loadMs << " ms, composite " << compositeMs << " ms)";
+	}
+	return written;
+}
+
+int mergeAovTiles(const std::string& outDir) {
+	fs::path tileDir = fs::path(outDir) / "tiles" / "aov";
+	if (!fs::exists(tileDir))
+		return 0;
+
+	// Group by layer and frame, same tile names as the PNGs
+	struct Tile { int x, y; fs::path path; };
+	std::map<std::pair<std::string, int>, std::vector<Tile>> images;
+	std::regex pattern("([a-z0-9]+)_output(\\d{5})_x(\\d+)_y(\\d+)\\.pfm");
+
+	for (const auto& entry : fs::directory_iterator(tileDir)) {
+		std::smatch m;
+		std::string name = entry.path().filename().string();
+		if (!std::regex_match(name, m, pattern)) continue;
+		images[{ m[1], std::stoi(m[2]) }].push_back({ std::stoi(m[3]), std::stoi(m[4]), entry.path() });
+	}
+
+	fs::path aovDir = fs::path(outDir) / "aov";
+	std::error_code ec;
+	fs::create_directories(aovDir, ec);
+
+	int written = 0;
+	for (auto& [key, tiles] : images) {
+		struct Loaded { int w = 0, h = 0, channels = 0; std::vector<float> data; };
+		std::vector<Loaded> loaded(tiles.size());
+		int width = 0;
+		int height = 0;
+		int channels = 0;
+		for (size_t i = 0; i < tiles.size(); ++i) {
+			Loaded& l = loaded[i];
+			if (!readPfm(tiles[i].path.string(), l.w, l.h, l.channels, l.data)) continue;
+			width = std::max(width, tiles[i].x + l.w);
+			height = std::max(height, tiles[i].y + l.h);
+			channels = l.channels;
+		}
+		if (width == 0 || height == 0) continue;
+
+		std::vector<float> full((size_t)width * height * channels, 0.0f);
+		for (size_t i = 0; i < tiles.size(); ++i) {
+			const Loaded& l = loaded[i];
+			if (l.data.empty() || l.channels != channels) continue;
+			for (int y = 0; y < l.h; ++y) {
+				std::copy(l.data.begin() + (size_t)y * l.w * channels, l.data.begin() + (size_t)(y + 1) * l.w * channels,
+					full.begin() + ((size_t)(tiles[i].y + y) * width + tiles[i].x) * channels);
+			}
+		}
+
+		std::string base = fs::path(frameFileName(key.second)).stem().string();
+		writePfm((aovDir / (key.first + "_" + base + ".pfm")).string(), width, height, channels, full.data());
+		written++;
+	}
+	ofLog() << "Merged " << written << " AOV layers";
+	return written;
+}
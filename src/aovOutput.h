@@ -0,0 +1,80 @@
+#ifndef AOVOUTPUT_H
+#define AOVOUTPUT_H
+
+#include "shadeSample.h"
+#include "lightGroups.h"
+#include <string>
+#include <vector>
+
+// Float HDR layers (AOVs) of a frame, so glow strength, cloud contribution or exposure can be changed
+// without tracing again. Every layer is an uncompressed PFM in <out>/aov (tiles go to <out>/tiles/aov and
+// are put together by --merge), named <layer>_<png name>.pfm. The layers are the linear per pixel terms
+// from before any of the clamps in ShadeSample::compose:
+//   direct      ambient + diffuse + bounce surface light (after the denoiser when that is on)
+//   bolt        bolt emission where the camera ray hits a segment
+//   cloudnear   cloud in-scatter up to the first surface
+//   cloudfar    cloud in-scatter out to the far distance
+//   cloudtrans  cloud transmittance up to the first surface, single channel
+//   aura, core  bolt glow before the tone curve, split by the aura / core mults of every segment
+// The screen-space glow splat blurs aura and core together, with it the whole glow is in the aura layer.
+// With light groups on, the per group layers from lightGroups.h are stored alongside.
+
+enum AovLayer {
+    AOV_DIRECT,
+    AOV_BOLT,
+    AOV_CLOUD_NEAR,
+    AOV_CLOUD_FAR,
+    AOV_CLOUD_TRANSMITTANCE,
+    AOV_AURA,
+    AOV_CORE,
+    AOV_COUNT
+};
+
+const char* aovName(int layer);
+int aovChannels(int layer);
+
+// What the compositor applies on top of the layers. The defaults rebuild the rendered frame.
+struct GradeSettings {
+    float exposure = 1.0f;     // scales the final sum
+    float direct = 1.0f;       // per layer gains
+    float bolt = 1.0f;
+    float cloud = 1.0f;        // both cloud in-scatter layers
+    float aura = 1.0f;
+    float core = 1.0f;
+    float cloudShadow = 0.0f;  // 0 - 1, darkens the surface light by the cloud transmittance in front of it
+};
+
+// All layers of one frame (or tile), each a flat width * height * channels array
+struct AovFrame {
+    int width = 0;
+    int height = 0;
+    std::vector<float> layers[AOV_COUNT];
+    std::vector<float> groups[LIGHT_GROUP_TERMS * LIGHT_GROUPS];  // only after loadGroups
+    bool hasGroups = false;
+
+    // Averaged per pixel samples to layers
+    void fromSamples(const std::vector<ShadeSample>& samples, int w, int h);
+
+    bool save(const std::string& dir, const std::string& baseName) const;
+    bool load(const std::string& dir, const std::string& baseName);
+    bool loadGroups(const std::string& dir, const std::string& baseName);
+
+    // Same order of adds and clamps as ShadeSample::compose, with the gains in between. groupWeight is the
+    // intensity of every light group relative to the render (needs loadGroups). rgb gets
+    // width * height * 3 bytes.
+    void composite(const GradeSettings& grade, unsigned char* rgb, const float* groupWeight = nullptr) const;
+};
+
+// Portable Float Map, 1 (Pf) or 3 (PF) channels, little endian, rows stored bottom to top
+bool writePfm(const std::string& path, int width, int height, int channels, const float* data);
+bool readPfm(const std::string& path, int& width, int& height, int& channels, std::vector<float>& data);
+
+// Rebuilds every frame found in outDir/aov into outDir/graded. Returns the number of frames written.
+// With keys, every frame from the first key to the last is written instead, relit from the latest rendered
+// frame at or before it, so one render can be flickered over a whole range.
+int compositeAovs(const std::string& outDir, const GradeSettings& grade, const RelightKeys& keys = RelightKeys());
+
+// Puts the AOV tiles in outDir/tiles/aov together into full frames in outDir/aov
+int mergeAovTiles(const std::string& outDir);
+
+#endif
@@ -0,0 +1,125 @@
+#include "autoTune.h"
+#include "glowKernel.h"
+#include "renderJob.h"
+#include "ofMain.h"
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+static const char* KERNEL_NAMES[] = { "auto", "scalar", "avx2" };
+static const double MIN_GAIN = 1.03;  // a candidate has to be 3% faster to win
+
+std::string describeTune(const TuneSettings& s) {
+	return "threads " + ofToString(s.threads) + ", tile " + ofToString(s.tileSize) + ", glow kernel " + KERNEL_NAMES[s.glowKernel];
+}
+
+std::string defaultTuneFile() {
+	return (fs::path(defaultOutDir()).parent_path() / "tune.txt").string();
+}
+
+std::string tuneKey(int width, int height, int minSamples, int maxSamples, bool wavefront) {
+	return "hw" + ofToString(std::thread::hardware_concurrency())
+		+ (GlowKernel::avx2Supported() ? "-avx2" : "-noavx2")
+		+ "-" + ofToString(width) + "x" + ofToString(height)
+		+ "-spp" + ofToString(minSamples) + "-" + ofToString(maxSamples)
+		+ (wavefront ? "-wavefront" : "-megakernel");
+}
+
+// "KEY THREADS TILE KERNEL RATE" into settings, false if the line doesn't parse
+static bool parseLine(const std::string& line, std::string& key, TuneSettings& settings) {
+	std::istringstream in(line);
+	std::string kernel;
+	in >> key >> settings.threads >> settings.tileSize >> kernel >> settings.rate;
+	if (!in || settings.threads < 1 || settings.tileSize < 1)
+		return false;
+	for (int k = 0; k < 3; ++k) {
+		if (kernel == KERNEL_NAMES[k]) {
+			settings.glowKernel = k;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool loadTune(const std::string& path, const std::string& key, TuneSettings& settings) {
+	std::ifstream file(path);
+	if (!file)
+		return false;
+
+	std::string line;
+	while (std::getline(file, line)) {
+		if (line.empty() || line[0] == '#') continue;
+		std::string lineKey;
+		TuneSettings s;
+		if (!parseLine(line, lineKey, s)) {
+			ofLogWarning() << "Auto-tune: skipping bad line \"" << line << "\" in " << path;
+			continue;
+		}
+		if (lineKey == key) {
+			settings = s;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool saveTune(const std::string& path, const std::string& key, const TuneSettings& settings) {
+	// Keep the other machines' / settings' lines, replace ours
+	std::vector<std::string> lines;
+	{
+		std::ifstream file(path);
+		std::string line;
+		while (std::getline(file, line)) {
+			std::string lineKey;
+			TuneSettings s;
+			if (!line.empty() && line[0] != '#' && parseLine(line, lineKey, s) && lineKey == key) continue;
+			lines.push_back(line);
+		}
+	}
+	if (lines.empty())
+		lines.push_back("# --tune results: key threads tile glow-kernel pixels/s, delete a line to calibrate again");
+	std::ostringstream entry;
+	entry << key << " " << settings.threads << " " << settings.tileSize << " " << KERNEL_NAMES[settings.glowKernel]
+		<< " " << (long long)settings.rate;
+	lines.push_back(entry.str());
+
+	std::ofstream file(path, std::ios::trunc);
+	for (const std::string& line : lines)
+		file << line << "\n";
+	if (!file) {
+		ofLogError() << "Auto-tune: could not write " << path;
+		return false;
+	}
+	return true;
+}
+
+TuneSettings tuneSearch(TuneSettings start, const std::vector<int>& kernels, const std::vector<int>& threads,
+                        const std::vector<int>& tileSizes, const std::function<double(const TuneSettings&)>& rate) {
+	// The first pass also pays for first touch of the frame's data, it only warms up
+	rate(start);
+	start.rate = rate(start);
+	TuneSettings best = start;
+	ofLog() << "Auto-tune: " << describeTune(best) << ": " << best.rate / 1e6 << " Mpixel/s";
+
+	auto tryEach = [&](const std::vector<int>& values, int TuneSettings::* field) {
+		TuneSettings base = best;
+		for (int v : values) {
+			if (v == base.*field) continue;
+			TuneSettings candidate = base;
+			candidate.*field = v;
+			candidate.rate = rate(candidate);
+			ofLog() << "Auto-tune: " << describeTune(candidate) << ": " << candidate.rate / 1e6 << " Mpixel/s";
+			if (candidate.rate > best.rate * MIN_GAIN)
+				best = candidate;
+		}
+	};
+	tryEach(kernels, &TuneSettings::glowKernel);
+	tryEach(threads, &TuneSettings::threads);
+	tryEach(tileSizes, &TuneSettings::tileSize);
+
+	ofLog() << "Auto-tune: picked " << describeTune(best) << " (" << best.rate / start.rate << "x the starting settings)";
+	return best;
+}
@@ -0,0 +1,39 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <string>
+#include <vector>
+#include <functional>
+
+// How --tune picks the machine dependent settings
+enum TuneMode {
+    TUNE_OFF,     // the defaults in ofApp.h
+    TUNE_CACHED,  // the tune file's entry for this machine and these settings, calibrate if there is none
+    TUNE_FORCE    // calibrate again and replace the entry
+};
+
+// The knobs that only change speed, not pixels: worker threads, tile size and the glow kernel variant.
+// The best ones depend on cores, SMT, caches and SIMD width, so they are measured instead of guessed.
+struct TuneSettings {
+    int threads = 0;
+    int tileSize = 0;
+    int glowKernel = 0;   // GlowKernelKind
+    double rate = 0.0;    // pixels / s over the calibration slice
+};
+
+// Tune file: one line per machine and settings, "KEY THREADS TILE KERNEL RATE". The key holds what the
+// best choice depends on (hardware threads, AVX2, image size, tracer, sample range), so the file can be
+// kept on a machine across runs with different settings and copied between identical ones.
+std::string defaultTuneFile();  // <project>/tune.txt, next to the out folder
+std::string tuneKey(int width, int height, int minSamples, int maxSamples, bool wavefront);
+bool loadTune(const std::string& path, const std::string& key, TuneSettings& settings);
+bool saveTune(const std::string& path, const std::string& key, const TuneSettings& settings);
+std::string describeTune(const TuneSettings& settings);  // "threads N, tile N, glow kernel K" for the log
+
+// Coordinate search from `start`: the glow kernels, then the thread counts with the best kernel, then the
+// tile sizes. rate(settings) renders the calibration slice and returns pixels / s. A candidate only
+// replaces the current best when it is clearly faster, so timing noise doesn't move the settings around.
+TuneSettings tuneSearch(TuneSettings start, const std::vector<int>& kernels, const std::vector<int>& threads,
+                        const std::vector<int>& tileSizes, const std::function<double(const TuneSettings&)>& rate);
+
+#endif
@@ -0,0 +1,194 @@
+#include "boltTransmittance.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+
+// Same as the camera march in renderVolume: absorption exp(-density * step * 25), below 0.01 is empty
+static const float EXTINCTION_SCALE = 25.0f;
+static const float MIN_DENSITY = 0.01f;
+static const int MAX_DIM = 96;
+
+void BoltTransmittance::init(const CloudField& clouds, const std::vector<std::shared_ptr<LightningSegment>>& strike) {
+	extinction.clear();
+	if (clouds.empty() || strike.empty())
+		return;
+
+	glm::vec3 lo(1e30f), hi(-1e30f);
+	for (const auto& seg : strike) {
+		lo = glm::min(lo, glm::min(seg->startPoint, seg->endPoint));
+		hi = glm::max(hi, glm::max(seg->startPoint, seg->endPoint));
+	}
+	lo -= margin;
+	hi += margin;
+
+	// Coarser cells rather than a grid that doesn't reach around the strike
+	glm::vec3 extent = hi - lo;
+	cellSize = std::max(cellSize, std::max(extent.x, std::max(extent.y, extent.z)) / MAX_DIM);
+	dims = glm::max(glm::ivec3(glm::ceil(extent / cellSize)), glm::ivec3(2));
+	origin = lo;
+
+	size_t count = (size_t)dims.x * dims.y * dims.z;
+	extinction.assign(count, 0.0f);
+
+	// ---------- Density at every grid point, octaves finer than a cell fade out like they do for a wide pixel
+	const std::vector<Cloud>& cells = clouds.getCells();
+	parallelRows(dims.z, [&](int z0, int z1) {
+		for (int z = z0; z < z1; ++z) {
+			for (int y = 0; y < dims.y; ++y) {
+				for (int x = 0; x < dims.x; ++x) {
+					glm::vec3 p = centre(x, y, z);
+					if (clouds.densityBound(p) <= MIN_DENSITY) continue;
+					float density = 0.0f;
+					for (const Cloud& cell : cells)
+						density += cell.getDensity(p, cellSize);
+					if (density > MIN_DENSITY)
+						extinction[index(x, y, z)] = density * EXTINCTION_SCALE;
+				}
+			}
+		}
+	});
+
+	// Bounds of the cloud for clipping the marches, and where the scatter sums are worth keeping
+	cloudy.assign(count, 0);
+	cloudMin = glm::vec3(1e30f);
+	cloudMax = glm::vec3(-1e30f);
+	for (int z = 0; z < dims.z; ++z) {
+		for (int y = 0; y < dims.y; ++y) {
+			for (int x = 0; x < dims.x; ++x) {
+				if (extinction[index(x, y, z)] <= 0.0f) continue;
+				glm::vec3 p = centre(x, y, z);
+				cloudMin = glm::min(cloudMin, p - cellSize);
+				cloudMax = glm::max(cloudMax, p + cellSize);
+				for (int dz = -1; dz <= 1; ++dz)
+					for (int dy = -1; dy <= 1; ++dy)
+						for (int dx = -1; dx <= 1; ++dx) {
+							glm::ivec3 q = glm::clamp(glm::ivec3(x + dx, y + dy, z + dz), glm::ivec3(0), dims - 1);
+							cloudy[index(q.x, q.y, q.z)] = 1;
+						}
+			}
+		}
+	}
+
+	reset();
+}
+
+void BoltTransmittance::reset() {
+	size_t count = extinction.size();
+	irradianceSum.assign(count, 0.0f);
+	irradianceWeight.assign(count, 0.0f);
+	scatterSum.assign(count, 0.0f);
+	scatterWeight.assign(count, 0.0f);
+	revealed = 0;
+}
+
+bool BoltTransmittance::update(const std::vector<std::shared_ptr<LightningSegment>>& visible) {
+	if (!valid())
+		return false;
+	if (visible.size() < revealed)
+		reset();
+	if (visible.size() == revealed)
+		return false;
+
+	std::vector<const LightningSegment*> added;
+	for (size_t i = revealed; i < visible.size(); ++i) {
+		if (visible[i]->isEmissive())
+			added.push_back(visible[i].get());
+	}
+	revealed = visible.size();
+	if (added.empty())
+		return false;
+
+	parallelRows(dims.z, [&](int z0, int z1) {
+		for (int z = z0; z < z1; ++z) {
+			for (int y = 0; y < dims.y; ++y) {
+				for (int x = 0; x < dims.x; ++x) {
+					size_t k = index(x, y, z);
+					glm::vec3 p = centre(x, y, z);
+					for (const LightningSegment* seg : added) {
+						// Segments are shorter than a cell, the midpoint stands for the whole of it
+						glm::vec3 m = seg->midpoint();
+						glm::vec3 L = m - p;
+						float T = transmittance(p, m);
+
+						float w = 1.0f / (glm::dot(L, L) + 1e-4f);
+						irradianceSum[k] += w * T;
+						irradianceWeight[k] += w;
+
+						if (cloudy[k]) {
+							float glow = seg->computeGlow(p);
+							if (glow > 1e-6f) {
+								scatterSum[k] += glow * T;
+								scatterWeight[k] += glow;
+							}
+						}
+					}
+				}
+			}
+		}
+	});
+	return true;
+}
+
+float BoltTransmittance::extinctionAt(const glm::vec3& p) const {
+	glm::vec3 g = glm::clamp((p - origin) / cellSize - 0.5f, glm::vec3(0.0f), glm::vec3(dims - 1));
+	glm::ivec3 i0 = glm::min(glm::ivec3(g), dims - 2);
+	glm::vec3 f = g - glm::vec3(i0);
+
+	float c00 = glm::mix(extinction[index(i0.x, i0.y, i0.z)], extinction[index(i0.x + 1, i0.y, i0.z)], f.x);
+	float c10 = glm::mix(extinction[index(i0.x, i0.y + 1, i0.z)], extinction[index(i0.x + 1, i0.y + 1, i0.z)], f.x);
+	float c01 = glm::mix(extinction[index(i0.x, i0.y, i0.z + 1)], extinction[index(i0.x + 1, i0.y, i0.z + 1)], f.x);
+	float c11 = glm::mix(extinction[index(i0.x, i0.y + 1, i0.z + 1)], extinction[index(i0.x + 1, i0.y + 1, i0.z + 1)], f.x);
+	return glm::mix(glm::mix(c00, c10, f.y), glm::mix(c01, c11, f.y), f.z);
+}
+
+float BoltTransmittance::transmittance(const glm::vec3& from, const glm::vec3& to) const {
+	glm::vec3 d = to - from;
+	float len = glm::length(d);
+	if (len <= 0.0f) return 1.0f;
+
+	// Only the part inside the cloud bounds is marched, most paths below the cloud base skip it entirely
+	glm::vec3 invDir = 1.0f / d;
+	glm::vec3 t0 = (cloudMin - from) * invDir;
+	glm::vec3 t1 = (cloudMax - from) * invDir;
+	glm::vec3 tNear = glm::min(t0, t1);
+	glm::vec3 tFar = glm::max(t0, t1);
+	float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+	float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, 1.0f));
+	if (!(enter < exit)) return 1.0f;
+
+	int steps = std::max(1, (int)std::ceil((exit - enter) * len / cellSize));
+	float dt = (exit - enter) / steps;
+	float opticalDepth = 0.0f;
+	for (int i = 0; i < steps; ++i) {
+		opticalDepth += extinctionAt(from + d * (enter + (i + 0.5f) * dt));
+		// Nothing gets through past this
+		if (opticalDepth * dt * len > 12.0f) return 0.0f;
+	}
+	return std::exp(-opticalDepth * dt * len);
+}
+
+float BoltTransmittance::ratio(const std::vector<float>& sum, const std::vector<float>& weight, const glm::vec3& p) const {
+	glm::vec3 g = glm::clamp((p - origin) / cellSize - 0.5f, glm::vec3(0.0f), glm::vec3(dims - 1));
+	glm::ivec3 i0 = glm::min(glm::ivec3(g), dims - 2);
+	glm::vec3 f = g - glm::vec3(i0);
+
+	// Both sums interpolated on their own, the ratio follows the heavier weights
+	float s = 0.0f;
+	float w = 0.0f;
+	for (int c = 0; c < 8; ++c) {
+		int dx = c & 1, dy = (c >> 1) & 1, dz = c >> 2;
+		float b = (dx ? f.x : 1.0f - f.x) * (dy ? f.y : 1.0f - f.y) * (dz ? f.z : 1.0f - f.z);
+		size_t k = index(i0.x + dx, i0.y + dy, i0.z + dz);
+		s += sum[k] * b;
+		w += weight[k] * b;
+	}
+	return w > 1e-12f ? glm::clamp(s / w, 0.0f, 1.0f) : 1.0f;
+}
+
+float BoltTransmittance::irradiance(const glm::vec3& p) const {
+	return ratio(irradianceSum, irradianceWeight, p);
+}
+
+float BoltTransmittance::scatter(const glm::vec3& p) const {
+	return ratio(scatterSum, scatterWeight, p);
+}
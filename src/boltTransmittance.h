@@ -0,0 +1,58 @@
+#ifndef BOLTTRANSMITTANCE_H
+#define BOLTTRANSMITTANCE_H
+
+#include "cloudField.h"
+#include "lightningSegment.h"
+#include <vector>
+#include <memory>
+
+// How much of the bolt's light gets through the clouds to any point, on a coarse grid around the strike.
+// Every grid point keeps two weighted sums over the revealed segments, weight times the cloud transmittance
+// from the segment to the point and the weight alone:
+//   irradiance  weight 1 / d^2, the falloff of the surface lighting, for shadow rays at ground level
+//   scatter     weight computeGlow, what renderVolume lights the cloud with, for the in-scatter
+// A query interpolates both sums and divides, so it costs the same as one texture lookup and tracePixel /
+// renderVolume never march a secondary ray. The transmittance itself is marched through a density grid
+// sampled once per scene at the grid resolution (noise octaves below the cell size faded out), with the
+// same extinction as the camera march. Segments are added as they are revealed, a frame only pays for its
+// new segments; going back in the animation starts the sums over.
+class BoltTransmittance {
+public:
+    float cellSize = 0.2f;  // world units per grid cell
+    float margin = 2.0f;    // grid reaches this far past the whole strike
+
+    // Grid around all segments of the strike and the cloud density on it, once per scene
+    void init(const CloudField& clouds, const std::vector<std::shared_ptr<LightningSegment>>& strike);
+    bool valid() const { return !extinction.empty(); }
+
+    // Brings the sums up to the visible segments (a prefix of the strike). Returns true if anything changed.
+    bool update(const std::vector<std::shared_ptr<LightningSegment>>& visible);
+
+    // Fraction of the bolt light reaching p, 1 where no cloud is in the way (or outside the grid with none)
+    float irradiance(const glm::vec3& p) const;
+    float scatter(const glm::vec3& p) const;
+
+private:
+    glm::vec3 origin = glm::vec3(0.0f);  // corner of cell 0, grid points sit at the cell centres
+    glm::ivec3 dims = glm::ivec3(0);
+    glm::vec3 cloudMin = glm::vec3(0.0f);  // bounds of the non-empty density
+    glm::vec3 cloudMax = glm::vec3(0.0f);
+    size_t revealed = 0;
+
+    std::vector<float> extinction;  // per unit length
+    std::vector<uint8_t> cloudy;    // cloud at or next to the point, only there the scatter sums are kept
+    std::vector<float> irradianceSum;
+    std::vector<float> irradianceWeight;
+    std::vector<float> scatterSum;
+    std::vector<float> scatterWeight;
+
+    size_t index(int x, int y, int z) const { return ((size_t)z * dims.y + y) * dims.x + x; }
+    glm::vec3 centre(int x, int y, int z) const { return origin + (glm::vec3(x, y, z) + 0.5f) * cellSize; }
+
+    float extinctionAt(const glm::vec3& p) const;
+    float transmittance(const glm::vec3& from, const glm::vec3& to) const;
+    float ratio(const std::vector<float>& sum, const std::vector<float>& weight, const glm::vec3& p) const;
+    void reset();
+};
+
+#endif
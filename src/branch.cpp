@@ -175,19 +175,54 @@ float LightningSegment::minDistanceToSegment(const Ray & r) const {
 	return glm::distance(closestRay, closestSeg);
 }
 
-float LightningSegment::computeGlowForRay(const Ray & r) const {
+float LightningSegment::glowWidth() const {
+	return std::max(radius * 18.0f * (isMainBranchSegment ? 2.5f : 0.3f), 0.12f);
+}
+
+float LightningSegment::glowPower() const {
+	return isMainBranchSegment ? 1.8f : 4.5f;
+}
+
+float LightningSegment::glowPeak(float t) const {
 	float baseGlowMain = 0.08f;
 	float baseGlowChild = 0.04f;
 	float liMain = 1.2f;
 	float liChild = 0.8f;
 
-	float di = minDistanceToSegment(r);
+	float glow = (isMainBranchSegment ? baseGlowMain : baseGlowChild) * (isMainBranchSegment ? liMain : liChild);
 
-	float W = std::max(radius * 18.0f * (isMainBranchSegment ? 2.5f : 0.3f), 0.12f);
+	float tFade = isMainBranchSegment ? (1.0f - 0.3f * t) : powf(1.0f - t, 1.5f);
 
-	float power = isMainBranchSegment ? 1.8f : 4.5f;
+	float depthFactor = isMainBranchSegment ? 1.0f : powf(0.6f, branchDepth);
+
+	return glow * radius * 18.0f * tFade * depthFactor;
+}
 
-	float glow = (isMainBranchSegment ? baseGlowMain : baseGlowChild) * (isMainBranchSegment ? liMain : liChild) * expf(-powf(di / W, power));
+float LightningSegment::glowCompositeScale() const {
+	float boost = glowIsAdditive() ? 5.0f : 1.0f;
+
+	float t = glm::length(midpoint() - startPoint) / length();
+	float tFade = isMainBranchSegment ? 1.0f : (branchDepth == 1 ? 1.0f : powf(1.0f - t, 1.5f));
+	float depthFade = isMainBranchSegment ? 1.0f : (branchDepth == 1 ? 1.0f : powf(0.45f, branchDepth));
+	float finalScale = tFade * depthFade;
+
+	float auraMult = isMainBranchSegment ? 0.6f : (branchDepth == 1 ? 0.6f : 0.02f);
+	float coreMult = isMainBranchSegment ? 0.15f : (branchDepth == 1 ? 0.15f : 0.01f);
+
+	return boost * finalScale * (auraMult + coreMult);
+}
+
+float LightningSegment::glowAuraShare() const {
+	// Same mults as glowCompositeScale, everything else there is common to both
+	float auraMult = isMainBranchSegment ? 0.6f : (branchDepth == 1 ? 0.6f : 0.02f);
+	float coreMult = isMainBranchSegment ? 0.15f : (branchDepth == 1 ? 0.15f : 0.01f);
+	return auraMult / (auraMult + coreMult);
+}
+
+float LightningSegment::computeGlowForRay(const Ray & r) const {
+	float di = minDistanceToSegment(r);
+
+	float falloff = expf(-powf(di / glowWidth(), glowPower()));
 
 	glm::vec3 dir = endPoint - startPoint;
 	float len2 = glm::dot(dir, dir);
@@ -203,11 +238,36 @@ float LightningSegment::computeGlowForRay(const Ray & r) const {
 		t = glm::clamp(t, 0.0f, 1.0f);
 	}
 
-	float tFade = isMainBranchSegment ? (1.0f - 0.3f * t) : powf(1.0f - t, 1.5f);
-
-	float depthFactor = isMainBranchSegment ? 1.0f : powf(0.6f, branchDepth);
+	return falloff * glowPeak(t);
+}
 
-	float finalGlow = glow * radius * 18.0f * tFade * depthFactor;
+glm::vec3 LightningSegment::boltColor() const {
+	if (isEmissive()) {
+		float baseScale;
+		float depthFactor;
+		float fade;
+
+		if (isMainBranchSegment) {
+			baseScale = 1.0f;
+			depthFactor = 1.0f;
+			fade = 1.0f;
+		} else if (branchDepth == 1) {
+			baseScale = 0.3f;
+			depthFactor = 0.8f;
+			fade = 0.9f;
+		} else {
+			baseScale = 0.3f;
+			depthFactor = powf(0.6f, branchDepth);
+			float t = glm::length(midpoint() - startPoint) / length();
+			fade = powf(1.0f - t, 1.5f);
+		}
+
+		float intensityScale = baseScale * fade * depthFactor;
+		return lightSource->color * lightSource->intensity * intensityScale;
+	}
 
-	return finalGlow;
+	float t = glm::length(midpoint() - startPoint) / length();
+	float fade = isMainBranchSegment ? 1.0f : powf(1.0f - t, 1.5f);
+	float intensityScale = isMainBranchSegment ? 1.0f : 0.1f * fade;
+	return color * intensityScale;
 }
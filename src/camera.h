@@ -15,6 +15,9 @@ public:
     double viewportHeight = 2.0f;
     double aspectRatio = 7.0f / 9.0f;
 
+    // Footprint growth per unit distance for one pixel, copied into every ray for the cloud noise LOD
+    float pixelSpread = 0.0f;
+
     Camera() {
         double viewportWidth = aspectRatio * viewportHeight;
 
@@ -29,7 +32,33 @@ public:
     // Each pixel position u, v is in range [0,1], where (0,0) is bottom left and (1,1) is top right
     Ray getRay(double u, double v) const {
         glm::vec3 dir = glm::normalize(lowerLeft + u * horizontal + v * vertical - camera_center);
-        return Ray(camera_center, dir);
+        Ray r(camera_center, dir);
+        r.spread = pixelSpread;
+        return r;
+    }
+
+    // Pixel spacing on the viewport over its distance from the eye, the angle one pixel covers
+    void setResolution(int width, int height) {
+        float dx = glm::length(horizontal) / glm::max(1, width - 1);
+        float dy = glm::length(vertical) / glm::max(1, height - 1);
+        glm::vec3 forward = lowerLeft + horizontal * 0.5f + vertical * 0.5f - camera_center;
+        pixelSpread = glm::max(dx, dy) / glm::length(forward);
+    }
+
+    // Inverse of getRay. Projects a world point back onto the viewport, giving u, v in the same [0,1] range
+    // and the distance along the viewing axis. Returns false for points behind the camera.
+    bool project(const glm::vec3& p, float& u, float& v, float& depth) const {
+        glm::vec3 forward = lowerLeft + horizontal * 0.5f + vertical * 0.5f - camera_center;
+        glm::vec3 d = p - camera_center;
+        float along = glm::dot(d, forward);
+        if (along <= 1e-6f) return false;
+
+        float forwardLen2 = glm::dot(forward, forward);
+        glm::vec3 onPlane = camera_center + d * (forwardLen2 / along) - lowerLeft;
+        u = glm::dot(onPlane, horizontal) / glm::dot(horizontal, horizontal);
+        v = glm::dot(onPlane, vertical) / glm::dot(vertical, vertical);
+        depth = along / sqrt(forwardLen2);
+        return true;
     }
 
 };
@@ -0,0 +1,199 @@
+#include "capsuleChain.h"
+#include <algorithm>
+#include <cmath>
+
+ChainRay::ChainRay(const Ray& r) : origin(r.origin()) {
+	scale = glm::length(r.direction());
+	dir = r.direction() / scale;
+	invDir = 1.0f / dir;
+}
+
+// Slab test, with the inf / nan of axis aligned rays falling out of min / max
+static bool overlaps(const CapsuleChain::Bounds& b, const ChainRay& r, float tmin, float tmax) {
+	glm::vec3 t0 = (b.lo - r.origin) * r.invDir;
+	glm::vec3 t1 = (b.hi - r.origin) * r.invDir;
+	glm::vec3 tNear = glm::min(t0, t1);
+	glm::vec3 tFar = glm::max(t0, t1);
+	float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, tmin));
+	float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tmax));
+	return enter <= exit;
+}
+
+static bool sphereEntry(const glm::vec3& oc, const glm::vec3& rd, float radius, float& t) {
+	float b = glm::dot(oc, rd);
+	float h = b * b - glm::dot(oc, oc) + radius * radius;
+	if (h < 0.0f) return false;
+	t = -b - std::sqrt(h);
+	return true;
+}
+
+// First entry of a unit direction ray into the round cone pa (radius ra) - pb (radius rb), in (tmin, tmax).
+// Body from the cone tangent to both spheres (as in Inigo Quilez' rounded cone), the ends are the spheres.
+// A convex shape, so the smallest entry of the pieces is the entry of the whole thing.
+static bool roundCone(const glm::vec3& ro, const glm::vec3& rd, const glm::vec3& pa, const glm::vec3& pb,
+                      float ra, float rb, float tmin, float tmax, float& tHit) {
+	// Solved from the point of the ray nearest pa, the quadratics lose too much to cancellation from the eye
+	float shift = glm::dot(pa - ro, rd);
+	glm::vec3 start = ro + shift * rd;
+	tmin -= shift;
+	tmax -= shift;
+
+	glm::vec3 ba = pb - pa;
+	glm::vec3 oa = start - pa;
+	glm::vec3 ob = start - pb;
+	float rr = ra - rb;
+	float m0 = glm::dot(ba, ba);
+	float d2 = m0 - rr * rr;
+
+	float best = tmax;
+	float t;
+	if (d2 > 0.0f) {
+		float m1 = glm::dot(ba, oa);
+		float m2 = glm::dot(ba, rd);
+		float m3 = glm::dot(rd, oa);
+		float m5 = glm::dot(oa, oa);
+		float k2 = d2 - m2 * m2;
+		float k1 = d2 * m3 - m1 * m2 + m2 * rr * ra;
+		float k0 = d2 * m5 - m1 * m1 + m1 * rr * ra * 2.0f - m0 * ra * ra;
+		float h = k1 * k1 - k0 * k2;
+		if (h < 0.0f) return false;  // misses the hull, spheres included
+		if (std::fabs(k2) > 1e-12f) {
+			t = (-std::sqrt(h) - k1) / k2;
+			float y = m1 - ra * rr + t * m2;
+			if (y > 0.0f && y < d2 && t > tmin && t < best)
+				best = t;
+		}
+		if (sphereEntry(oa, rd, ra, t) && t > tmin && t < best) best = t;
+		if (sphereEntry(ob, rd, rb, t) && t > tmin && t < best) best = t;
+	}
+	else {
+		// One sphere inside the other (a span shorter than the radius change)
+		if (sphereEntry(ra > rb ? oa : ob, rd, std::max(ra, rb), t) && t > tmin && t < best) best = t;
+	}
+
+	if (best >= tmax) return false;
+	tHit = best + shift;
+	return true;
+}
+
+// Inside the span, the radius taken along the axis (a hair generous at the tapered end)
+static bool contains(const glm::vec3& pa, const glm::vec3& pb, float ra, float rb, const glm::vec3& x) {
+	glm::vec3 ba = pb - pa;
+	float len2 = glm::dot(ba, ba);
+	float s = len2 > 0.0f ? glm::clamp(glm::dot(x - pa, ba) / len2, 0.0f, 1.0f) : 0.0f;
+	float radius = ra + (rb - ra) * s + 0.002f;
+	glm::vec3 d = x - (pa + s * ba);
+	return glm::dot(d, d) <= radius * radius;
+}
+
+bool CapsuleChain::continuesWith(const LightningSegment& seg) const {
+	const LightningSegment& last = *segments.back();
+	return seg.startPoint == points.back() && seg.branchDepth == last.branchDepth &&
+	       seg.isMainBranchSegment == last.isMainBranchSegment;
+}
+
+void CapsuleChain::append(const LightningSegment& seg) {
+	if (points.empty()) {
+		points.push_back(seg.startPoint);
+		radii.push_back(seg.radius);
+	}
+	else {
+		// The joint takes the radius of the segment that starts there, the branch tapers span by span
+		radii.back() = seg.radius;
+	}
+	points.push_back(seg.endPoint);
+	radii.push_back(seg.radius);
+	segments.push_back(&seg);
+}
+
+void CapsuleChain::finish() {
+	blocks.clear();
+	bounds.lo = glm::vec3(1e30f);
+	bounds.hi = glm::vec3(-1e30f);
+	for (size_t first = 0; first < spanCount(); first += SPAN_BLOCK) {
+		size_t last = std::min(first + SPAN_BLOCK, spanCount());
+		Bounds b = { glm::vec3(1e30f), glm::vec3(-1e30f) };
+		for (size_t v = first; v <= last; ++v) {
+			b.lo = glm::min(b.lo, points[v] - radii[v]);
+			b.hi = glm::max(b.hi, points[v] + radii[v]);
+		}
+		blocks.push_back(b);
+		bounds.lo = glm::min(bounds.lo, b.lo);
+		bounds.hi = glm::max(bounds.hi, b.hi);
+	}
+}
+
+template <class Visit>
+bool CapsuleChain::walk(const ChainRay& r, float tmin, float tmax, Visit&& visit) const {
+	if (!overlaps(bounds, r, tmin, tmax))
+		return false;
+	for (size_t b = 0; b < blocks.size(); ++b) {
+		if (!overlaps(blocks[b], r, tmin, tmax))
+			continue;
+		size_t last = std::min((b + 1) * SPAN_BLOCK, spanCount());
+		for (size_t i = b * SPAN_BLOCK; i < last; ++i) {
+			if (visit(i))
+				return true;
+		}
+	}
+	return false;
+}
+
+int CapsuleChain::nearest(const ChainRay& r, float tmin, float tmax, float& t) const {
+	int best = -1;
+	walk(r, tmin, tmax, [&](size_t i) {
+		float tHit;
+		if (roundCone(r.origin, r.dir, points[i], points[i + 1], radii[i], radii[i + 1], tmin, tmax, tHit)) {
+			tmax = tHit;
+			t = tHit;
+			best = (int)i;
+		}
+		return false;
+	});
+	return best;
+}
+
+bool CapsuleChain::occluded(const ChainRay& r, float tmin, float tmax, const glm::vec3& skip) const {
+	return walk(r, tmin, tmax, [&](size_t i) {
+		float tHit;
+		return roundCone(r.origin, r.dir, points[i], points[i + 1], radii[i], radii[i + 1], tmin, tmax, tHit) &&
+		       !contains(points[i], points[i + 1], radii[i], radii[i + 1], skip);
+	});
+}
+
+void BoltChains::build(const std::vector<std::shared_ptr<LightningSegment>>& segs) {
+	chains.clear();
+
+	// generateBranch writes a step, then the whole child branch that forks off there, then the next step.
+	// The branches still open form a stack, a segment carries on one of them or starts a new one on top.
+	std::vector<size_t> open;
+	for (const auto& seg : segs) {
+		size_t depth = open.size();
+		while (depth > 0 && !chains[open[depth - 1]].continuesWith(*seg))
+			--depth;
+		if (depth > 0) {
+			// Back on a parent, the branches above it are done
+			open.resize(depth);
+		}
+		else {
+			chains.emplace_back();
+			open.push_back(chains.size() - 1);
+		}
+		chains[open.back()].append(*seg);
+	}
+
+	for (CapsuleChain& chain : chains)
+		chain.finish();
+}
+
+bool BoltChains::occluded(const Ray& r, float tmin, float tmax) const {
+	ChainRay cr(r);
+	glm::vec3 light = r.at(tmax);
+	float lo = tmin * cr.scale;
+	float hi = tmax * cr.scale;
+	for (const CapsuleChain& chain : chains) {
+		if (chain.occluded(cr, lo, hi, light))
+			return true;
+	}
+	return false;
+}
@@ -0,0 +1,86 @@
+#ifndef CAPSULECHAIN_H
+#define CAPSULECHAIN_H
+
+#include "lightningSegment.h"
+#include <vector>
+#include <memory>
+
+// A whole bolt branch as one swept-sphere polyline: consecutive segments share their end points, so the
+// branch is stored as its vertices with a radius each, and every span between two vertices is a round cone
+// (the convex hull of the two end spheres). Joints come out round instead of the gaps and overlaps flat
+// capped cylinders leave at kinks, and a ray tests the branch bounds, then the bounds of blocks of
+// SPAN_BLOCK spans, and only the spans in the blocks it actually crosses.
+
+// Ray prepared once for all chains. The round cone maths wants a unit direction, t is converted back.
+struct ChainRay {
+    glm::vec3 origin;
+    glm::vec3 dir;     // unit length
+    glm::vec3 invDir;
+    float scale;       // length of the original direction, t_unit = t * scale
+
+    explicit ChainRay(const Ray& r);
+};
+
+class CapsuleChain {
+public:
+    static const int SPAN_BLOCK = 8;
+
+    struct Bounds {
+        glm::vec3 lo;
+        glm::vec3 hi;
+    };
+
+    std::vector<glm::vec3> points;                  // span i runs from points[i] to points[i + 1]
+    std::vector<float> radii;                       // per vertex
+    std::vector<const LightningSegment*> segments;  // the segment each span stands for (bolt colour, light)
+    Bounds bounds;
+    std::vector<Bounds> blocks;
+
+    size_t spanCount() const { return segments.size(); }
+
+    // Does segment seg carry on from the end of this chain (same branch, next step)?
+    bool continuesWith(const LightningSegment& seg) const;
+    void append(const LightningSegment& seg);
+    void finish();  // bounds, after the last append
+
+    // Nearest span in (tmin, tmax), t in the units of ChainRay (unit direction). -1 on a miss.
+    int nearest(const ChainRay& r, float tmin, float tmax, float& t) const;
+
+    // Any span in (tmin, tmax) that doesn't contain the point skip
+    bool occluded(const ChainRay& r, float tmin, float tmax, const glm::vec3& skip) const;
+
+private:
+    template <class Visit>
+    bool walk(const ChainRay& r, float tmin, float tmax, Visit&& visit) const;
+};
+
+// Every branch of the visible part of a bolt, rebuilt per frame from the segment list
+class BoltChains {
+public:
+    std::vector<CapsuleChain> chains;
+
+    // segs in generation order (a branch's segments in sequence, child branches in between)
+    void build(const std::vector<std::shared_ptr<LightningSegment>>& segs);
+    bool empty() const { return chains.empty(); }
+
+    // hit(segment) once per chain the ray crosses in (tmin, tmax), with the segment of the nearest span.
+    // A branch adds its bolt colour once, also where it overlaps itself at a joint.
+    template <class Hit>
+    void forEachHit(const Ray& r, float tmin, float tmax, Hit&& hit) const {
+        ChainRay cr(r);
+        float lo = tmin * cr.scale;
+        float hi = tmax * cr.scale;
+        for (const CapsuleChain& chain : chains) {
+            float t;
+            int span = chain.nearest(cr, lo, hi, t);
+            if (span >= 0)
+                hit(*chain.segments[span]);
+        }
+    }
+
+    // Shadow ray towards a point on a bolt light: the spans around the ray's end point are the light
+    // itself and don't count (the cylinder version skipped the light's own segment).
+    bool occluded(const Ray& r, float tmin, float tmax) const;
+};
+
+#endif
@@ -4,9 +4,8 @@
 #include "ray.h"
 #include <vector>
 #include <memory>
-
-// Forward declaration
-class LightningSegment;
+#include <algorithm>
+#include <cmath>
 
 class Cloud {
 public:
@@ -49,13 +48,23 @@ public:
         return res;
     }
     
-    float fbm(const glm::vec3& p, int octaves = 5) const {
+    // footprint is the pixel footprint in noise space. An octave needs cells of at least two footprints to
+    // be resolved (Nyquist), so octaves fade to the noise mean (0.5) as their cells shrink from four to two
+    // footprints and past that aren't evaluated at all. Distant cloud stops aliasing and costs fewer noise
+    // lookups. 0 keeps every octave.
+    float fbm(const glm::vec3& p, int octaves = 5, float footprint = 0.0f) const {
         float value = 0.0f;
         float amplitude = 0.5f;
         float frequency = 1.0f;
         
         for (int i = 0; i < octaves; i++) {
-            value += amplitude * noise3D(p * frequency);
+            float keep = footprint > 0.0f ? glm::clamp(0.5f / (frequency * footprint) - 1.0f, 0.0f, 1.0f) : 1.0f;
+            if (keep >= 1.0f)
+                value += amplitude * noise3D(p * frequency);
+            else if (keep > 0.0f)
+                value += amplitude * glm::mix(0.5f, noise3D(p * frequency), keep);
+            else
+                value += amplitude * 0.5f;
             frequency *= 2.0f;
             amplitude *= 0.5f;
         }
@@ -63,7 +72,8 @@ public:
         return value;
     }
     
-    float getDensity(const glm::vec3& point) const {
+    // footprint: world size of the pixel footprint at this point, for the noise LOD
+    float getDensity(const glm::vec3& point, float footprint = 0.0f) const {
         if (!contains(point)) return 0.0f;
         
         glm::vec3 localPoint = (point - center) / size;
@@ -77,13 +87,13 @@ public:
         float verticalFalloff = smoothstep(1.0f, -0.3f, heightFactor);
         verticalFalloff = glm::pow(verticalFalloff, 0.5f);
         
-        float noise1 = fbm(point * 1.0f, 6);
-        float noise2 = fbm(point * 3.0f, 4);
-        float noise3 = fbm(point * 8.0f, 3);
+        float noise1 = fbm(point * 1.0f, 6, footprint * 1.0f);
+        float noise2 = fbm(point * 3.0f, 4, footprint * 3.0f);
+        float noise3 = fbm(point * 8.0f, 3, footprint * 8.0f);
         
         float combinedNoise = noise1 * 0.6f + noise2 * 0.3f + noise3 * 0.1f;
         
-        float turbulence = fbm(point * 2.0f + glm::vec3(100.0f), 5);
+        float turbulence = fbm(point * 2.0f + glm::vec3(100.0f), 5, footprint * 2.0f);
         combinedNoise = glm::mix(combinedNoise, turbulence, 0.5f);
         
         float stormDensity = 1.0f - heightFactor * 0.3f;
@@ -113,6 +123,25 @@ public:
         return tMax > tMin && tMax > 0.0f;
     }
     
+    // Upper bound of getDensity inside a box, from the falloffs alone (the noise is always below 1).
+    // The falloffs only shrink away from the centre column and towards the top, so the bound is the
+    // envelope at the box point closest to the axis and lowest in y.
+    float densityBound(const glm::vec3& boxMin, const glm::vec3& boxMax) const {
+        glm::vec3 lo = (glm::max(boxMin, center - size * 0.5f) - center) / size;
+        glm::vec3 hi = (glm::min(boxMax, center + size * 0.5f) - center) / size;
+        if (lo.x > hi.x || lo.y > hi.y || lo.z > hi.z) return 0.0f;
+
+        auto minAbs = [](float a, float b) { return (a <= 0.0f && b >= 0.0f) ? 0.0f : std::min(std::fabs(a), std::fabs(b)); };
+        float heightFactor = lo.y + 0.5f;
+
+        float edgeFalloff = smoothstep(0.5f, 0.1f, minAbs(lo.x, hi.x)) * smoothstep(0.5f, 0.05f, minAbs(lo.z, hi.z));
+        float verticalFalloff = glm::pow(smoothstep(1.0f, -0.3f, heightFactor), 0.5f);
+        float stormDensity = glm::pow(1.0f - heightFactor * 0.3f, 1.2f);
+
+        float bound = glm::pow(density * edgeFalloff * verticalFalloff * stormDensity, 0.5f) * 1.8f;
+        return glm::clamp(bound, 0.0f, 2.5f);
+    }
+
 private:
     float smoothstep(float edge0, float edge1, float x) const {
         float t = glm::clamp((x - edge0) / (edge1 - edge0), 0.0f, 1.0f);
@@ -120,70 +149,4 @@ private:
     }
 };
 
-class LightningSegment;
-
-inline glm::vec3 renderVolume(const Ray& r, const std::vector<Cloud>& clouds, 
-                              float maxDist, const glm::vec3& backgroundColor,
-                              const std::vector<std::shared_ptr<LightningSegment>>& lightningSegs) {
-    const float STEP_SIZE = 0.05f;
-    
-    glm::vec3 color = backgroundColor;
-    float transmittance = 1.0f;
-    
-    for (const auto& cloud : clouds) {
-        float tMin, tMax;
-        if (!cloud.intersect(r, tMin, tMax)) continue;
-        
-        tMin = glm::max(tMin, 0.0f);
-        tMax = glm::min(tMax, maxDist);
-        
-        if (tMin >= tMax) continue;
-        
-        float t = tMin;
-        int steps = 0;
-        const int MAX_STEPS = 150;
-        
-        while (t < tMax && transmittance > 0.002f && steps < MAX_STEPS) {
-            glm::vec3 pos = r.at(t);
-            float localDensity = cloud.getDensity(pos);
-            
-            if (localDensity > 0.01f) {
-                // Lightning illumination (REDUCED REFLECTION)
-                float lightningGlow = 0.0f;
-                glm::vec3 lightColor = glm::vec3(1.0f, 0.85f, 0.95f);
-                
-                for (const auto& seg : lightningSegs) {
-                    if (seg->isEmissive()) {
-                        float glow = seg->computeGlow(pos);
-                        lightningGlow += glow;
-                    }
-                }
-                
-                float absorption = exp(-localDensity * STEP_SIZE * 25.0f);
-                
-                // Reduced ambient light
-                glm::vec3 ambient = glm::vec3(0.01f, 0.015f, 0.02f); // Was 0.03, 0.04, 0.05
-                
-                // REDUCED scattered light multiplier (was 2.0f, now 0.5f)
-                glm::vec3 scattered = lightColor * lightningGlow * localDensity * 0.5f;
-                
-                // REDUCED edge lighting (was 0.08f, now 0.02f)
-                float edgeLight = glm::pow(1.0f - localDensity, 3.0f) * 0.02f;
-                
-                glm::vec3 cloudColor = (cloud.color * 0.5f + ambient) * (1.0f + edgeLight) + scattered;
-                
-                // REDUCED overall contribution (was 6.0f, now 2.0f)
-                float contribution = transmittance * (1.0f - absorption) * localDensity;
-                color += cloudColor * contribution * 2.0f;
-                
-                transmittance *= absorption;
-            }
-            
-            t += STEP_SIZE;
-            steps++;
-        }
-    }
-    
-    return color;
-}
 #endif
\ No newline at end of file
@@ -0,0 +1,243 @@
+#include "cloudField.h"
+#include "boltTransmittance.h"
+#include <algorithm>
+#include <cmath>
+
+void CloudField::build(const std::vector<Cloud>& newCells) {
+	cells = newCells;
+	order.resize(cells.size());
+	for (uint32_t i = 0; i < order.size(); ++i)
+		order[i] = i;
+
+	nodes.clear();
+	if (!cells.empty())
+		buildNode(0, (uint32_t)cells.size());
+
+	// ---------- Sparse density bounds, only the bricks some cell overlaps exist
+	bricks.clear();
+	for (const Cloud& cell : cells) {
+		glm::vec3 boxMin = cell.center - cell.size * 0.5f;
+		glm::vec3 boxMax = cell.center + cell.size * 0.5f;
+		glm::ivec3 b0 = glm::ivec3(glm::floor(boxMin / brickSize));
+		glm::ivec3 b1 = glm::ivec3(glm::floor(boxMax / brickSize));
+
+		for (int z = b0.z; z <= b1.z; ++z) {
+			for (int y = b0.y; y <= b1.y; ++y) {
+				for (int x = b0.x; x <= b1.x; ++x) {
+					glm::vec3 brickMin = glm::vec3(x, y, z) * brickSize;
+					float bound = cell.densityBound(brickMin, brickMin + glm::vec3(brickSize));
+					// Small margin so rounding never turns the bound into an underestimate
+					bricks[brickKey(x, y, z)] += bound * 1.001f + 1e-5f;
+				}
+			}
+		}
+	}
+}
+
+uint32_t CloudField::buildNode(uint32_t begin, uint32_t end) {
+	uint32_t index = (uint32_t)nodes.size();
+	nodes.push_back(Node());
+
+	glm::vec3 boxMin(1e30f), boxMax(-1e30f), centreMin(1e30f), centreMax(-1e30f);
+	for (uint32_t i = begin; i < end; ++i) {
+		const Cloud& c = cells[order[i]];
+		boxMin = glm::min(boxMin, c.center - c.size * 0.5f);
+		boxMax = glm::max(boxMax, c.center + c.size * 0.5f);
+		centreMin = glm::min(centreMin, c.center);
+		centreMax = glm::max(centreMax, c.center);
+	}
+	nodes[index].boxMin = boxMin;
+	nodes[index].boxMax = boxMax;
+
+	const uint32_t LEAF_SIZE = 2;
+	if (end - begin <= LEAF_SIZE) {
+		nodes[index].first = begin;
+		nodes[index].count = end - begin;
+		return index;
+	}
+
+	// Median split along the axis the centres spread most on
+	glm::vec3 extent = centreMax - centreMin;
+	int axis = (extent.x > extent.y && extent.x > extent.z) ? 0 : (extent.y > extent.z ? 1 : 2);
+	uint32_t mid = (begin + end) / 2;
+	std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+		[&](uint32_t a, uint32_t b) { return cells[a].center[axis] < cells[b].center[axis]; });
+
+	buildNode(begin, mid);
+	uint32_t right = buildNode(mid, end);
+	nodes[index].first = right;
+	nodes[index].count = 0;
+	return index;
+}
+
+uint64_t CloudField::brickKey(int x, int y, int z) const {
+	const int BIAS = 1 << 20;
+	return ((uint64_t)(x + BIAS) << 42) | ((uint64_t)(y + BIAS) << 21) | (uint64_t)(z + BIAS);
+}
+
+float CloudField::densityBound(const glm::vec3& p) const {
+	glm::ivec3 b = glm::ivec3(glm::floor(p / brickSize));
+	auto it = bricks.find(brickKey(b.x, b.y, b.z));
+	return it == bricks.end() ? 0.0f : it->second;
+}
+
+void CloudField::intervals(const Ray& r, float maxDist, std::vector<Interval>& out) const {
+	out.clear();
+	if (nodes.empty()) return;
+
+	glm::vec3 invDir = 1.0f / r.dir;
+	uint32_t stack[64];
+	int top = 0;
+	stack[top++] = 0;
+
+	while (top > 0) {
+		const Node& node = nodes[stack[--top]];
+
+		// Same slab test as Cloud::intersect, limited to [0, maxDist]
+		glm::vec3 t0 = (node.boxMin - r.orig) * invDir;
+		glm::vec3 t1 = (node.boxMax - r.orig) * invDir;
+		glm::vec3 tNear = glm::min(t0, t1);
+		glm::vec3 tFar = glm::max(t0, t1);
+		float tMin = glm::max(glm::max(tNear.x, tNear.y), tNear.z);
+		float tMax = glm::min(glm::min(tFar.x, tFar.y), tFar.z);
+		if (!(tMax > tMin && tMax > 0.0f && tMin < maxDist)) continue;
+
+		if (node.count == 0) {
+			uint32_t self = (uint32_t)(&node - nodes.data());
+			stack[top++] = node.first;
+			stack[top++] = self + 1;
+			continue;
+		}
+
+		for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+			float enter, exit;
+			if (!cells[order[i]].intersect(r, enter, exit)) continue;
+			enter = glm::max(enter, 0.0f);
+			exit = glm::min(exit, maxDist);
+			if (enter >= exit) continue;
+			out.push_back({ enter, exit, order[i] });
+		}
+	}
+
+	std::sort(out.begin(), out.end(), [](const Interval& a, const Interval& b) {
+		return a.tEnter < b.tEnter || (a.tEnter == b.tEnter && a.cell < b.cell);
+	});
+}
+
+glm::vec3 renderVolume(const Ray& r, const CloudField& clouds, float maxDist, const glm::vec3& backgroundColor,
+                       const std::vector<std::shared_ptr<LightningSegment>>& lightningSegs,
+                       float* transmittanceOut, glm::vec3* groupScatter, const BoltTransmittance* lightShadow) {
+	const float STEP_SIZE = 0.05f;
+	const int MAX_STEPS = 150;
+
+	thread_local std::vector<CloudField::Interval> spans;
+	thread_local std::vector<uint32_t> active;
+	clouds.intervals(r, maxDist, spans);
+	const std::vector<Cloud>& cells = clouds.getCells();
+
+	glm::vec3 color = backgroundColor;
+	float transmittance = 1.0f;
+
+	size_t next = 0;
+	while (next < spans.size() && transmittance > 0.002f) {
+		// One march over the union of the spans that overlap, starting at the nearest entry
+		float t = spans[next].tEnter;
+		float tEnd = spans[next].tExit;
+		size_t last = next + 1;
+		while (last < spans.size() && spans[last].tEnter <= tEnd) {
+			tEnd = glm::max(tEnd, spans[last].tExit);
+			last++;
+		}
+
+		active.clear();
+		size_t added = next;
+		int steps = 0;
+
+		while (t < tEnd && transmittance > 0.002f && steps < MAX_STEPS) {
+			// Cells whose span contains t
+			while (added < last && spans[added].tEnter <= t)
+				active.push_back((uint32_t)added++);
+			active.erase(std::remove_if(active.begin(), active.end(),
+				[&](uint32_t k) { return spans[k].tExit <= t; }), active.end());
+
+			glm::vec3 pos = r.at(t);
+
+			// Bricks that can't get over the threshold below skip the noise
+			if (!active.empty() && clouds.densityBound(pos) > 0.01f) {
+				float localDensity = 0.0f;
+				glm::vec3 cellColor(0.0f);
+				glm::vec3 weightedColor(0.0f);
+				int contributing = 0;
+				for (uint32_t k : active) {
+					const Cloud& cloud = cells[spans[k].cell];
+					float d = cloud.getDensity(pos, r.spread * t);
+					if (d <= 0.0f) continue;
+					if (contributing++ == 0) cellColor = cloud.color;
+					weightedColor += cloud.color * d;
+					localDensity += d;
+				}
+				// Overlapping cells add their densities, the colour is density weighted
+				if (contributing > 1)
+					cellColor = weightedColor / localDensity;
+
+				if (localDensity > 0.01f) {
+					// Lightning illumination (REDUCED REFLECTION)
+					float lightningGlow = 0.0f;
+					float groupGlow[LIGHT_GROUPS] = {};
+					glm::vec3 lightColor = glm::vec3(1.0f, 0.85f, 0.95f);
+
+					for (const auto& seg : lightningSegs) {
+						if (seg->isEmissive()) {
+							float glow = seg->computeGlow(pos);
+							lightningGlow += glow;
+							if (groupScatter)
+								groupGlow[lightGroup(*seg)] += glow;
+						}
+					}
+
+					// Cloud between the bolt and this step
+					if (lightShadow) {
+						float reach = lightShadow->scatter(pos);
+						lightningGlow *= reach;
+						for (int g = 0; g < LIGHT_GROUPS; ++g)
+							groupGlow[g] *= reach;
+					}
+
+					float absorption = exp(-localDensity * STEP_SIZE * 25.0f);
+
+					// Reduced ambient light
+					glm::vec3 ambient = glm::vec3(0.01f, 0.015f, 0.02f); // Was 0.03, 0.04, 0.05
+
+					// REDUCED scattered light multiplier (was 2.0f, now 0.5f)
+					glm::vec3 scattered = lightColor * lightningGlow * localDensity * 0.5f;
+
+					// REDUCED edge lighting (was 0.08f, now 0.02f)
+					float edgeLight = glm::pow(1.0f - localDensity, 3.0f) * 0.02f;
+
+					glm::vec3 cloudColor = (cellColor * 0.5f + ambient) * (1.0f + edgeLight) + scattered;
+
+					// REDUCED overall contribution (was 6.0f, now 2.0f)
+					float contribution = transmittance * (1.0f - absorption) * localDensity;
+					color += cloudColor * contribution * 2.0f;
+
+					// The scattered part is the only one the bolt's light goes into
+					if (groupScatter) {
+						for (int g = 0; g < LIGHT_GROUPS; ++g)
+							groupScatter[g] += lightColor * groupGlow[g] * localDensity * 0.5f * contribution * 2.0f;
+					}
+
+					transmittance *= absorption;
+				}
+			}
+
+			t += STEP_SIZE;
+			steps++;
+		}
+
+		next = last;
+	}
+
+	if (transmittanceOut)
+		*transmittanceOut = transmittance;
+	return color;
+}
@@ -0,0 +1,69 @@
+#ifndef CLOUDFIELD_H
+#define CLOUDFIELD_H
+
+#include "cloud.h"
+#include "lightningSegment.h"
+#include "lightGroups.h"
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
+
+// Acceleration structure over any number of (overlapping) cloud cells.
+// A BVH over the cell boxes gives the cells a ray passes through, sorted by entry, so the march is one
+// ordered pass over the union of their spans with the densities of overlapping cells added up. A sparse
+// grid of bricks, only allocated where a cell exists, keeps an upper bound of the density, and samples in
+// bricks that can't reach the march threshold skip the noise entirely. Memory and march cost follow the
+// occupied volume instead of the number of cells times their size.
+class CloudField {
+public:
+    float brickSize = 0.5f;  // world units per brick side
+
+    void build(const std::vector<Cloud>& cells);
+
+    bool empty() const { return cells.empty(); }
+    const std::vector<Cloud>& getCells() const { return cells; }
+    size_t brickCount() const { return bricks.size(); }
+
+    // A cell's span along a ray
+    struct Interval {
+        float tEnter;
+        float tExit;
+        uint32_t cell;
+    };
+
+    // Spans of every cell the ray passes through within [0, maxDist], sorted by entry
+    void intervals(const Ray& r, float maxDist, std::vector<Interval>& out) const;
+
+    // Upper bound of the summed density around a point, 0 outside every cell
+    float densityBound(const glm::vec3& p) const;
+
+private:
+    struct Node {
+        glm::vec3 boxMin;
+        glm::vec3 boxMax;
+        uint32_t first;  // leaf: first index into order, inner: index of the right child (left is next)
+        uint32_t count;  // 0 for inner nodes
+    };
+
+    std::vector<Cloud> cells;
+    std::vector<uint32_t> order;  // cell indices, grouped by leaf
+    std::vector<Node> nodes;
+    std::unordered_map<uint64_t, float> bricks;
+
+    uint32_t buildNode(uint32_t begin, uint32_t end);
+    uint64_t brickKey(int x, int y, int z) const;
+};
+
+class BoltTransmittance;
+
+// Cloud in-scatter along a ray up to maxDist, added on top of backgroundColor. The transmittance left at
+// the end of the march goes to transmittanceOut when given, and the part of the in-scatter lit by each
+// light group is added to groupScatter[LIGHT_GROUPS]. With lightShadow the bolt light reaching every step
+// is cut by the cloud between it and the bolt.
+glm::vec3 renderVolume(const Ray& r, const CloudField& clouds, float maxDist, const glm::vec3& backgroundColor,
+                       const std::vector<std::shared_ptr<LightningSegment>>& lightningSegs,
+                       float* transmittanceOut = nullptr, glm::vec3* groupScatter = nullptr,
+                       const BoltTransmittance* lightShadow = nullptr);
+
+#endif
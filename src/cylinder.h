@@ -5,7 +5,7 @@
 #include "hittable.h"
 #include "ray.h"
 
-class Cylinder : public hittable {
+class Cylinder : public hittableShape<Cylinder> {
 public:
     Cylinder(glm::vec3 c, float r, float h, glm::vec3 col, glm::vec3 ax)
         : center(c), radius(r), height(h), color(col), axis(ax){
@@ -18,7 +18,8 @@ public:
     glm::vec3 color;
     glm::vec3 axis; // A normalized vec3 for the central axis
 
-    bool hit(const Ray& r, float t_min, float t_max, hit_record& rec) const override {
+    template <HitQuery Q>
+    bool intersect(const Ray& r, float t_min, float t_max, hit_record& rec) const {
         int hit_type = 0;
         
         // ---------- Build an orthogonal around cylinder centre axis (where are my lin alg 2 notes???)
@@ -74,6 +75,7 @@ public:
                 // Discard if the y-value of the ray-intersection lies beyond the cylinder's height
                 float y_local = local_orig.y + t1 * local_dir.y;
                 if (y_local >= - height / 2.0f && y_local <= height / 2.0f) {
+                    if (Q == HitQuery::Occlusion) return true;
                     if (t1 < t_cyl)
                     {
                         t_cyl = t1;
@@ -86,6 +88,7 @@ public:
             if (t2 > t_min && t2 < t_max) {
                 float y_local = local_orig.y + t2 * local_dir.y;
                 if (y_local >=  - height / 2.0f && y_local <= height / 2.0f) {
+                    if (Q == HitQuery::Occlusion) return true;
                     if (t2 < t_cyl) {
                         t_cyl = t2;
                         hit_type = 1;
@@ -104,6 +107,7 @@ public:
 
                 // Discard if the ray-intersection lies outside the radius. Set hit type.
                 if (p.x * p.x + p.z * p.z <= radius * radius) {
+                    if (Q == HitQuery::Occlusion) return true;
                     if (t_top < t_cyl) {
                         t_cyl = t_top;
                         hit_type = 2;
@@ -116,6 +120,7 @@ public:
             if (t_bottom > t_min && t_bottom < t_max) {
                 glm::vec3 p = local_orig + t_bottom * local_dir;
                 if (p.x * p.x + p.z * p.z <= radius * radius) {
+                    if (Q == HitQuery::Occlusion) return true;
                     if (t_bottom < t_cyl) {
                         t_cyl = t_bottom;
                         hit_type = 3;
@@ -127,6 +132,9 @@ public:
         // Resolve Collisions in local space then translate to world space
         if (t_cyl < 1e20f) {
             rec.t = t_cyl;
+            if (Q != HitQuery::Closest)
+                return true;
+
             rec.p = r.orig + t_cyl * r.dir;
 
             // Initiate the point in local space
@@ -0,0 +1,91 @@
+#include "denoise.h"
+#include "parallel.h"
+#include <cmath>
+
+static float luminance(const glm::vec3& c) {
+	return glm::dot(c, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+void denoiseDirect(std::vector<ShadeSample>& gbuffer, int width, int height, const DenoiseSettings& settings) {
+	const float EPS = 1e-3f;
+	int count = width * height;
+
+	// ---------- Per pixel guides, normalized by how much of the pixel hit a surface
+	std::vector<glm::vec3> normal(count);
+	std::vector<float> depth(count);
+	std::vector<float> emissive(count);
+	std::vector<bool> valid(count);
+	std::vector<glm::vec3> irradiance(count);
+
+	for (int i = 0; i < count; ++i) {
+		const ShadeSample& g = gbuffer[i];
+		valid[i] = g.coverage > 0.0f;
+		if (!valid[i]) continue;
+
+		float inv = 1.0f / g.coverage;
+		float nLen = glm::length(g.normal);
+		normal[i] = nLen > 0.0f ? g.normal / nLen : glm::vec3(0.0f);
+		depth[i] = g.depth * inv;
+		emissive[i] = g.emissive;
+
+		// Demodulate, the texture-free irradiance is much smoother than the lit colour
+		glm::vec3 a = glm::max(g.albedo, glm::vec3(EPS));
+		irradiance[i] = g.direct / a;
+	}
+
+	// ---------- A-trous passes with a B3 spline kernel
+	const float kernel[5] = { 1.0f / 16.0f, 1.0f / 4.0f, 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+	std::vector<glm::vec3> next(count);
+
+	for (int it = 0; it < settings.iterations; ++it) {
+		int step = 1 << it;
+
+		parallelRows(height, [&](int yStart, int yEnd) {
+			for (int y = yStart; y < yEnd; ++y) {
+				for (int x = 0; x < width; ++x) {
+					int p = y * width + x;
+					if (!valid[p]) {
+						next[p] = irradiance[p];
+						continue;
+					}
+
+					float lp = luminance(irradiance[p]);
+					glm::vec3 sum(0.0f);
+					float wSum = 0.0f;
+
+					for (int j = -2; j <= 2; ++j) {
+						int qy = y + j * step;
+						if (qy < 0 || qy >= height) continue;
+						for (int i = -2; i <= 2; ++i) {
+							int qx = x + i * step;
+							if (qx < 0 || qx >= width) continue;
+							int q = qy * width + qx;
+							if (!valid[q]) continue;
+
+							// Edge stopping on geometry, lighting and the bolt mask
+							float wn = powf(glm::max(0.0f, glm::dot(normal[p], normal[q])), settings.sigmaNormal);
+							float wz = expf(-fabs(depth[p] - depth[q]) / (settings.sigmaDepth * step * depth[p] + EPS));
+							float lq = luminance(irradiance[q]);
+							float wl = expf(-fabs(lp - lq) / (settings.sigmaLuminance * 0.5f * (lp + lq) + EPS));
+							float we = 1.0f - glm::min(1.0f, fabs(emissive[p] - emissive[q]));
+
+							float w = kernel[i + 2] * kernel[j + 2] * wn * wz * wl * we;
+							sum += irradiance[q] * w;
+							wSum += w;
+						}
+					}
+
+					next[p] = wSum > 0.0f ? sum / wSum : irradiance[p];
+				}
+			}
+		});
+
+		irradiance.swap(next);
+	}
+
+	// ---------- Remodulate
+	for (int i = 0; i < count; ++i) {
+		if (!valid[i]) continue;
+		gbuffer[i].direct = irradiance[i] * glm::max(gbuffer[i].albedo, glm::vec3(EPS));
+	}
+}
@@ -0,0 +1,20 @@
+#ifndef DENOISE_H
+#define DENOISE_H
+
+#include "shadeSample.h"
+#include <vector>
+
+struct DenoiseSettings {
+    int iterations = 5;           // a-trous passes, the footprint doubles each pass (5 -> 65x65 pixels)
+    float sigmaNormal = 64.0f;    // exponent on dot(n_p, n_q)
+    float sigmaDepth = 0.02f;     // relative depth difference tolerated per unit of step size
+    float sigmaLuminance = 2.0f;  // relative irradiance difference tolerated
+};
+
+// Edge-avoiding a-trous wavelet filter over the direct lighting only.
+// The direct term is demodulated by albedo, filtered with weights from the primary hit normal, depth,
+// irradiance and the emissive mask, then remodulated. Bolt, cloud and glow terms are left untouched so
+// compose() afterwards gives the denoised pixel.
+void denoiseDirect(std::vector<ShadeSample>& gbuffer, int width, int height, const DenoiseSettings& settings);
+
+#endif
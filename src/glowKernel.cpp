@@ -0,0 +1,285 @@
+#include "glowKernel.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define GLOW_KERNEL_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define GLOW_AVX2_TARGET
+#else
+// Only these functions get AVX2 code, the rest of the build stays at the baseline instruction set
+#define GLOW_AVX2_TARGET __attribute__((target("avx2,fma")))
+#endif
+#endif
+
+static const size_t LANES = 8;
+
+bool GlowKernel::avx2Supported() {
+#if defined(GLOW_KERNEL_X86) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	bool fma = (info[2] & (1 << 12)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	if (!fma || !osxsave) return false;
+	// The OS has to save the ymm registers
+	if ((_xgetbv(0) & 6) != 6) return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#elif defined(GLOW_KERNEL_X86)
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+	return false;
+#endif
+}
+
+void GlowKernel::build(const std::vector<std::shared_ptr<LightningSegment>>& list, GlowKernelKind kind) {
+	count = list.size();
+	if (kind == GLOW_KERNEL_AUTO)
+		kind = avx2Supported() ? GLOW_KERNEL_AVX2 : GLOW_KERNEL_SCALAR;
+	else if (kind == GLOW_KERNEL_AVX2 && !avx2Supported())
+		kind = GLOW_KERNEL_SCALAR;
+	active = kind;
+
+	// Padding lanes are a unit segment far away with no peak, they come out as exactly zero
+	size_t padded = (count + LANES - 1) / LANES * LANES;
+	segs.assign(count, nullptr);
+	sx.assign(padded, 0.0f); sy.assign(padded, 0.0f); sz.assign(padded, 0.0f);
+	dx.assign(padded, 1.0f); dy.assign(padded, 0.0f); dz.assign(padded, 0.0f);
+	len2.assign(padded, 1.0f);
+	invWidth.assign(padded, 1.0f);
+	power.assign(padded, 1.0f);
+	peakScale.assign(padded, 0.0f);
+	mainBranch.assign(padded, 0.0f);
+	compositeScale.assign(count, 0.0f);
+	auraShare.assign(count, 0.0f);
+	additive.assign(count, 0);
+	group.assign(count, 0);
+
+	for (size_t i = 0; i < count; ++i) {
+		const LightningSegment& seg = *list[i];
+		glm::vec3 d = seg.endPoint - seg.startPoint;
+		segs[i] = &seg;
+		sx[i] = seg.startPoint.x; sy[i] = seg.startPoint.y; sz[i] = seg.startPoint.z;
+		dx[i] = d.x; dy[i] = d.y; dz[i] = d.z;
+		len2[i] = glm::dot(d, d);
+		invWidth[i] = 1.0f / seg.glowWidth();
+		power[i] = seg.glowPower();
+		compositeScale[i] = seg.glowCompositeScale();
+		mainBranch[i] = seg.isMainBranchSegment ? 1.0f : 0.0f;
+		// glowPeak is this times the fade along t (1 at t = 0 for both kinds)
+		peakScale[i] = seg.glowPeak(0.0f) * compositeScale[i];
+		auraShare[i] = seg.glowAuraShare();
+		additive[i] = seg.glowIsAdditive() ? 1 : 0;
+		group[i] = (uint8_t)lightGroup(seg);
+	}
+}
+
+void GlowKernel::evaluate(const Ray& r, float* out) const {
+	if (active == GLOW_KERNEL_AVX2)
+		evaluateAvx2(r, out);
+	else
+		evaluateScalar(r, out);
+}
+
+void GlowKernel::evaluateScalar(const Ray& r, float* out) const {
+	for (size_t i = 0; i < count; ++i)
+		out[i] = segs[i]->computeGlowForRay(r) * compositeScale[i];
+}
+
+#if defined(GLOW_KERNEL_X86)
+
+// ---------- 8 wide exp / log, the Cephes polynomials (as in avx_mathfun), a couple of ulp off expf / logf
+
+GLOW_AVX2_TARGET static inline __m256 expAvx(__m256 x) {
+	x = _mm256_min_ps(x, _mm256_set1_ps(88.3762626647949f));
+	// Down here 2^n has a zero exponent field, the result is exactly 0
+	x = _mm256_max_ps(x, _mm256_set1_ps(-88.3762626647949f));
+
+	__m256 fx = _mm256_fmadd_ps(x, _mm256_set1_ps(1.44269504088896341f), _mm256_set1_ps(0.5f));
+	fx = _mm256_floor_ps(fx);
+	x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(0.693359375f), x);
+	x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(-2.12194440e-4f), x);
+
+	__m256 z = _mm256_mul_ps(x, x);
+	__m256 y = _mm256_set1_ps(1.9875691500e-4f);
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.3981999507e-3f));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(8.3334519073e-3f));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(4.1665795894e-2f));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.6666665459e-1f));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(5.0000001201e-1f));
+	y = _mm256_fmadd_ps(y, z, x);
+	y = _mm256_add_ps(y, _mm256_set1_ps(1.0f));
+
+	__m256i n = _mm256_add_epi32(_mm256_cvttps_epi32(fx), _mm256_set1_epi32(127));
+	n = _mm256_slli_epi32(n, 23);
+	return _mm256_mul_ps(y, _mm256_castsi256_ps(n));
+}
+
+// x > 0 only
+GLOW_AVX2_TARGET static inline __m256 logAvx(__m256 x) {
+	__m256i bits = _mm256_castps_si256(x);
+	__m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(126)));
+	// Mantissa in [0.5, 1)
+	x = _mm256_castsi256_ps(_mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007fffff)),
+	                                        _mm256_set1_epi32(0x3f000000)));
+
+	__m256 small = _mm256_cmp_ps(x, _mm256_set1_ps(0.707106781186547524f), _CMP_LT_OQ);
+	__m256 tmp = _mm256_and_ps(x, small);
+	x = _mm256_sub_ps(x, _mm256_set1_ps(1.0f));
+	e = _mm256_sub_ps(e, _mm256_and_ps(_mm256_set1_ps(1.0f), small));
+	x = _mm256_add_ps(x, tmp);
+
+	__m256 z = _mm256_mul_ps(x, x);
+	__m256 y = _mm256_set1_ps(7.0376836292e-2f);
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(-1.1514610310e-1f));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.1676998740e-1f));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(-1.2420140846e-1f));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(1.4249322787e-1f));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(-1.6668057665e-1f));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(2.0000714765e-1f));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(-2.4999993993e-1f));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(3.3333331174e-1f));
+	y = _mm256_mul_ps(_mm256_mul_ps(y, x), z);
+
+	y = _mm256_fmadd_ps(e, _mm256_set1_ps(-2.12194440e-4f), y);
+	y = _mm256_fnmadd_ps(z, _mm256_set1_ps(0.5f), y);
+	x = _mm256_add_ps(x, y);
+	return _mm256_fmadd_ps(e, _mm256_set1_ps(0.693359375f), x);
+}
+
+GLOW_AVX2_TARGET static inline __m256 dot3(__m256 ax, __m256 ay, __m256 az, __m256 bx, __m256 by, __m256 bz) {
+	return _mm256_fmadd_ps(az, bz, _mm256_fmadd_ps(ay, by, _mm256_mul_ps(ax, bx)));
+}
+
+GLOW_AVX2_TARGET static inline __m256 clamp01(__m256 x) {
+	return _mm256_min_ps(_mm256_max_ps(x, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+}
+
+// computeGlowForRay for 8 segments: minDistanceToSegment, the segment parameter for the peak, falloff
+GLOW_AVX2_TARGET void GlowKernel::evaluateAvx2(const Ray& r, float* out) const {
+	glm::vec3 o = r.origin();
+	glm::vec3 d = r.direction();
+	glm::vec3 n = glm::normalize(d);
+
+	const __m256 ox = _mm256_set1_ps(o.x), oy = _mm256_set1_ps(o.y), oz = _mm256_set1_ps(o.z);
+	const __m256 rx = _mm256_set1_ps(d.x), ry = _mm256_set1_ps(d.y), rz = _mm256_set1_ps(d.z);
+	const __m256 nx = _mm256_set1_ps(n.x), ny = _mm256_set1_ps(n.y), nz = _mm256_set1_ps(n.z);
+	const __m256 d11 = _mm256_set1_ps(glm::dot(d, d));
+	const __m256 invD11 = _mm256_set1_ps(1.0f / glm::dot(d, d));
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 parallelEps = _mm256_set1_ps(1e-6f);
+	const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+	const __m256 tiny = _mm256_set1_ps(1e-30f);
+
+	for (size_t i = 0; i < count; i += LANES) {
+		__m256 ex = _mm256_loadu_ps(&dx[i]), ey = _mm256_loadu_ps(&dy[i]), ez = _mm256_loadu_ps(&dz[i]);
+		__m256 d22 = _mm256_loadu_ps(&len2[i]);
+
+		// p = ray origin - segment start
+		__m256 px = _mm256_sub_ps(ox, _mm256_loadu_ps(&sx[i]));
+		__m256 py = _mm256_sub_ps(oy, _mm256_loadu_ps(&sy[i]));
+		__m256 pz = _mm256_sub_ps(oz, _mm256_loadu_ps(&sz[i]));
+
+		__m256 d12 = dot3(rx, ry, rz, ex, ey, ez);
+		__m256 d2p = dot3(ex, ey, ez, px, py, pz);
+		__m256 d1p = dot3(rx, ry, rz, px, py, pz);
+
+		// ---------- Closest approach of the ray and the segment
+		__m256 denom = _mm256_fmsub_ps(d11, d22, _mm256_mul_ps(d12, d12));
+		__m256 s = _mm256_div_ps(_mm256_fmsub_ps(d11, d2p, _mm256_mul_ps(d12, d1p)), denom);
+		s = clamp01(s);
+
+		// v = closest segment point - ray origin, the ray parameter is clamped to the front
+		__m256 vx = _mm256_fmsub_ps(s, ex, px);
+		__m256 vy = _mm256_fmsub_ps(s, ey, py);
+		__m256 vz = _mm256_fmsub_ps(s, ez, pz);
+		__m256 tr = _mm256_max_ps(_mm256_mul_ps(dot3(rx, ry, rz, vx, vy, vz), invD11), _mm256_setzero_ps());
+		__m256 wx = _mm256_fnmadd_ps(tr, rx, vx);
+		__m256 wy = _mm256_fnmadd_ps(tr, ry, vy);
+		__m256 wz = _mm256_fnmadd_ps(tr, rz, vz);
+		__m256 dist = _mm256_sqrt_ps(dot3(wx, wy, wz, wx, wy, wz));
+
+		// Ray and segment parallel: distance to the segment's line
+		__m256 cx = _mm256_fmsub_ps(ey, pz, _mm256_mul_ps(ez, py));
+		__m256 cy = _mm256_fmsub_ps(ez, px, _mm256_mul_ps(ex, pz));
+		__m256 cz = _mm256_fmsub_ps(ex, py, _mm256_mul_ps(ey, px));
+		__m256 lineDist = _mm256_sqrt_ps(_mm256_div_ps(dot3(cx, cy, cz, cx, cy, cz), d22));
+		__m256 parallel = _mm256_cmp_ps(_mm256_and_ps(denom, absMask), parallelEps, _CMP_LT_OQ);
+		dist = _mm256_blendv_ps(dist, lineDist, parallel);
+
+		// ---------- Segment parameter against the normalized direction, for the fade along the bolt
+		__m256 dd = dot3(nx, ny, nz, ex, ey, ez);
+		__m256 rdn = dot3(nx, ny, nz, px, py, pz);
+		__m256 den2 = _mm256_fnmadd_ps(dd, dd, d22);
+		__m256 t = _mm256_div_ps(_mm256_fnmadd_ps(dd, rdn, d2p), den2);
+		__m256 tParallel = _mm256_div_ps(d2p, d22);
+		t = _mm256_blendv_ps(t, tParallel, _mm256_cmp_ps(_mm256_and_ps(den2, absMask), parallelEps, _CMP_LT_OQ));
+		t = clamp01(t);
+
+		// Main channel fades linearly, children with (1 - t)^1.5
+		__m256 rest = _mm256_sub_ps(one, t);
+		__m256 childFade = _mm256_mul_ps(rest, _mm256_sqrt_ps(rest));
+		__m256 mainFade = _mm256_fnmadd_ps(_mm256_set1_ps(0.3f), t, one);
+		__m256 isMain = _mm256_cmp_ps(_mm256_loadu_ps(&mainBranch[i]), _mm256_setzero_ps(), _CMP_NEQ_OQ);
+		__m256 fade = _mm256_blendv_ps(childFade, mainFade, isMain);
+
+		// ---------- exp(-(dist / width)^power)
+		__m256 u = _mm256_max_ps(_mm256_mul_ps(dist, _mm256_loadu_ps(&invWidth[i])), tiny);
+		__m256 pw = expAvx(_mm256_mul_ps(_mm256_loadu_ps(&power[i]), logAvx(u)));
+		__m256 falloff = expAvx(_mm256_sub_ps(_mm256_setzero_ps(), pw));
+
+		__m256 glow = _mm256_mul_ps(_mm256_mul_ps(falloff, fade), _mm256_loadu_ps(&peakScale[i]));
+
+		if (i + LANES <= count) {
+			_mm256_storeu_ps(out + i, glow);
+		} else {
+			float tail[LANES];
+			_mm256_storeu_ps(tail, glow);
+			std::memcpy(out + i, tail, (count - i) * sizeof(float));
+		}
+	}
+}
+
+#else
+
+void GlowKernel::evaluateAvx2(const Ray& r, float* out) const {
+	evaluateScalar(r, out);
+}
+
+#endif
+
+glm::vec3 GlowKernel::glow(const Ray& r, glm::vec3* aura, glm::vec3* core, glm::vec3* groupGlow) const {
+	thread_local std::vector<float> perSegment;
+	perSegment.resize(count);
+	evaluate(r, perSegment.data());
+
+	glm::vec3 glowTotal(0.0f);
+	glm::vec3 pinkGlow(1.0f, 0.5f, 0.8f);
+
+	for (size_t i = 0; i < count; ++i) {
+		float g = perSegment[i];
+		// Most segments are far from most rays, nothing to add and no exp to pay for
+		if (g == 0.0f) continue;
+
+		// Aura and core together
+		glm::vec3 contribution = pinkGlow * g;
+
+		glm::vec3 added = additive[i] ? contribution : contribution * glm::exp(-glowTotal);
+		glowTotal += added;
+
+		// Linear aura / core layers for the AOV output, they add up to glowTotal before the tone curve
+		if (aura) {
+			*aura += added * auraShare[i];
+			*core += added * (1.0f - auraShare[i]);
+		}
+		if (groupGlow)
+			groupGlow[group[i]] += added;
+	}
+
+	glowTotal = glm::pow(glowTotal, glm::vec3(0.6f));
+	glowTotal = glm::min(glowTotal, glm::vec3(1.0f));
+	return glowTotal;
+}
@@ -0,0 +1,59 @@
+#ifndef GLOWKERNEL_H
+#define GLOWKERNEL_H
+
+#include "lightningSegment.h"
+#include "lightGroups.h"
+#include <vector>
+#include <memory>
+
+// Which implementation evaluates the per segment glow
+enum GlowKernelKind {
+    GLOW_KERNEL_AUTO,    // AVX2 when the CPU has it, scalar otherwise
+    GLOW_KERNEL_SCALAR,  // computeGlowForRay per segment, the reference
+    GLOW_KERNEL_AVX2     // 8 segments per instruction
+};
+
+// One ray against every segment of a frame for the exact glow.
+// build() copies what computeGlowForRay needs (end points, glow width / power, peak and composite scale)
+// into flat arrays, padded to a multiple of 8, so the AVX2 kernel does closest approach, segment parameter
+// and falloff for 8 segments at once with no virtual calls or pointer chasing. The accumulation over the
+// segments stays a scalar pass in segment order, the saturating glow depends on it, and skips every segment
+// whose glow came out exactly zero.
+class GlowKernel {
+public:
+    void build(const std::vector<std::shared_ptr<LightningSegment>>& segs, GlowKernelKind kind = GLOW_KERNEL_AUTO);
+
+    size_t size() const { return count; }
+    GlowKernelKind kind() const { return active; }
+    static bool avx2Supported();
+
+    // computeGlowForRay * glowCompositeScale for every segment, out needs size() floats
+    void evaluate(const Ray& r, float* out) const;
+
+    // The glow block of tracePixel: accumulate, tone map. aura / core / groupGlow get the linear layers.
+    glm::vec3 glow(const Ray& r, glm::vec3* aura = nullptr, glm::vec3* core = nullptr,
+                   glm::vec3* groupGlow = nullptr) const;
+
+private:
+    size_t count = 0;
+    GlowKernelKind active = GLOW_KERNEL_SCALAR;
+    std::vector<const LightningSegment*> segs;
+
+    // Per segment, structure of arrays
+    std::vector<float> sx, sy, sz;     // start point
+    std::vector<float> dx, dy, dz;     // end - start
+    std::vector<float> len2;
+    std::vector<float> invWidth;       // 1 / glowWidth
+    std::vector<float> power;          // glowPower
+    std::vector<float> peakScale;      // glowPeak without the fade along t, times glowCompositeScale
+    std::vector<float> mainBranch;     // 1 for the main channel (linear fade along t), 0 for children
+    std::vector<float> compositeScale;
+    std::vector<float> auraShare;
+    std::vector<uint8_t> additive;
+    std::vector<uint8_t> group;
+
+    void evaluateScalar(const Ray& r, float* out) const;
+    void evaluateAvx2(const Ray& r, float* out) const;
+};
+
+#endif
@@ -0,0 +1,195 @@
+#include "glowSplat.h"
+#include <cmath>
+#include <glm/gtc/constants.hpp>
+
+// Same tint tracePixel uses for the aura and core
+static const glm::vec3 PINK_GLOW(1.0f, 0.5f, 0.8f);
+
+void GlowSplatter::build(const Camera& cam, int width, int height,
+                         const std::vector<std::shared_ptr<LightningSegment>>& segs) {
+	screenW = width;
+	screenH = height;
+
+	// ---------- Set up the pyramid
+	levels.resize(numLevels);
+	for (int l = 0; l < numLevels; ++l) {
+		Level& lvl = levels[l];
+		float sigma = baseSigma * powf(2.0f, (float)l);
+
+		// Keep the blur at 1-2 level pixels by dropping resolution for the wide levels
+		lvl.scale = 1 << std::max(0, l - 1);
+		lvl.sigma = sigma / lvl.scale;
+		lvl.pad = (int)ceil(4.0f * lvl.sigma) + 1;
+		lvl.w = (width + lvl.scale - 1) / lvl.scale + 2 * lvl.pad;
+		lvl.h = (height + lvl.scale - 1) / lvl.scale + 2 * lvl.pad;
+		lvl.additive.assign(lvl.w * lvl.h, 0.0f);
+		lvl.saturating.assign(lvl.w * lvl.h, 0.0f);
+	}
+
+	// World size of one pixel at unit distance, used to bring glow widths into screen space
+	float pixelSize = glm::length(cam.horizontal) / float(std::max(width - 1, 1)) / (float)cam.focalLength;
+
+	// ---------- Splat every segment
+	for (const auto& seg : segs) {
+		float u0, v0, d0, u1, v1, d1;
+		if (!cam.project(seg->startPoint, u0, v0, d0)) continue;
+		if (!cam.project(seg->endPoint, u1, v1, d1)) continue;
+
+		glm::vec2 p0(u0 * (width - 1), v0 * (height - 1));
+		glm::vec2 p1(u1 * (width - 1), v1 * (height - 1));
+		float lenPx = glm::length(p1 - p0);
+
+		float dist = glm::distance(cam.camera_center, seg->midpoint());
+		float widthPx = seg->glowWidth() / (dist * pixelSize);
+		float power = seg->glowPower();
+
+		// Total glow of a segment on the image plane for a unit peak:
+		// the round ends (2D integral of exp(-(d/W)^p)) plus the body along the segment (1D integral times length)
+		float ends = 2.0f * glm::pi<float>() * widthPx * widthPx * std::tgamma(2.0f / power) / power;
+		float body = 2.0f * widthPx * std::tgamma(1.0f / power) / power * lenPx;
+		float energy = (ends + body) * seg->glowCompositeScale();
+		if (energy <= 0.0f) continue;
+
+		// Pick the Gaussian with the same peak and the same energy as the exp(-(d/W)^p) falloff
+		// (sigma = W / sqrt(2) for p = 2). Split the mass between the two pyramid levels around that
+		// sigma so the width changes smoothly.
+		float sigmaPx = widthPx * sqrt(std::tgamma(2.0f / power) / power);
+		float level = log2(std::max(sigmaPx, baseSigma) / baseSigma);
+		level = glm::clamp(level, 0.0f, float(numLevels - 1));
+		int lo = (int)floor(level);
+		int hi = std::min(lo + 1, numLevels - 1);
+		float frac = level - lo;
+
+		bool additive = seg->glowIsAdditive();
+
+		// One splat per level pixel along the segment, weighted by the fade along it
+		for (int pass = 0; pass < 2; ++pass) {
+			int l = pass == 0 ? lo : hi;
+			float share = pass == 0 ? 1.0f - frac : frac;
+			if (share <= 0.0f) continue;
+
+			Level& lvl = levels[l];
+			int steps = std::max(1, (int)ceil(lenPx / lvl.scale));
+
+			for (int i = 0; i < steps; ++i) {
+				float t = (i + 0.5f) / steps;
+				glm::vec2 p = p0 + (p1 - p0) * t;
+				float mass = energy * share * seg->glowPeak(t) / steps;
+				splat(lvl, p.x, p.y, mass, additive);
+			}
+		}
+	}
+
+	// ---------- Blur and resolve
+	for (auto& lvl : levels) {
+		blur(lvl, lvl.additive);
+		blur(lvl, lvl.saturating);
+	}
+
+	glow.assign(width * height, glm::vec3(0.0f));
+	linearGlow.assign(width * height, glm::vec3(0.0f));
+	for (int y = 0; y < height; ++y) {
+		for (int x = 0; x < width; ++x) {
+			float add = 0.0f;
+			float sat = 0.0f;
+			for (const auto& lvl : levels) {
+				add += sample(lvl, lvl.additive, x, y);
+				sat += sample(lvl, lvl.saturating, x, y);
+			}
+
+			// tracePixel adds the saturating segments as g * exp(-total). Summed over many segments that
+			// converges to log(1 + sum), so the order of the segments no longer matters.
+			glm::vec3 glowTotal(
+				log(1.0f + sat * PINK_GLOW.r),
+				log(1.0f + sat * PINK_GLOW.g),
+				log(1.0f + sat * PINK_GLOW.b));
+			glowTotal += PINK_GLOW * add;
+			linearGlow[y * width + x] = glowTotal;
+
+			glowTotal = glm::pow(glowTotal, glm::vec3(0.6f));
+			glowTotal = glm::min(glowTotal, glm::vec3(1.0f));
+			glow[y * width + x] = glowTotal;
+		}
+	}
+}
+
+void GlowSplatter::splat(Level& lvl, float x, float y, float mass, bool additive) {
+	// Screen pixel to level pixel, then bilinear deposit. Mass is stored per screen pixel of area.
+	float lx = (x + 0.5f) / lvl.scale - 0.5f + lvl.pad;
+	float ly = (y + 0.5f) / lvl.scale - 0.5f + lvl.pad;
+	int ix = (int)floor(lx);
+	int iy = (int)floor(ly);
+	float fx = lx - ix;
+	float fy = ly - iy;
+
+	auto& buf = additive ? lvl.additive : lvl.saturating;
+	float density = mass / float(lvl.scale * lvl.scale);
+
+	for (int dy = 0; dy < 2; ++dy) {
+		for (int dx = 0; dx < 2; ++dx) {
+			int px = ix + dx;
+			int py = iy + dy;
+			if (px < 0 || py < 0 || px >= lvl.w || py >= lvl.h) continue;
+			float wgt = (dx ? fx : 1.0f - fx) * (dy ? fy : 1.0f - fy);
+			buf[py * lvl.w + px] += density * wgt;
+		}
+	}
+}
+
+void GlowSplatter::blur(Level& lvl, std::vector<float>& buf) {
+	int radius = (int)ceil(4.0f * lvl.sigma);
+	std::vector<float> kernel(2 * radius + 1);
+	float sum = 0.0f;
+	for (int i = -radius; i <= radius; ++i) {
+		kernel[i + radius] = expf(-(i * i) / (2.0f * lvl.sigma * lvl.sigma));
+		sum += kernel[i + radius];
+	}
+	for (auto& k : kernel) k /= sum;
+
+	std::vector<float> tmp(buf.size(), 0.0f);
+
+	// Horizontal pass
+	for (int y = 0; y < lvl.h; ++y) {
+		for (int x = 0; x < lvl.w; ++x) {
+			float acc = 0.0f;
+			for (int k = -radius; k <= radius; ++k) {
+				int sx = x + k;
+				if (sx < 0 || sx >= lvl.w) continue;
+				acc += buf[y * lvl.w + sx] * kernel[k + radius];
+			}
+			tmp[y * lvl.w + x] = acc;
+		}
+	}
+
+	// Vertical pass
+	for (int y = 0; y < lvl.h; ++y) {
+		for (int x = 0; x < lvl.w; ++x) {
+			float acc = 0.0f;
+			for (int k = -radius; k <= radius; ++k) {
+				int sy = y + k;
+				if (sy < 0 || sy >= lvl.h) continue;
+				acc += tmp[sy * lvl.w + x] * kernel[k + radius];
+			}
+			buf[y * lvl.w + x] = acc;
+		}
+	}
+}
+
+float GlowSplatter::sample(const Level& lvl, const std::vector<float>& buf, int x, int y) const {
+	if (lvl.scale == 1)
+		return buf[(y + lvl.pad) * lvl.w + (x + lvl.pad)];
+
+	// Bilinear upsample from the coarse level
+	float lx = (x + 0.5f) / lvl.scale - 0.5f + lvl.pad;
+	float ly = (y + 0.5f) / lvl.scale - 0.5f + lvl.pad;
+	int ix = glm::clamp((int)floor(lx), 0, lvl.w - 2);
+	int iy = glm::clamp((int)floor(ly), 0, lvl.h - 2);
+	float fx = glm::clamp(lx - ix, 0.0f, 1.0f);
+	float fy = glm::clamp(ly - iy, 0.0f, 1.0f);
+
+	float a = buf[iy * lvl.w + ix];
+	float b = buf[iy * lvl.w + ix + 1];
+	float c = buf[(iy + 1) * lvl.w + ix];
+	float d = buf[(iy + 1) * lvl.w + ix + 1];
+	return glm::mix(glm::mix(a, b, fx), glm::mix(c, d, fx), fy);
+}
@@ -0,0 +1,56 @@
+#ifndef GLOWSPLAT_H
+#define GLOWSPLAT_H
+
+#include "camera.h"
+#include "lightningSegment.h"
+#include <vector>
+#include <memory>
+
+// Screen-space version of the bolt glow.
+// The camera is a plain pinhole, so the glow around a segment is really just a blur of the projected segment.
+// Each segment is projected, splatted as a weighted line into a float buffer and then blurred with a
+// separable Gaussian. Wide glows go into coarser pyramid levels so every blur stays a handful of taps.
+// Cost is O(pixels + segments) instead of O(pixels * segments) for the per-ray version.
+class GlowSplatter {
+public:
+    int numLevels = 10;        // sigma doubles every level, 10 levels covers the main channel up close
+    float baseSigma = 1.0f;    // blur width of level 0 in screen pixels
+
+    // Project and blur the segments for one frame
+    void build(const Camera& cam, int width, int height,
+               const std::vector<std::shared_ptr<LightningSegment>>& segs);
+
+    // Final glow for a pixel, already saturated and tone mapped like the glow block in tracePixel
+    glm::vec3 glowAt(int x, int y) const {
+        return glow[y * screenW + x];
+    }
+
+    // The same glow before the tone curve, for the AOV output. Aura and core are blurred together here.
+    glm::vec3 linearGlowAt(int x, int y) const {
+        return linearGlow[y * screenW + x];
+    }
+
+private:
+    struct Level {
+        int scale = 1;   // downsample factor relative to the screen
+        int pad = 0;     // border in level pixels so off screen segments can still bleed in
+        int w = 0, h = 0;
+        float sigma = 1.0f; // blur width in level pixels
+
+        // Glow mass per screen pixel, split like the two accumulation paths in tracePixel
+        std::vector<float> additive;
+        std::vector<float> saturating;
+    };
+
+    int screenW = 0;
+    int screenH = 0;
+    std::vector<Level> levels;
+    std::vector<glm::vec3> glow;
+    std::vector<glm::vec3> linearGlow;
+
+    void splat(Level& lvl, float x, float y, float mass, bool additive);
+    void blur(Level& lvl, std::vector<float>& buf);
+    float sample(const Level& lvl, const std::vector<float>& buf, int x, int y) const;
+};
+
+#endif
@@ -0,0 +1,180 @@
+#include "groundLight.h"
+#include "lineLight.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+
+static const float EPS = 0.001f;
+static const int MAX_DIM = 1024;
+static const int BORDER = 2;  // texels past the ground seen, so the bilinear filter has both sides
+
+glm::vec3 GroundLight::centre(const Grid& grid, int x, int y) const {
+	glm::vec2 uv = grid.origin + (glm::vec2(x, y) + 0.5f) * grid.cellSize;
+	return point + uv.x * tangent + uv.y * bitangent;
+}
+
+// New empty grid over lo - hi in plane coordinates, every revealed segment has to go in again
+void GroundLight::resize(Grid& grid, float texel, const glm::vec2& lo, const glm::vec2& hi) const {
+	glm::vec2 extent = hi - lo;
+	grid.cellSize = std::max(texel, std::max(extent.x, extent.y) / (MAX_DIM - 2 * BORDER));
+	grid.origin = lo - float(BORDER) * grid.cellSize;
+	grid.dims = glm::ivec2(glm::ceil(extent / grid.cellSize)) + 2 * BORDER;
+	grid.texels.assign((size_t)grid.dims.x * grid.dims.y, glm::vec3(0.0f));
+}
+
+// Same sum as the shading loop in traceSample, with the samples spread evenly over the visible spans
+void GroundLight::addLights(const PrimitiveStore& world, Grid& grid, size_t first) const {
+	const float invSamples = 1.0f / samplesPerTexel;
+	parallelRows(grid.dims.y, [&](int y0, int y1) {
+		std::vector<LightSpan> spans;
+		for (int y = y0; y < y1; ++y) {
+			for (int x = 0; x < grid.dims.x; ++x) {
+				glm::vec3 p = centre(grid, x, y);
+				glm::vec3 origin = p + normal * EPS;
+				glm::vec3 sum(0.0f);
+				for (size_t i = first; i < lights.size(); ++i) {
+					const LightningSegment& seg = *lights[i];
+					float visible = visibleSpans(world, p, origin, seg.startPoint, seg.endPoint, spans);
+					if (visible <= 0.0f) continue;
+
+					glm::vec3 segVec = seg.endPoint - seg.startPoint;
+					float light = 0.0f;
+					for (int s = 0; s < samplesPerTexel; ++s) {
+						float t = spanParameter(spans, visible, (s + 0.5f) * invSamples);
+						glm::vec3 L = seg.startPoint + t * segVec - p;
+						float dist2 = glm::dot(L, L);
+						float dist = std::sqrt(dist2);
+						if (dist <= 0.0f) continue;
+						glm::vec3 lightDir = L / dist;
+						float nDotL = glm::dot(normal, lightDir);
+						if (nDotL <= 0.0f) continue;
+						if (world.occludedThin(Ray(origin, lightDir), EPS, dist - EPS)) continue;
+						light += nDotL / (dist2 + 1e-4f);
+					}
+					sum += seg.lightSource->color * (seg.lightSource->intensity * light * visible * invSamples);
+				}
+				grid.texels[(size_t)y * grid.dims.x + x] += sum;
+			}
+		}
+	});
+}
+
+GroundLight::Grid& GroundLight::writable(int level) {
+	// Only prepareFrame copies the cache, so a count of 1 can't go up behind our back
+	if (grids[level].use_count() > 1)
+		grids[level] = std::make_shared<Grid>(*grids[level]);
+	return *grids[level];
+}
+
+bool GroundLight::update(const Camera& cam, const PrimitiveStore& world, uint32_t planeIndex,
+                         const std::vector<std::shared_ptr<LightningSegment>>& visible,
+                         int screenWidth, int screenHeight, int x0, int y0, int w, int h) {
+	if (planeIndex >= world.planes.size() || levels < 1)
+		return false;
+	const Plane& ground = world.planes[planeIndex];
+	bool changed = false;
+	if (plane != planeIndex || ground.point != point || ground.normal != normal || (int)grids.size() != levels) {
+		plane = planeIndex;
+		point = ground.point;
+		normal = ground.normal;
+		glm::vec3 a = std::fabs(normal.x) > 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+		tangent = glm::normalize(glm::cross(a, normal));
+		bitangent = glm::cross(normal, tangent);
+		grids.clear();
+		for (int k = 0; k < levels; ++k)
+			grids.push_back(std::make_shared<Grid>());
+		changed = true;
+	}
+
+	// ---------- Ground the view shows per level, in plane coordinates
+	std::vector<glm::vec2> lo(levels, glm::vec2(1e30f));
+	std::vector<glm::vec2> hi(levels, glm::vec2(-1e30f));
+	for (int y = y0; y < y0 + h + stride - 1; y += stride) {
+		for (int x = x0; x < x0 + w + stride - 1; x += stride) {
+			float px = std::min(float(x), float(x0 + w - 1));
+			float py = std::min(float(y), float(y0 + h - 1));
+			Ray r = cam.getRay(px / (screenWidth - 1), py / (screenHeight - 1));
+			float tmax = std::ldexp(maxDistance, levels - 1);
+			float hitMax;
+			PrimRef ref = world.nearest(r, EPS, tmax, hitMax);
+			if (ref.kind != PrimRef::PLANE || ref.index != plane) continue;
+			glm::vec3 d = r.at(tmax) - point;
+			glm::vec2 uv(glm::dot(d, tangent), glm::dot(d, bitangent));
+			for (int k = 0; k < levels; ++k) {
+				if (tmax > std::ldexp(maxDistance, k)) continue;
+				lo[k] = glm::min(lo[k], uv);
+				hi[k] = glm::max(hi[k], uv);
+			}
+		}
+	}
+
+	// ---------- Back in the animation: start over
+	if (visible.size() < revealed) {
+		lights.clear();
+		revealed = 0;
+		for (int k = 0; k < levels; ++k) {
+			if (!grids[k]->texels.empty()) {
+				Grid& grid = writable(k);
+				std::fill(grid.texels.begin(), grid.texels.end(), glm::vec3(0.0f));
+			}
+		}
+		changed = true;
+	}
+	size_t first = lights.size();
+	for (size_t i = revealed; i < visible.size(); ++i) {
+		if (visible[i]->isEmissive())
+			lights.push_back(visible[i].get());
+	}
+	revealed = visible.size();
+
+	for (int k = 0; k < levels; ++k) {
+		const Grid& grid = *grids[k];
+		size_t from = first;
+
+		// Ground outside the level: regrow it around both, all segments again. A level with no ground in
+		// view is kept for when it comes back.
+		if (lo[k].x <= hi[k].x) {
+			glm::vec2 gridLo = grid.origin + float(BORDER) * grid.cellSize;
+			glm::vec2 gridHi = grid.origin + glm::vec2(grid.dims - BORDER) * grid.cellSize;
+			bool empty = grid.texels.empty();
+			if (empty || lo[k].x < gridLo.x || lo[k].y < gridLo.y || hi[k].x > gridHi.x || hi[k].y > gridHi.y) {
+				if (!empty) {
+					lo[k] = glm::min(lo[k], gridLo);
+					hi[k] = glm::max(hi[k], gridHi);
+				}
+				// A fresh level, nothing to copy from the old one
+				auto grown = std::make_shared<Grid>();
+				resize(*grown, std::ldexp(texelSize, k), lo[k], hi[k]);
+				grids[k] = grown;
+				from = 0;
+				changed = true;
+			}
+		}
+
+		if (!grids[k]->texels.empty() && from < lights.size()) {
+			addLights(world, writable(k), from);
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+bool GroundLight::lookup(const glm::vec3& p, glm::vec3& light) const {
+	glm::vec3 d = p - point;
+	glm::vec2 uv(glm::dot(d, tangent), glm::dot(d, bitangent));
+	for (const auto& level : grids) {
+		const Grid& grid = *level;
+		if (grid.texels.empty()) continue;
+		glm::vec2 g = (uv - grid.origin) / grid.cellSize - 0.5f;
+		if (!(g.x >= 0.0f && g.y >= 0.0f && g.x <= grid.dims.x - 1 && g.y <= grid.dims.y - 1))
+			continue;
+		glm::ivec2 i0 = glm::min(glm::ivec2(g), grid.dims - 2);
+		glm::vec2 f = g - glm::vec2(i0);
+
+		const glm::vec3* row0 = &grid.texels[(size_t)i0.y * grid.dims.x + i0.x];
+		const glm::vec3* row1 = row0 + grid.dims.x;
+		light = glm::mix(glm::mix(row0[0], row0[1], f.x), glm::mix(row1[0], row1[1], f.x), f.y);
+		return true;
+	}
+	return false;
+}
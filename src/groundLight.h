@@ -0,0 +1,70 @@
+#ifndef GROUNDLIGHT_H
+#define GROUNDLIGHT_H
+
+#include "camera.h"
+#include "primitiveStore.h"
+#include "lightningSegment.h"
+#include <vector>
+#include <memory>
+
+// The ground plane's direct bolt light, cached in the plane's own texture space.
+// The ground fills a big part of the frame, doesn't move and its lighting is smooth, yet every AA sample on
+// it pays every segment times samplesPerLight shadow rays. Here 2D grids of texels over the part of the
+// plane the camera sees hold the light sum traceSample would build (colour * intensity * cos / d^2 per
+// segment, before the cloud attenuation), and camera rays on the ground look it up with a bilinear filter
+// instead of shading. Like a clipmap, each coarser level reaches twice as far, so the texels stay about
+// as dense on screen towards the horizon. A texel adds a new segment once, exactly: its visible spans past
+// the spheres and the plane from lineLight.h, samplesPerTexel points spread over them.
+//
+// Revealing segments only adds those segments to the texels, nothing is redone while the segment set stays
+// the same, and a view that shows ground outside a level (the preview camera moving) regrows that level.
+// Going back in the animation starts over. Bolt branches don't shadow the cached ground.
+//
+// Copies share the levels, so a per frame snapshot costs a few pointers. update() only clones a level it
+// changes while a snapshot still holds it (copy on write).
+class GroundLight {
+public:
+    float texelSize = 0.02f;   // world units per texel in the finest level
+    float maxDistance = 4.0f;  // camera distance the finest level reaches, each level doubles both
+    int levels = 4;            // ground past maxDistance * 2^(levels - 1) is shaded per sample as before
+    int samplesPerTexel = 8;   // points along a segment's visible spans
+    int stride = 8;            // pixel spacing of the camera rays that find the visible ground
+
+    // Brings the texels up to the visible segments (a prefix of the strike) for the part of plane `plane`
+    // the region of the screen shows. Returns true if anything changed.
+    bool update(const Camera& cam, const PrimitiveStore& world, uint32_t plane,
+                const std::vector<std::shared_ptr<LightningSegment>>& visible,
+                int screenWidth, int screenHeight, int x0, int y0, int w, int h);
+
+    bool valid() const { return !grids.empty() && !grids[0]->texels.empty(); }
+    uint32_t planeIndex() const { return plane; }
+
+    // Light sum at p on the plane from the finest level that has it, false outside all of them
+    bool lookup(const glm::vec3& p, glm::vec3& light) const;
+
+private:
+    // One level: texel (x, y) sits at origin + (x, y) + 0.5 cells in plane coordinates
+    struct Grid {
+        glm::vec2 origin = glm::vec2(0.0f);
+        glm::ivec2 dims = glm::ivec2(0);
+        float cellSize = 0.0f;  // the level's texel size, coarser if its ground needs too many texels
+        std::vector<glm::vec3> texels;
+    };
+
+    uint32_t plane = 0;
+    glm::vec3 point = glm::vec3(0.0f);  // plane frame: (u, v) is at point + u * tangent + v * bitangent
+    glm::vec3 normal = glm::vec3(0.0f);
+    glm::vec3 tangent = glm::vec3(0.0f);
+    glm::vec3 bitangent = glm::vec3(0.0f);
+
+    std::vector<std::shared_ptr<Grid>> grids;  // finest first, each a clipmap level nested in the next
+    std::vector<const LightningSegment*> lights;  // emissive segments revealed so far
+    size_t revealed = 0;
+
+    glm::vec3 centre(const Grid& grid, int x, int y) const;
+    void resize(Grid& grid, float texel, const glm::vec2& lo, const glm::vec2& hi) const;
+    void addLights(const PrimitiveStore& world, Grid& grid, size_t first) const;
+    Grid& writable(int level);  // the level, cloned first if a copy of this cache shares it
+};
+
+#endif
@@ -17,6 +17,13 @@ public:
     float t;
 };
 
+// What a caller needs back from an intersection test
+enum class HitQuery {
+    Closest,    // nearest hit with the full record (point, normal, colour, emission)
+    ClosestT,   // nearest hit, only rec.t is written
+    Occlusion   // any hit in (tmin, tmax), stops at the first one and writes nothing
+};
+
 class hittable {
 public:
     virtual ~hittable() = default;
@@ -24,6 +31,35 @@ public:
     glm::vec3 color;
 
     virtual bool hit(const Ray& r, float ray_tmin, float ray_tmax, hit_record& rec) const = 0;
+    virtual bool hitT(const Ray& r, float ray_tmin, float ray_tmax, float& t) const = 0;
+    virtual bool occluded(const Ray& r, float ray_tmin, float ray_tmax) const = 0;
+};
+
+// Shapes write one intersect<HitQuery>() and get the three virtual queries from it.
+// Each query is its own instantiation, so shadow rays and t-only tests compile without the
+// normal / colour work.
+template <class Shape>
+class hittableShape : public hittable {
+public:
+    bool hit(const Ray& r, float ray_tmin, float ray_tmax, hit_record& rec) const override {
+        return shape().template intersect<HitQuery::Closest>(r, ray_tmin, ray_tmax, rec);
+    }
+
+    bool hitT(const Ray& r, float ray_tmin, float ray_tmax, float& t) const override {
+        hit_record rec;
+        if (!shape().template intersect<HitQuery::ClosestT>(r, ray_tmin, ray_tmax, rec))
+            return false;
+        t = rec.t;
+        return true;
+    }
+
+    bool occluded(const Ray& r, float ray_tmin, float ray_tmax) const override {
+        hit_record rec;
+        return shape().template intersect<HitQuery::Occlusion>(r, ray_tmin, ray_tmax, rec);
+    }
+
+private:
+    const Shape& shape() const { return static_cast<const Shape&>(*this); }
 };
 
 #endif
@@ -0,0 +1,361 @@
+#include "irradianceCache.h"
+#include "boltTransmittance.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <glm/gtc/constants.hpp>
+
+static const float EPS = 0.001f;
+static const float ESCAPED = 1e29f;
+static const int MAX_WAVES = 4;
+static const float PI = glm::pi<float>();
+static const float DIFFUSE = 0.09f;  // the renderer's diffuse scale, light leaving = DIFFUSE * albedo * irradiance
+
+// Tangent frame around n, t and b span the base plane of the hemisphere
+static void basis(const glm::vec3& n, glm::vec3& t, glm::vec3& b) {
+	glm::vec3 a = std::fabs(n.x) > 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+	t = glm::normalize(glm::cross(a, n));
+	b = glm::cross(n, t);
+}
+
+// Stratum jitter from the record position, the same point always gathers along the same rays
+static uint32_t hashPoint(const glm::vec3& p) {
+	uint32_t h = 2166136261u;
+	const float v[3] = { p.x, p.y, p.z };
+	for (float f : v) {
+		uint32_t bits;
+		std::memcpy(&bits, &f, sizeof(bits));
+		h = (h ^ bits) * 16777619u;
+	}
+	return h;
+}
+
+static float nextFloat(uint32_t& state) {
+	state = state * 1664525u + 1013904223u;
+	return (state >> 8) * (1.0f / 16777216.0f);
+}
+
+// ---------- IrradianceLookup
+
+uint64_t IrradianceLookup::key(int x, int y, int z) const {
+	const int BIAS = 1 << 20;
+	return ((uint64_t)(x + BIAS) << 42) | ((uint64_t)(y + BIAS) << 21) | (uint64_t)(z + BIAS);
+}
+
+const std::vector<uint32_t>* IrradianceLookup::cell(const glm::vec3& p) const {
+	glm::ivec3 c = glm::ivec3(glm::floor(p / cellSize));
+	auto it = grid.find(key(c.x, c.y, c.z));
+	return it == grid.end() ? nullptr : &it->second;
+}
+
+// Ward's error estimate turned into a weight, 0 outside the record's area (and for points in front of it,
+// which see light the record's hemisphere doesn't). Shifted by 1 / a so it fades out at the edge instead
+// of stepping.
+float IrradianceLookup::weight(const Record& rec, const glm::vec3& p, const glm::vec3& n) const {
+	glm::vec3 d = p - rec.p;
+	if (glm::dot(d, n + rec.n) < -0.02f * rec.R)
+		return 0.0f;
+	float err = glm::length(d) / rec.R + std::sqrt(std::max(0.0f, 1.0f - glm::dot(n, rec.n)));
+	float w = 1.0f / std::max(err, 1e-4f) - 1.0f / accuracy;
+	return std::max(w, 0.0f);
+}
+
+glm::vec3 IrradianceLookup::indirect(const glm::vec3& p, const glm::vec3& n) const {
+	const std::vector<uint32_t>* list = cell(p);
+	if (!list)
+		return glm::vec3(0.0f);
+
+	glm::vec3 sum(0.0f);
+	float total = 0.0f;
+	for (uint32_t i : *list) {
+		const Record& rec = records[i];
+		float w = weight(rec, p, n);
+		if (w <= 0.0f) continue;
+		glm::vec3 d = p - rec.p;
+		glm::vec3 turn = glm::cross(rec.n, n);
+		glm::vec3 E;
+		for (int c = 0; c < 3; ++c)
+			E[c] = rec.E[c] + glm::dot(turn, rec.gradR[c]) + glm::dot(d, rec.gradT[c]);
+		sum += w * glm::max(E, glm::vec3(0.0f));
+		total += w;
+	}
+	// E is irradiance / pi, the receiver takes it the way traceSample takes its direct light
+	if (total > 0.0f)
+		return (DIFFUSE * PI) * sum / total;
+
+	// Just past every record's area (a gap the update didn't fill), the nearest facing record without
+	// gradients rather than a black spot
+	const Record* best = nullptr;
+	float bestDist = 1e30f;
+	for (uint32_t i : *list) {
+		const Record& rec = records[i];
+		if (glm::dot(n, rec.n) < 0.7f) continue;
+		float dist = glm::length(p - rec.p) / rec.R;
+		if (dist < bestDist) {
+			bestDist = dist;
+			best = &rec;
+		}
+	}
+	return best ? (DIFFUSE * PI) * best->E : glm::vec3(0.0f);
+}
+
+float IrradianceLookup::coverage(const glm::vec3& p, const glm::vec3& n) const {
+	const std::vector<uint32_t>* list = cell(p);
+	if (!list)
+		return 0.0f;
+	float total = 0.0f;
+	for (uint32_t i : *list)
+		total += weight(records[i], p, n);
+	return total;
+}
+
+void IrradianceLookup::insert(const Record& rec) {
+	uint32_t index = (uint32_t)(&rec - records.data());
+	float reach = accuracy * rec.R;
+	glm::ivec3 lo = glm::ivec3(glm::floor((rec.p - reach) / cellSize));
+	glm::ivec3 hi = glm::ivec3(glm::floor((rec.p + reach) / cellSize));
+	for (int z = lo.z; z <= hi.z; ++z)
+		for (int y = lo.y; y <= hi.y; ++y)
+			for (int x = lo.x; x <= hi.x; ++x)
+				grid[key(x, y, z)].push_back(index);
+}
+
+void IrradianceLookup::clear() {
+	records.clear();
+	grid.clear();
+}
+
+// ---------- IrradianceCache
+
+void IrradianceCache::gather(const PrimitiveStore& world, const glm::vec3& p, const glm::vec3& n, std::vector<Gather>& rays) const {
+	glm::vec3 t, b;
+	basis(n, t, b);
+	uint32_t rng = hashPoint(p);
+
+	// Cosine-weighted strata, theta rows of phi columns: sin^2 theta uniform in [j, j + 1) / M
+	rays.assign(thetaStrata * phiStrata, Gather());
+	for (int j = 0; j < thetaStrata; ++j) {
+		for (int k = 0; k < phiStrata; ++k) {
+			Gather& g = rays[j * phiStrata + k];
+			float sin2 = (j + nextFloat(rng)) / thetaStrata;
+			g.phi = 2.0f * PI * (k + nextFloat(rng)) / phiStrata;
+			float sinTheta = std::sqrt(sin2);
+			float cosTheta = std::sqrt(1.0f - sin2);
+			g.tanTheta = sinTheta / std::max(cosTheta, 1e-4f);
+			glm::vec3 dir = (std::cos(g.phi) * t + std::sin(g.phi) * b) * sinTheta + n * cosTheta;
+
+			hit_record rec;
+			if (!world.hit(Ray(p + n * EPS, dir), EPS, 1e20f, rec))
+				continue;
+			g.dist = rec.t;
+			g.p = rec.p;
+			g.n = rec.normal;
+			// Emitters are direct light already, only lit surfaces bounce here
+			g.albedo = rec.emissive ? glm::vec3(0.0f) : rec.color;
+		}
+	}
+}
+
+// Direct light leaving every gather hit from count more segments, each as a point light at its midpoint
+// with one shadow ray. The same falloff and 0.09 diffuse scale as the camera samples.
+void IrradianceCache::addLight(const PrimitiveStore& world, std::vector<Gather>& rays, const LightningSegment* const* first,
+                               size_t count, const BoltTransmittance* lightShadow) const {
+	for (Gather& g : rays) {
+		if (g.dist >= ESCAPED || g.albedo == glm::vec3(0.0f)) continue;
+		glm::vec3 light(0.0f);
+		for (size_t i = 0; i < count; ++i) {
+			const LightSource& source = *first[i]->lightSource;
+			glm::vec3 L = first[i]->midpoint() - g.p;
+			float dist2 = glm::dot(L, L);
+			float dist = std::sqrt(dist2);
+			if (dist <= 0.0f) continue;
+			glm::vec3 lightDir = L / dist;
+			float nDotL = glm::dot(g.n, lightDir);
+			if (nDotL <= 0.0f) continue;
+			if (world.occluded(Ray(g.p + g.n * EPS, lightDir), EPS, dist - EPS)) continue;
+			light += source.color * (source.intensity * nDotL / (dist2 + 1e-4f));
+		}
+		if (lightShadow)
+			light *= lightShadow->irradiance(g.p);
+		g.L += g.albedo * light * DIFFUSE;
+	}
+}
+
+// E, R and the two gradients from the gather rays (Ward & Heckbert 92, eqs. for a cosine-weighted
+// M x N stratification), all divided by pi to go with E being irradiance / pi
+void IrradianceCache::finish(IrradianceLookup::Record& rec, const std::vector<Gather>& rays) const {
+	const int M = thetaStrata;
+	const int N = phiStrata;
+	glm::vec3 t, b;
+	basis(rec.n, t, b);
+
+	rec.E = glm::vec3(0.0f);
+	float invDist = 0.0f;
+	for (const Gather& g : rays) {
+		rec.E += g.L;
+		if (g.dist < ESCAPED)
+			invDist += 1.0f / g.dist;
+	}
+	rec.E /= float(M * N);
+	rec.R = invDist > 0.0f ? float(M * N) / invDist : maxSpacing;
+	rec.R = glm::clamp(rec.R, minSpacing, maxSpacing);
+
+	for (int c = 0; c < 3; ++c) {
+		rec.gradT[c] = glm::vec3(0.0f);
+		rec.gradR[c] = glm::vec3(0.0f);
+	}
+
+	for (int k = 0; k < N; ++k) {
+		int kPrev = (k + N - 1) % N;
+		float phiBoundary = 2.0f * PI * k / N;
+		glm::vec3 across = -std::sin(phiBoundary) * t + std::cos(phiBoundary) * b;
+		for (int j = 0; j < M; ++j) {
+			const Gather& g = rays[j * N + k];
+			glm::vec3 toward = std::cos(g.phi) * t + std::sin(g.phi) * b;
+			glm::vec3 turn = -std::sin(g.phi) * t + std::cos(g.phi) * b;
+
+			// Rotation: the cosine falloff tilting under each ray
+			for (int c = 0; c < 3; ++c)
+				rec.gradR[c] += turn * (g.tanTheta * g.L[c] / float(M * N));
+
+			// Translation: the boundary to the previous phi column moves with the closer of the two hits...
+			const Gather& side = rays[j * N + kPrev];
+			float sinOuter = std::sqrt(float(j + 1) / M);
+			float sinInner = std::sqrt(float(j) / M);
+			float wall = (sinOuter - sinInner) / std::min(g.dist, side.dist);
+			for (int c = 0; c < 3; ++c)
+				rec.gradT[c] += across * (wall * (g.L[c] - side.L[c]) / PI);
+
+			// ...and the one to the previous theta row as well
+			if (j > 0) {
+				const Gather& below = rays[(j - 1) * N + k];
+				float sin2 = float(j) / M;
+				float ring = (2.0f * PI / N) * std::sqrt(sin2) * (1.0f - sin2) / std::min(g.dist, below.dist);
+				for (int c = 0; c < 3; ++c)
+					rec.gradT[c] += toward * (ring * (g.L[c] - below.L[c]) / PI);
+			}
+		}
+	}
+}
+
+bool IrradianceCache::update(const Camera& cam, const PrimitiveStore& world,
+                             const std::vector<std::shared_ptr<LightningSegment>>& visible,
+                             int screenWidth, int screenHeight, int x0, int y0, int w, int h,
+                             const BoltTransmittance* lightShadow) {
+	bool changed = false;
+	if (visible.size() < revealed) {
+		view.clear();
+		gathers.clear();
+		lights.clear();
+		revealed = 0;
+		changed = true;
+	}
+	if (view.empty()) {
+		view.accuracy = accuracy;
+		view.cellSize = maxSpacing * accuracy;
+	}
+
+	// ---------- Newly revealed segments into the records there are, at their stored gather hits
+	size_t firstNew = lights.size();
+	for (size_t i = revealed; i < visible.size(); ++i) {
+		if (visible[i]->isEmissive())
+			lights.push_back(visible[i].get());
+	}
+	revealed = visible.size();
+	size_t added = lights.size() - firstNew;
+	if (added > 0 && !view.empty()) {
+		parallelRows((int)view.records.size(), [&](int r0, int r1) {
+			for (int r = r0; r < r1; ++r) {
+				addLight(world, gathers[r], lights.data() + firstNew, added, lightShadow);
+				finish(view.records[r], gathers[r]);
+			}
+		});
+		changed = true;
+	}
+
+	// ---------- Surfaces in view that no record covers yet, one camera ray every stride pixels
+	struct Candidate {
+		glm::vec3 p;
+		glm::vec3 n;
+	};
+	int cols = (w + stride - 1) / stride;
+	int rows = (h + stride - 1) / stride;
+	std::vector<std::vector<Candidate>> perRow(rows);
+	parallelRows(rows, [&](int r0, int r1) {
+		for (int row = r0; row < r1; ++row) {
+			float y = std::min(y0 + row * stride + 0.5f * stride, float(y0 + h - 1));
+			for (int col = 0; col < cols; ++col) {
+				float x = std::min(x0 + col * stride + 0.5f * stride, float(x0 + w - 1));
+				Ray r = cam.getRay(x / (screenWidth - 1), y / (screenHeight - 1));
+				float tmax = 1e20f;
+				float hitMax;
+				PrimRef ref = world.nearest(r, EPS, tmax, hitMax);
+				if (ref.kind != PrimRef::SPHERE && ref.kind != PrimRef::PLANE) continue;
+				hit_record rec;
+				if (!world.resolve(ref, r, EPS, hitMax, rec) || rec.emissive) continue;
+				if (view.coverage(rec.p, rec.normal) <= 0.0f)
+					perRow[row].push_back({ rec.p, rec.normal });
+			}
+		}
+	});
+	std::vector<Candidate> candidates;
+	for (const auto& row : perRow)
+		candidates.insert(candidates.end(), row.begin(), row.end());
+
+	// A record's R is only known once it has gathered, so new records go in waves: candidates at least
+	// spacing apart are gathered together, the ones they still don't cover go to the next wave with half
+	// the spacing.
+	float spacing = maxSpacing * accuracy;
+	for (int wave = 0; wave < MAX_WAVES && !candidates.empty(); ++wave) {
+		std::vector<Candidate> accepted;
+		std::vector<Candidate> rest;
+		std::unordered_map<uint64_t, std::vector<uint32_t>> near;
+		for (const Candidate& c : candidates) {
+			if (wave > 0 && view.coverage(c.p, c.n) > 0.0f) continue;
+			glm::ivec3 cell = glm::ivec3(glm::floor(c.p / spacing));
+			bool crowded = false;
+			for (int dz = -1; dz <= 1 && !crowded; ++dz)
+				for (int dy = -1; dy <= 1 && !crowded; ++dy)
+					for (int dx = -1; dx <= 1 && !crowded; ++dx) {
+						auto it = near.find(view.key(cell.x + dx, cell.y + dy, cell.z + dz));
+						if (it == near.end()) continue;
+						for (uint32_t a : it->second) {
+							if (glm::length(accepted[a].p - c.p) < spacing && glm::dot(accepted[a].n, c.n) > 0.9f) {
+								crowded = true;
+								break;
+							}
+						}
+					}
+			if (crowded) {
+				rest.push_back(c);
+				continue;
+			}
+			near[view.key(cell.x, cell.y, cell.z)].push_back((uint32_t)accepted.size());
+			accepted.push_back(c);
+		}
+		if (accepted.empty())
+			break;
+
+		size_t base = view.records.size();
+		view.records.resize(base + accepted.size());
+		gathers.resize(base + accepted.size());
+		parallelRows((int)accepted.size(), [&](int a0, int a1) {
+			for (int a = a0; a < a1; ++a) {
+				IrradianceLookup::Record& rec = view.records[base + a];
+				rec.p = accepted[a].p;
+				rec.n = accepted[a].n;
+				gather(world, rec.p, rec.n, gathers[base + a]);
+				addLight(world, gathers[base + a], lights.data(), lights.size(), lightShadow);
+				finish(rec, gathers[base + a]);
+			}
+		});
+		for (size_t i = base; i < view.records.size(); ++i)
+			view.insert(view.records[i]);
+
+		candidates.swap(rest);
+		spacing *= 0.5f;
+		changed = true;
+	}
+	return changed;
+}
@@ -0,0 +1,103 @@
+#ifndef IRRADIANCECACHE_H
+#define IRRADIANCECACHE_H
+
+#include "camera.h"
+#include "primitiveStore.h"
+#include "lightningSegment.h"
+#include <vector>
+#include <memory>
+#include <unordered_map>
+
+class BoltTransmittance;
+
+// One bounce of bolt light off the ground and the spheres, as an irradiance cache (Ward et al. 88,
+// gradients from Ward & Heckbert 92). The indirect light changes slowly across a surface, so it is only
+// gathered at sparse cache points, with a stratified hemisphere of rays each, and interpolated in between
+// with the rotation and translation gradients that come out of the same rays for free.
+//
+// A gather ray keeps where it hit and the direct light leaving that point, and that direct light is just a
+// sum over the segments. So when segments are revealed the records only add the new segments' light at
+// their stored hit points instead of gathering again, and nothing is redone while the segment set stays
+// the same. Going back in the animation starts over.
+
+// What a camera ray needs: the records and a hash grid over their areas of influence
+class IrradianceLookup {
+public:
+    struct Record {
+        glm::vec3 p;
+        glm::vec3 n;
+        glm::vec3 E;          // mean radiance over the cosine-weighted hemisphere (irradiance / pi)
+        glm::vec3 gradT[3];   // translation gradient of E, per colour channel
+        glm::vec3 gradR[3];   // rotation gradient of E, per colour channel
+        float R;              // harmonic mean distance of the gather hits, clamped to the record spacing
+    };
+
+    float accuracy = 0.3f;   // Ward's a, a record is used up to accuracy * R away (at the same normal)
+    float cellSize = 0.3f;   // hash grid, records are entered in every cell their influence reaches
+                             // (both set by IrradianceCache before the first record goes in)
+
+    std::vector<Record> records;
+
+    bool empty() const { return records.empty(); }
+
+    // Interpolated E at p with normal n in the renderer's diffuse convention (0.09 * pi * E, the scale the
+    // direct light uses), 0 where no record reaches. Light leaving the point is albedo * indirect().
+    glm::vec3 indirect(const glm::vec3& p, const glm::vec3& n) const;
+
+    // Sum of the weights of the records usable at p, 0 = a new record is needed here
+    float coverage(const glm::vec3& p, const glm::vec3& n) const;
+
+    void insert(const Record& rec);  // grid entry for a record already in records
+    void clear();
+
+    uint64_t key(int x, int y, int z) const;
+
+private:
+    std::unordered_map<uint64_t, std::vector<uint32_t>> grid;
+
+    const std::vector<uint32_t>* cell(const glm::vec3& p) const;
+    float weight(const Record& rec, const glm::vec3& p, const glm::vec3& n) const;
+};
+
+class IrradianceCache {
+public:
+    float accuracy = 0.3f;     // Ward's a, smaller = more records closer together
+    int thetaStrata = 12;      // gather rays per record, thetaStrata * phiStrata
+    int phiStrata = 36;
+    float minSpacing = 0.05f;  // bounds on a record's R, in world units
+    float maxSpacing = 1.0f;
+    int stride = 4;            // pixel spacing of the camera rays that look for places without records
+
+    // Brings the records up to the visible segments (a prefix of the strike) and adds records where the
+    // view has surfaces no record covers. Returns true if anything changed.
+    bool update(const Camera& cam, const PrimitiveStore& world,
+                const std::vector<std::shared_ptr<LightningSegment>>& visible,
+                int screenWidth, int screenHeight, int x0, int y0, int w, int h,
+                const BoltTransmittance* lightShadow = nullptr);
+
+    const IrradianceLookup& lookup() const { return view; }
+
+private:
+    // One gather ray: where it hit and the light coming back along it
+    struct Gather {
+        glm::vec3 p;
+        glm::vec3 n;
+        glm::vec3 albedo;
+        glm::vec3 L = glm::vec3(0.0f);
+        float dist = 1e30f;  // 1e30 = escaped, no light comes back
+        float phi;           // direction in the record's hemisphere, for the gradients
+        float tanTheta;
+    };
+
+    IrradianceLookup view;
+    std::vector<std::vector<Gather>> gathers;  // per record, thetaStrata * phiStrata
+    std::vector<const LightningSegment*> lights;  // emissive segments revealed so far
+    size_t revealed = 0;
+
+    void gather(const PrimitiveStore& world, const glm::vec3& p, const glm::vec3& n, std::vector<Gather>& rays) const;
+    void addLight(const PrimitiveStore& world, std::vector<Gather>& rays, const LightningSegment* const* first,
+                  size_t count, const BoltTransmittance* lightShadow) const;
+    void finish(IrradianceLookup::Record& rec, const std::vector<Gather>& rays) const;
+};
+
+#endif
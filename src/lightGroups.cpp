@@ -0,0 +1,98 @@
+#include "lightGroups.h"
+#include "aovOutput.h"
+#include "ofMain.h"
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+static const char* TERM_NAMES[LIGHT_GROUP_TERMS] = { "direct", "bolt", "cloudnear", "cloudfar", "glow" };
+
+static std::string layerPath(const std::string& dir, int term, int group, const std::string& baseName) {
+	return (fs::path(dir) / (std::string(TERM_NAMES[term]) + "g" + ofToString(group) + "_" + baseName + ".pfm")).string();
+}
+
+bool RelightKeys::load(const std::string& path) {
+	std::ifstream file(path);
+	if (!file) {
+		ofLogError() << "Relight: could not open " << path;
+		return false;
+	}
+
+	keys.clear();
+	std::string line;
+	while (std::getline(file, line)) {
+		if (line.empty() || line[0] == '#') continue;
+		std::istringstream in(line);
+		Key key;
+		in >> key.frame;
+		for (int g = 0; g < LIGHT_GROUPS; ++g)
+			in >> key.weight[g];
+		if (!in) {
+			ofLogError() << "Relight: bad key \"" << line << "\" in " << path;
+			return false;
+		}
+		keys.push_back(key);
+	}
+	std::sort(keys.begin(), keys.end(), [](const Key& a, const Key& b) { return a.frame < b.frame; });
+	return !keys.empty();
+}
+
+void RelightKeys::weightsAt(int frame, float* weight) const {
+	for (int g = 0; g < LIGHT_GROUPS; ++g)
+		weight[g] = 1.0f;
+	if (keys.empty()) return;
+
+	// Held before the first and after the last key
+	size_t next = 0;
+	while (next < keys.size() && keys[next].frame <= frame)
+		next++;
+	const Key& a = keys[next == 0 ? 0 : next - 1];
+	const Key& b = keys[next == keys.size() ? keys.size() - 1 : next];
+	float t = b.frame > a.frame ? float(frame - a.frame) / float(b.frame - a.frame) : 0.0f;
+	t = glm::clamp(t, 0.0f, 1.0f);
+	for (int g = 0; g < LIGHT_GROUPS; ++g)
+		weight[g] = a.weight[g] + (b.weight[g] - a.weight[g]) * t;
+}
+
+bool saveLightGroups(const std::string& dir, const std::string& baseName, int width, int height,
+                     const std::vector<LightGroupSample>& groups) {
+	std::error_code ec;
+	fs::create_directories(dir, ec);
+
+	std::vector<float> layer(width * height * 3);
+	bool ok = true;
+	for (int term = 0; term < LIGHT_GROUP_TERMS; ++term) {
+		for (int g = 0; g < LIGHT_GROUPS; ++g) {
+			for (int i = 0; i < width * height; ++i) {
+				const LightGroupSample& s = groups[i];
+				const glm::vec3* terms[LIGHT_GROUP_TERMS] = { s.direct, s.bolt, s.volumeNear, s.volumeFar, s.glow };
+				glm::vec3 v = terms[term][g];
+				layer[i * 3 + 0] = v.r;
+				layer[i * 3 + 1] = v.g;
+				layer[i * 3 + 2] = v.b;
+			}
+			ok = writePfm(layerPath(dir, term, g, baseName), width, height, 3, layer.data()) && ok;
+		}
+	}
+	return ok;
+}
+
+bool loadLightGroups(const std::string& dir, const std::string& baseName, int width, int height,
+                     std::vector<float>* layers) {
+	for (int term = 0; term < LIGHT_GROUP_TERMS; ++term) {
+		for (int g = 0; g < LIGHT_GROUPS; ++g) {
+			std::string path = layerPath(dir, term, g, baseName);
+			int w, h, channels;
+			std::vector<float>& layer = layers[term * LIGHT_GROUPS + g];
+			if (!readPfm(path, w, h, channels, layer))
+				return false;
+			if (w != width || h != height || channels != 3) {
+				ofLogError() << "Relight: " << path << " doesn't match the AOVs";
+				return false;
+			}
+		}
+	}
+	return true;
+}
@@ -0,0 +1,76 @@
+#ifndef LIGHTGROUPS_H
+#define LIGHTGROUPS_H
+
+#include "lightningSegment.h"
+#include <string>
+#include <vector>
+
+// Relightable per strike group lighting.
+// Every term the bolt lights is linear in its segments' intensity up to the clamps and the glow tone curve,
+// so a frame can be re-brightened per group (a return stroke flickering the main channel) without tracing
+// again: the renderer keeps what each group adds to the direct light, the bolt emission, the cloud
+// in-scatter and the linear glow, and the compositor adds (weight - 1) * group on top of the AOV layers
+// before compose()'s clamps. Weights of 1 give back the rendered frame. The glow saturation weights are
+// the ones of the rendered intensities, so big glow changes are approximate.
+static const int LIGHT_GROUPS = 4;  // main channel, first level branches, second level, everything deeper
+
+inline int lightGroup(const LightningSegment& seg) {
+    if (seg.isMainBranchSegment) return 0;
+    return seg.branchDepth < 1 ? 1 : (seg.branchDepth < LIGHT_GROUPS - 1 ? seg.branchDepth : LIGHT_GROUPS - 1);
+}
+
+// What each group adds to one sample, summed and averaged per pixel like ShadeSample
+struct LightGroupSample {
+    glm::vec3 direct[LIGHT_GROUPS] = {};      // diffuse surface light, albedo included
+    glm::vec3 bolt[LIGHT_GROUPS] = {};        // emission of the group's segments seen directly
+    glm::vec3 volumeNear[LIGHT_GROUPS] = {};  // cloud in-scatter of the group's light, near march
+    glm::vec3 volumeFar[LIGHT_GROUPS] = {};   // and the far march
+    glm::vec3 glow[LIGHT_GROUPS] = {};        // linear glow, before the tone curve
+
+    LightGroupSample& operator+=(const LightGroupSample& o) {
+        for (int g = 0; g < LIGHT_GROUPS; ++g) {
+            direct[g] += o.direct[g];
+            bolt[g] += o.bolt[g];
+            volumeNear[g] += o.volumeNear[g];
+            volumeFar[g] += o.volumeFar[g];
+            glow[g] += o.glow[g];
+        }
+        return *this;
+    }
+
+    LightGroupSample& operator*=(float s) {
+        for (int g = 0; g < LIGHT_GROUPS; ++g) {
+            direct[g] *= s;
+            bolt[g] *= s;
+            volumeNear[g] *= s;
+            volumeFar[g] *= s;
+            glow[g] *= s;
+        }
+        return *this;
+    }
+};
+
+// Intensity keyframes for the compositor. A text file with one key per line, "frame w0 w1 w2 w3" (one weight
+// per group, lines starting with # are skipped). Weights are interpolated linearly between keys.
+struct RelightKeys {
+    struct Key {
+        int frame;
+        float weight[LIGHT_GROUPS];
+    };
+    std::vector<Key> keys;  // sorted by frame
+
+    bool load(const std::string& path);
+    bool empty() const { return keys.empty(); }
+    void weightsAt(int frame, float* weight) const;
+};
+
+// Group layers are stored next to the AOVs as <term>g<group>_<png name>.pfm
+bool saveLightGroups(const std::string& dir, const std::string& baseName, int width, int height,
+                     const std::vector<LightGroupSample>& groups);
+
+// Flat rgb arrays, layers[term * LIGHT_GROUPS + group], terms in the order of LightGroupSample
+static const int LIGHT_GROUP_TERMS = 5;
+bool loadLightGroups(const std::string& dir, const std::string& baseName, int width, int height,
+                     std::vector<float>* layers);
+
+#endif
@@ -43,6 +43,25 @@ public:
 	float minDistanceToSegment(const Ray & r) const;
 	float computeGlowForRay(const Ray & r) const;
 
+    // Glow profile pieces, shared by computeGlowForRay and the screen-space glow splatter
+    float glowWidth() const;
+    float glowPower() const;
+    float glowPeak(float t) const; // glow right on the axis at segment parameter t
+
+    // Scale tracePixel puts on top of computeGlowForRay (aura + core mult and depth fades)
+    float glowCompositeScale() const;
+
+    // Part of that scale that is the wide aura, the rest is the core
+    float glowAuraShare() const;
+
+    // What a camera ray sees when it hits this segment directly
+    glm::vec3 boltColor() const;
+
+    // First level children add their glow straight, everything else saturates
+    bool glowIsAdditive() const {
+        return !isMainBranchSegment && branchDepth == 1;
+    }
+
     glm::vec3 midpoint() const {
         return 0.5f * (startPoint + endPoint);
     }
@@ -0,0 +1,147 @@
+#include "lineLight.h"
+#include <algorithm>
+#include <cmath>
+
+static const float EPS = 0.001f;
+
+// The shadow test tracePixel does for the light point x
+template <class Shape>
+static bool blocks(const Shape& s, const glm::vec3& p, const glm::vec3& origin, const glm::vec3& x) {
+	glm::vec3 L = x - p;
+	float dist = glm::length(L);
+	if (dist <= 0.0f) return false;
+	hit_record rec;
+	return queryShape<HitQuery::Occlusion>(s, Ray(origin, L / dist), EPS, dist - EPS, rec);
+}
+
+static void addRoot(float t, std::vector<float>& roots) {
+	if (t > 0.0f && t < 1.0f)
+		roots.push_back(t);
+}
+
+// Roots of c2 t^2 + c1 t + c0 strictly inside (0, 1)
+static void addRoots(float c2, float c1, float c0, std::vector<float>& roots) {
+	if (std::fabs(c2) <= 1e-9f * (std::fabs(c1) + std::fabs(c0))) {
+		if (c1 != 0.0f)
+			addRoot(-c0 / c1, roots);
+		return;
+	}
+	float disc = c1 * c1 - 4.0f * c2 * c0;
+	if (disc < 0.0f) return;
+	// The stable form, no cancellation in the smaller root
+	float q = -0.5f * (c1 + std::copysign(std::sqrt(disc), c1));
+	addRoot(q / c2, roots);
+	if (q != 0.0f)
+		addRoot(c0 / q, roots);
+}
+
+float visibleSpans(const PrimitiveStore& world, const glm::vec3& p, const glm::vec3& origin,
+                   const glm::vec3& a, const glm::vec3& b, std::vector<LightSpan>& spans) {
+	thread_local std::vector<float> cuts;
+	thread_local std::vector<uint32_t> partialSpheres;
+	thread_local std::vector<uint32_t> partialPlanes;
+	cuts.clear();
+	partialSpheres.clear();
+	partialPlanes.clear();
+	spans.clear();
+
+	// Light point relative to the shadow ray origin: d(t) = ao + t e
+	glm::vec3 e = b - a;
+	glm::vec3 ao = a - origin;
+	float aa = glm::dot(ao, ao);
+	float ae = glm::dot(ao, e);
+	float ee = glm::dot(e, e);
+	glm::vec3 mid = a + 0.5f * e;
+
+	// Every shadow ray lies in the triangle origin, a, b
+	glm::vec3 boxMin = glm::min(origin, glm::min(a, b));
+	glm::vec3 boxMax = glm::max(origin, glm::max(a, b));
+
+	// ---------- Spheres. Visibility can only change where the ray to the light point grazes the sphere,
+	// where the light point crosses the surface, or where the ray turns perpendicular to the centre.
+	for (uint32_t i = 0; i < world.spheres.size(); ++i) {
+		const Sphere& s = world.spheres[i];
+		glm::vec3 lo = glm::max(boxMin, s.center - s.radius);
+		glm::vec3 hi = glm::min(boxMax, s.center + s.radius);
+		if (lo.x > hi.x || lo.y > hi.y || lo.z > hi.z)
+			continue;
+
+		glm::vec3 w = s.center - origin;
+		float r2 = s.radius * s.radius;
+		float aw = glm::dot(ao, w);
+		float ew = glm::dot(e, w);
+		float k = glm::dot(w, w) - r2;
+
+		size_t before = cuts.size();
+		addRoots(ew * ew - k * ee, 2.0f * (aw * ew - k * ae), aw * aw - k * aa, cuts);
+		glm::vec3 f = ao - w;
+		addRoots(ee, 2.0f * glm::dot(f, e), glm::dot(f, f) - r2, cuts);
+		if (ew != 0.0f)
+			addRoot(-aw / ew, cuts);
+
+		if (cuts.size() > before)
+			partialSpheres.push_back(i);
+		else if (blocks(s, p, origin, mid))
+			return 0.0f;  // hides the whole segment
+	}
+
+	// ---------- Planes. Everything past the crossing point is on the other side.
+	for (uint32_t i = 0; i < world.planes.size(); ++i) {
+		const Plane& pl = world.planes[i];
+		float d0 = glm::dot(a - pl.point, pl.normal);
+		float d1 = glm::dot(e, pl.normal);
+
+		size_t before = cuts.size();
+		if (d1 != 0.0f)
+			addRoot(-d0 / d1, cuts);
+
+		if (cuts.size() > before)
+			partialPlanes.push_back(i);
+		else if (blocks(pl, p, origin, mid))
+			return 0.0f;
+	}
+
+	if (partialSpheres.empty() && partialPlanes.empty()) {
+		spans.push_back({ 0.0f, 1.0f });
+		return 1.0f;
+	}
+
+	// ---------- One exact test per sub-interval, against the occluders that change along the segment
+	cuts.push_back(0.0f);
+	cuts.push_back(1.0f);
+	std::sort(cuts.begin(), cuts.end());
+
+	float total = 0.0f;
+	for (size_t c = 0; c + 1 < cuts.size(); ++c) {
+		float t0 = cuts[c];
+		float t1 = cuts[c + 1];
+		if (t1 - t0 <= 1e-6f) continue;
+
+		glm::vec3 x = a + (0.5f * (t0 + t1)) * e;
+		bool hidden = false;
+		for (uint32_t i : partialSpheres) {
+			if (blocks(world.spheres[i], p, origin, x)) { hidden = true; break; }
+		}
+		for (size_t k = 0; !hidden && k < partialPlanes.size(); ++k)
+			hidden = blocks(world.planes[partialPlanes[k]], p, origin, x);
+		if (hidden) continue;
+
+		if (!spans.empty() && spans.back().t1 == t0)
+			spans.back().t1 = t1;
+		else
+			spans.push_back({ t0, t1 });
+		total += t1 - t0;
+	}
+	return total;
+}
+
+float spanParameter(const std::vector<LightSpan>& spans, float total, float u) {
+	float target = u * total;
+	for (const LightSpan& s : spans) {
+		float len = s.t1 - s.t0;
+		if (target < len)
+			return s.t0 + target;
+		target -= len;
+	}
+	return spans.empty() ? u : spans.back().t1;
+}
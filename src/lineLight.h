@@ -0,0 +1,27 @@
+#ifndef LINELIGHT_H
+#define LINELIGHT_H
+
+#include "primitiveStore.h"
+#include <vector>
+
+// Analytic visibility of a line light (a bolt segment) against spheres and planes.
+// Seen from a shading point, the part of a segment a sphere hides is bounded by roots of a few quadratics in
+// the segment parameter t (the shadow ray grazing the sphere, the light point crossing its surface, the ray
+// turning perpendicular), and a plane hides everything past the point where the segment crosses it. Between
+// consecutive roots visibility can't change, so one exact shadow test per sub-interval gives the visible
+// spans. Light samples are then spread over those spans only and weighted by their total length: sphere and
+// plane penumbrae come out noise free, and the shadow rays left only have to test the thin cylinders.
+struct LightSpan {
+    float t0;
+    float t1;
+};
+
+// Sorted, disjoint spans of [0, 1] along a -> b that point p (shadow rays start at origin, p pushed off
+// its surface) sees past every sphere and plane of the world. Returns their total length.
+float visibleSpans(const PrimitiveStore& world, const glm::vec3& p, const glm::vec3& origin,
+                   const glm::vec3& a, const glm::vec3& b, std::vector<LightSpan>& spans);
+
+// Maps u in [0, 1) uniformly onto the spans
+float spanParameter(const std::vector<LightSpan>& spans, float total, float u);
+
+#endif
@@ -1,18 +1,46 @@
 #include "ofMain.h"
 #include "ofApp.h"
+#include "renderJob.h"
+
+// Window / frame size
+const int WIDTH = 560;
+const int HEIGHT = 720;
 
 //========================================================================
-int main( ){
+int main(int argc, char* argv[]){
+
+	// Work split for distributed rendering, see renderJob.h for the options
+	RenderJob job;
+	if (!parseRenderJob(argc, argv, job))
+		return 1;
+
+	if (job.mode == RenderJob::MERGE) {
+		return mergeTiles(job.outDir.empty() ? defaultOutDir() : job.outDir) > 0 ? 0 : 1;
+	}
+	if (job.mode == RenderJob::COMPOSITE) {
+		RelightKeys keys;
+		if (!job.relightKeys.empty() && !keys.load(job.relightKeys))
+			return 1;
+		return compositeAovs(job.outDir.empty() ? defaultOutDir() : job.outDir, job.grade, keys) > 0 ? 0 : 1;
+	}
+	int width = job.width > 0 ? job.width : WIDTH;
+	int height = job.height > 0 ? job.height : HEIGHT;
+	if (job.mode == RenderJob::LAUNCH) {
+		return launchLocal(job, width, height) > 0 ? 0 : 1;
+	}
 
 	//Use ofGLFWWindowSettings for more options like multi-monitor fullscreen
 	ofGLWindowSettings settings;
-	settings.setSize(560, 720);
+	settings.setSize(width, height);
 	settings.windowMode = OF_WINDOW; //can also be OF_FULLSCREEN
 	settings.setGLVersion(3, 2);
 
 	auto window = ofCreateWindow(settings);
 
-	ofRunApp(window, std::make_shared<ofApp>());
+	auto app = std::make_shared<ofApp>();
+	app->job = job;
+
+	ofRunApp(window, app);
 	ofRunMainLoop();
 
 }
@@ -1,6 +1,12 @@
 ﻿#include "ofApp.h"
+#include "parallel.h"
 #include <filesystem>
 #include <glm/gtc/random.hpp>
+#include <glm/gtc/constants.hpp>
+
+// Per thread sample stream, restarted for every pixel / camera sample so results don't depend on which thread
+// or process renders it
+static thread_local SampleStream stream;
 
 //--------------------------------------------------------------
 void ofApp::setup() {
@@ -12,9 +18,36 @@ void ofApp::setup() {
 	ofSetFrameRate(0);
 	ofSetVerticalSync(false);
 
-	// Set values
-	screenWidth = ofGetWidth();
-	screenHeight = ofGetHeight();
+	saveRenderDefaults();
+	loadScene();
+	applyJob();
+	if (tuneMode != TUNE_OFF)
+		autoTune();
+
+	// Server mode: the scene stays loaded and draw() takes the jobs from stdin, see renderServer.h
+	if (job.sweepSteps > 0 && job.mode != RenderJob::SERVE)
+		ofLogWarning() << "--sweep is only for server jobs, rendering the job once";
+	if (job.mode == RenderJob::SERVE) {
+		server = std::make_unique<RenderServer>();
+		server->start();
+		server->reply("ready");
+	}
+}
+
+//--------------------------------------------------------------
+// Scene from the job: a scene cache or a generated strike, and the cloud field over it
+void ofApp::loadScene() {
+	// Everything built from the previous scene goes with it
+	world = PrimitiveStore();
+	clouds.clear();
+	strikeTargets.clear();
+	lightningSegments.clear();
+	boltTransmittance = BoltTransmittance();
+	boltTransmittanceFrame.reset();
+	irradianceCache = IrradianceCache();
+	irradianceFrame.reset();
+	groundLight = GroundLight();
+	groundLightFrame.reset();
 
 	cam = Camera();
 
@@ -22,9 +55,165 @@ void ofApp::setup() {
 	cam.camera_center = glm::vec3(0, 0, 2.5f);
 	cam.lowerLeft = cam.camera_center - cam.horizontal / 2.0f - cam.vertical / 2.0f - glm::vec3(0, 0, cam.focalLength);
 
-	// Fill the scene
-	// seed openFrameworks random
-	std::srand((unsigned int)time(nullptr)); 
+	// Fill the scene, from a scene cache if one was given, otherwise generate a new strike
+	SceneCache cache;
+	if (!job.sceneIn.empty() && cache.open(job.sceneIn)) {
+		cache.load(cam, world, clouds, lightningSegments);
+		sceneSeed = cache.header().seed;
+		ofLog() << "Loaded scene " << job.sceneIn << " (" << lightningSegments.size() << " segments, seed " << sceneSeed << ")";
+	}
+	else {
+		if (!job.sceneIn.empty())
+			ofLogError() << "Falling back to a generated scene";
+		generateScene();
+	}
+
+	if (!job.sceneOut.empty())
+		writeSceneCache(job.sceneOut, sceneSeed, cam, world, clouds, lightningSegments);
+
+	cloudField.build(clouds);
+	ofLog() << "Cloud field: " << clouds.size() << " cells, " << cloudField.brickCount() << " bricks";
+	sceneJob = job;
+}
+
+//--------------------------------------------------------------
+// The job settable render settings as ofApp.h has them, every job starts from these
+void ofApp::saveRenderDefaults() {
+	RenderDefaults& d = renderDefaults;
+	d.glowMode = glowMode;
+	d.minSamples = minSamples;
+	d.maxSamples = maxSamples;
+	d.sampler = sampler;
+	d.glowKernel = glowKernel;
+	d.cloudShadows = cloudShadows;
+	d.groundCache = groundCache;
+	d.bounceLight = bounceLight;
+	d.capsuleBolts = capsuleBolts;
+	d.analyticShadows = analyticShadows;
+	d.denoise = denoise;
+	d.aovs = aovs;
+	d.lightGroups = lightGroups;
+	d.wavefront = wavefront;
+	d.smoothRate = smoothRate;
+	d.volumeScale = volumeScale;
+	d.tileSize = tileSize;
+	d.threads = threads;
+	d.pipelineDepth = pipelineDepth;
+	d.tuneMode = tuneMode;
+}
+
+void ofApp::restoreRenderDefaults() {
+	const RenderDefaults& d = renderDefaults;
+	glowMode = d.glowMode;
+	minSamples = d.minSamples;
+	maxSamples = d.maxSamples;
+	sampler = d.sampler;
+	glowKernel = d.glowKernel;
+	cloudShadows = d.cloudShadows;
+	groundCache = d.groundCache;
+	bounceLight = d.bounceLight;
+	capsuleBolts = d.capsuleBolts;
+	analyticShadows = d.analyticShadows;
+	denoise = d.denoise;
+	aovs = d.aovs;
+	lightGroups = d.lightGroups;
+	wavefront = d.wavefront;
+	smoothRate = d.smoothRate;
+	volumeScale = d.volumeScale;
+	tileSize = d.tileSize;
+	threads = d.threads;
+	pipelineDepth = d.pipelineDepth;
+	tuneMode = d.tuneMode;
+}
+
+//--------------------------------------------------------------
+// Settings, frame range and image region from the job, on top of the defaults: a job line fully
+// describes its render, nothing carries over from the job before.
+void ofApp::applyJob() {
+	restoreRenderDefaults();
+
+	// Image size and the camera's pixel footprint for it
+	screenWidth = job.width > 0 ? job.width : ofGetWidth();
+	screenHeight = job.height > 0 ? job.height : ofGetHeight();
+	cam.setResolution(screenWidth, screenHeight);
+	cam.pixelSpread *= noiseLodScale;
+
+	// Frame range and image region from the render job
+	frameCount = job.frameStart;
+	totalFrames = job.frameEnd;
+	pipelineDepth = job.pipelineDepth;
+	denoise = job.denoise;
+	aovs = job.aovs;
+	lightGroups = job.lightGroups;
+	if (lightGroups) {
+		// The group terms are only split on the per sample path, everything that shares or splats them is off
+		aovs = true;
+		if (job.wavefront || job.volumeScale > 1 || job.smoothRate > 0 || volumeScale > 1 || smoothRate != SHADE_PER_SAMPLE || glowMode != GLOW_EXACT)
+			ofLogWarning() << "Light groups: tracing per sample with the exact glow (no wavefront, volume pass or shared terms)";
+		job.wavefront = false;
+		job.volumeScale = 1;
+		job.smoothRate = SHADE_PER_SAMPLE;
+		glowMode = GLOW_EXACT;
+	}
+	wavefront = job.wavefront;
+	if (job.analyticShadows >= 0)
+		analyticShadows = job.analyticShadows != 0;
+	if (job.sampler >= 0)
+		sampler = (SamplerKind)job.sampler;
+	if (job.cloudShadows >= 0)
+		cloudShadows = job.cloudShadows != 0;
+	if (job.bounceLight >= 0)
+		bounceLight = job.bounceLight != 0;
+	if (job.groundCache >= 0)
+		groundCache = job.groundCache != 0;
+	if (job.capsuleBolts >= 0)
+		capsuleBolts = job.capsuleBolts != 0;
+	if (job.glowKernel >= 0)
+		glowKernel = (GlowKernelKind)job.glowKernel;
+	if (glowKernel == GLOW_KERNEL_AVX2 && !GlowKernel::avx2Supported())
+		ofLogWarning() << "Glow kernel: no AVX2 on this CPU, using the scalar one";
+	if (job.smoothRate >= 0)
+		smoothRate = (ShadingRate)job.smoothRate;
+	if (job.volumeScale > 0)
+		volumeScale = job.volumeScale;
+	if (job.minSamples > 0) {
+		minSamples = job.minSamples;
+		maxSamples = glm::max(job.maxSamples, minSamples);
+	}
+	if (job.threads > 0)
+		threads = job.threads;
+	if (job.tune >= 0)
+		tuneMode = (TuneMode)job.tune;
+	previewMode = job.preview;
+
+	if (job.isTile()) {
+		regionX = glm::clamp(job.tileX, 0, screenWidth - 1);
+		regionY = glm::clamp(job.tileY, 0, screenHeight - 1);
+		regionW = glm::min(job.tileW, screenWidth - regionX);
+		regionH = glm::min(job.tileH, screenHeight - regionY);
+	}
+	else {
+		regionX = 0;
+		regionY = 0;
+		regionW = screenWidth;
+		regionH = screenHeight;
+	}
+
+	// Cloud density around the strike for the bolt light transmittance, filled in as segments are revealed
+	if (cloudShadows && !clouds.empty() && !boltTransmittance.valid()) {
+		auto c0 = std::chrono::high_resolution_clock::now();
+		boltTransmittance.init(cloudField, lightningSegments);
+		double initMs = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - c0).count() * 1000.0;
+		ofLog() << "Cloud shadow grid took " << initMs << " ms";
+	}
+}
+
+//--------------------------------------------------------------
+void ofApp::generateScene() {
+	// seed openFrameworks random. A fixed seed from the command line reproduces the same strike.
+	sceneSeed = job.seed ? job.seed : (uint32_t)time(nullptr);
+	ofLog() << "Scene seed: " << sceneSeed;
+	std::srand((unsigned int)sceneSeed); 
 	ofSeedRandom(std::rand()); 
 	for (int i = 0; i < 3; ++i) {
 		float x = glm::linearRand(-1.0f, 1.0f);
@@ -34,27 +223,27 @@ void ofApp::setup() {
 
 		glm::vec3 color = glm::vec3(ofRandom(0.2f, 0.8f), ofRandom(0.2f, 0.8f), ofRandom(0.2f, 0.8f));
 
-		auto s = std::make_shared<Sphere>(glm::vec3(x, y, z), r, color);
-		world.push_back(s);
+		Sphere s(glm::vec3(x, y, z), r, color);
+		world.spheres.push_back(s);
 		strikeTargets.push_back(s);
 	}
 
 	//Adding the ground to the scene.
-	world.push_back(std::make_shared<Plane>(
+	world.planes.push_back(Plane(
 		glm::vec3(0, 2, 0),
 		glm::vec3(0, -1, 0),
 		glm::vec3(0.2f, 0.25f, 0.3f)  
 	));
 
 	// Find the tallest sphere
-	std::shared_ptr<Sphere> tallest = nullptr;
+	const Sphere* tallest = nullptr;
 	float maxHeight = -1e9;
 
 	for (auto& s : strikeTargets) {
-		float top = s->center.y + s->radius;
+		float top = s.center.y + s.radius;
 		if (top > maxHeight) {
 			maxHeight = top;
-			tallest = s;
+			tallest = &s;
 		}
 	}
 
@@ -66,12 +255,12 @@ void ofApp::setup() {
 	Branch mainBranch(start,
 		dir,
 		glm::distance(start, target),      // distance to target
-		0.05f,        // radius
-		0.3f,       // branch probability
-		0.8f,       // mean branch length
-		30.0f,       // max segment angle
-		0.08f,        // mean segment length
-		50.0f,       // max branch angle
+		job.branch.radius,          // radius
+		job.branch.probability,     // branch probability
+		job.branch.branchLength,    // mean branch length
+		job.branch.segmentAngle,    // max segment angle
+		job.branch.segmentLength,   // mean segment length
+		job.branch.branchAngle,     // max branch angle
 		glm::vec3(0, 0, 1),
 		true,
 		0
@@ -79,8 +268,8 @@ void ofApp::setup() {
 
 	mainBranch.onMainBranchMove = [&](const glm::vec3& pos) {
 		for (auto& s : strikeTargets) {
-			float dist = glm::distance(pos, s->center);
-			if (dist <= s->radius) {
+			float dist = glm::distance(pos, s.center);
+			if (dist <= s.radius) {
 				mainBranch.mainBranchHit = true;
 				return;
 			}
@@ -101,8 +290,6 @@ void ofApp::setup() {
 		//glm::vec3(0.5f, 0.3565f, 0.378f)    
         glm::vec3(0.02f, 0.03f, 0.025f)   
 	));
-
-	pixels.allocate(screenWidth, screenHeight, OF_IMAGE_COLOR);
 }
 
 //--------------------------------------------------------------
@@ -114,188 +301,890 @@ void ofApp::update() {
 
 //--------------------------------------------------------------
 void ofApp::draw(){
-	// Set visible segments to max if exceeded
-	if (segmentsToShow > (int)lightningSegments.size())
-	{
-		segmentsToShow = (int)lightningSegments.size();
-	}
-	
-	// Set the number of visible segments
-	std::vector<std::shared_ptr<LightningSegment>> activeSegments;
-	if (segmentsToShow > 0) {
-		activeSegments.assign(lightningSegments.begin(), lightningSegments.begin() + segmentsToShow);
-	}
-
-	// Set threads count, each gets a portion of the screen split horizontally
-	int numThreads = std::thread::hardware_concurrency() * 1.9;
-	if (numThreads < 0) numThreads = 8;
-	int rowsPerThread = screenHeight / numThreads;
-
-	// Store the pixel data required for each thread
-	struct ThreadBuf { int yStart, yEnd; std::vector<ofColor> buf; };
-	std::vector<ThreadBuf> threadBufs;
-	threadBufs.reserve(numThreads);
-
-	// Fit thread buffer size
-	int y = 0;
-	for (int t = 0; t < numThreads; ++t) {
-		// Set the beginning, end, and rows
-		int yStart = y;
-		int yEnd; 
-		if (t == numThreads - 1) {
-			yEnd = screenHeight;
-		}
-		else {
-			yEnd = yStart + rowsPerThread;
-		}
-		int rows = yEnd - yStart;
-		
-		ThreadBuf tb;
-		tb.yStart = yStart; 
-		tb.yEnd = yEnd;
-		tb.buf.resize(rows * screenWidth);
-		threadBufs.push_back(std::move(tb));
-		y = yEnd;
+	if (server) {
+		serveNext();
+		return;
+	}
+
+	if (previewMode) {
+		drawPreview();
+		return;
+	}
+
+	if (pipelineDepth > 1) {
+		// Render the whole remaining animation with several frames in flight
+		renderPipelined();
+		ofExit();
+		return;
 	}
 
-	// Anti-aliasing samples
-	int samples = 4;
-	// WARNING : Hard coded 4 samples in the inner loop below, change there if modifying this value
+	renderFrame(frameCount);
+	frameCount++;
 
-	// Intitiate threads
+	if (frameCount >= totalFrames) {
+		ofLog() << "IN TOTAL Render took " << renderMsTotal << " ms (threads=" << workerCount() << ", samples=" << minSamples << "-" << maxSamples << ")";
+		ofExit();
+	}
+
+	// Batch script
+	// Run this (on windows) with ffmpeg to generate a video using the frames
+	// https://ffmpeg.org/download.html
+	// C:\ffmpeg-8.0-essentials_build\bin\ffmpeg.exe -framerate 8 -i out\output%05d.png -c:v libx264 -pix_fmt yuv420p out.mp4
+}
+
+// One frame, all threads on its tiles, saved before returning
+void ofApp::renderFrame(int frame) {
 	auto t0 = std::chrono::high_resolution_clock::now();
-	std::chrono::duration<double> timeTotal;
-	std::vector<std::thread> workers;
-	workers.reserve(threadBufs.size());
-
-	// Count the threads
-	for (size_t tid = 0; tid < threadBufs.size(); ++tid) {
-		workers.emplace_back([&, tid]() {
-
-			// Retrieve the buffer and raytrace
-			ThreadBuf& tb = threadBufs[tid];
-			int yStart = tb.yStart;
-			int yEnd = tb.yEnd;
-			auto& localBuf = tb.buf;
-
-			int rowCount = yEnd - yStart;
-			for (int yy = yStart; yy < yEnd; ++yy) {
-				for (int xx = 0; xx < screenWidth; ++xx) {
-					// Randomize and accumulate 4 samples  unrolled THIS IS HARD CODED BUT REDUCED OVERHEAD
-					glm::vec3 accumulated(0.0f);
-					
-					{
-						float ux = xx + fastRand();
-						float vy = yy + fastRand();
-						accumulated += tracePixel(ux, vy, frameCount, activeSegments);
-					}
+	auto frameJob = prepareFrame(frame);
+	std::vector<Tile> tiles = makeTiles();
+	int numThreads = workerCount();
+	renderTiles(*frameJob, tiles, numThreads);
 
-					{
-						float ux = xx + fastRand();
-						float vy = yy + fastRand();
-						accumulated += tracePixel(ux, vy, frameCount, activeSegments);
-					}
+	// ---------- Timing and logging
+	auto t1 = std::chrono::high_resolution_clock::now();
+	std::chrono::duration<double> took = t1 - t0;
+	renderMsTotal += took.count() * 1000.0;
+	ofLog() << "Render took " << (took.count() * 1000.0) << " ms (threads=" << numThreads << ", samples=" << minSamples << "-" << maxSamples
+		<< ", avg " << (double)frameJob->samplesTaken / (regionW * regionH) << ")";
 
-					{
-						float ux = xx + fastRand();
-						float vy = yy + fastRand();
-						accumulated += tracePixel(ux, vy, frameCount, activeSegments);
-					}
+	finishFrame(*frameJob);
+}
 
-					{
-						float ux = xx + fastRand();
-						float vy = yy + fastRand();
-						accumulated += tracePixel(ux, vy, frameCount, activeSegments);
-					}
+// One job line per call while serving. Only a job that changes the scene rebuilds it, everything else
+// (strike, cloud field, the cloud shadow grid, bounce and ground caches) carries over.
+void ofApp::serveNext() {
+	std::string line;
+	if (!server->poll(line)) {
+		if (server->closed())
+			ofExit();
+		else
+			ofSleepMillis(5);
+		return;
+	}
+	if (line.empty() || line[0] == '#')
+		return;
+	if (line == "quit") {
+		ofExit();
+		return;
+	}
 
-					glm::vec3 color = accumulated / float(samples);
-					color = glm::clamp(color, 0.0f, 1.0f);
+	RenderJob next;
+	if (!RenderServer::parseLine(line, next) || next.mode != RenderJob::RENDER || next.preview) {
+		ofLogError() << "Render server: not a render job: " << line;
+		server->reply("error " + line);
+		return;
+	}
 
-					// store into local buffer (row-major)
-					int localRow = yy - yStart;
-					int idx = localRow * screenWidth + xx;
-					localBuf[idx] = ofColor(
-						(unsigned char)(color.r * 255.0f),
-						(unsigned char)(color.g * 255.0f),
-						(unsigned char)(color.b * 255.0f));
-				}
+	// A sweep is one job per value, each with its own reply
+	for (const RenderJob& step : expandSweep(next))
+		serveJob(step);
+}
+
+// One render job in the running process, the scene rebuilt first if the job asks for a different one
+void ofApp::serveJob(const RenderJob& next) {
+	auto t0 = std::chrono::high_resolution_clock::now();
+	job = next;
+	bool rebuild = !job.sameScene(sceneJob);
+	if (rebuild)
+		loadScene();
+	else
+		ofLog() << "Render server: keeping scene (seed " << sceneSeed << ")";
+	applyJob();
+
+	if (pipelineDepth > 1) {
+		renderPipelined();
+	}
+	else {
+		for (int f = job.frameStart; f < job.frameEnd; ++f)
+			renderFrame(f);
+	}
+
+	namespace fs = std::filesystem;
+	double jobMs = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count() * 1000.0;
+	std::string outDir = fs::absolute(job.outDir.empty() ? fs::path(defaultOutDir()) : fs::path(job.outDir)).string();
+	server->reply("done " + ofToString(job.frameStart) + " " + ofToString(job.frameEnd) + " " + ofToString((int)jobMs)
+		+ (rebuild ? " rebuilt " : " warm ") + outDir);
+}
+
+// All tiles of a frame, workers pull them off a shared counter so fast threads keep busy until the end
+void ofApp::renderTiles(FrameJob& frameJob, const std::vector<Tile>& tiles, int numThreads) {
+	frameJob.tilesLeft = (int)tiles.size();
+	std::atomic<int> nextTile{ 0 };
+	std::vector<std::thread> workers;
+	workers.reserve(numThreads);
+
+	for (int tid = 0; tid < numThreads; ++tid) {
+		workers.emplace_back([&]() {
+			int i;
+			while ((i = nextTile++) < (int)tiles.size()) {
+				renderTile(frameJob, tiles[i]);
+				frameJob.tilesLeft--;
 			}
 		});
 	}
 
 	// Join threads
 	for (auto& w : workers) w.join();
+}
+
+int ofApp::workerCount() const {
+	if (threads > 0)
+		return threads;
+	// Oversubscribe a bit, tracing stalls on memory a lot. hardware_concurrency is unsigned and 0 when unknown.
+	unsigned hardware = std::thread::hardware_concurrency();
+	return hardware > 0 ? (int)(hardware * 1.9) : 8;
+}
+
+std::vector<ofApp::Tile> ofApp::makeTiles() const {
+	return makeTiles(tileSize, regionY, regionY + regionH);
+}
+
+// Tiles over the region's rows [rowStart, rowEnd)
+std::vector<ofApp::Tile> ofApp::makeTiles(int size, int rowStart, int rowEnd) const {
+	std::vector<Tile> tiles;
+	for (int y = rowStart; y < rowEnd; y += size) {
+		for (int x = regionX; x < regionX + regionW; x += size) {
+			Tile t;
+			t.x0 = x;
+			t.y0 = y;
+			t.x1 = glm::min(x + size, regionX + regionW);
+			t.y1 = glm::min(y + size, rowEnd);
+			tiles.push_back(t);
+		}
+	}
+	return tiles;
+}
+
+//--------------------------------------------------------------
+// ---------- Auto-tuning (--tune): threads, tile size and glow kernel for this machine, see autoTune.h
+void ofApp::autoTune() {
+	std::string file = defaultTuneFile();
+	std::string key = tuneKey(screenWidth, screenHeight, minSamples, maxSamples, wavefront);
+	TuneSettings tuned;
+	if (tuneMode == TUNE_CACHED && loadTune(file, key, tuned)) {
+		ofLog() << "Auto-tune: " << describeTune(tuned) << " from " << file << " (" << key << ", "
+			<< tuned.rate / 1e6 << " Mpixel/s when calibrated)";
+	}
+	else {
+		auto t0 = std::chrono::high_resolution_clock::now();
+		tuned = calibrate();
+		double tuneMs = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count() * 1000.0;
+		ofLog() << "Auto-tune: calibration took " << tuneMs << " ms, saved to " << file;
+		saveTune(file, key, tuned);
+	}
+
+	// The tuned values become the defaults every later (server) job starts from, explicit options still win
+	renderDefaults.threads = tuned.threads;
+	renderDefaults.tileSize = tuned.tileSize;
+	renderDefaults.glowKernel = (GlowKernelKind)tuned.glowKernel;
+	if (job.threads <= 0)
+		threads = tuned.threads;
+	tileSize = tuned.tileSize;
+	if (job.glowKernel < 0)
+		glowKernel = (GlowKernelKind)tuned.glowKernel;
+}
+
+// Times a slice of a real frame with each candidate setting: bands of rows through the region of a frame
+// halfway through the job, the strike partly revealed. Only the tiles are timed, the frame is prepared once.
+TuneSettings ofApp::calibrate() {
+	const int BANDS = 2;
+	const int BAND_ROWS = 64;  // the largest tile size, every candidate tiles the same rows
+
+	// The incremental caches stay where they are, the slice's frame shouldn't make the render start over
+	BoltTransmittance savedTransmittance = boltTransmittance;
+	IrradianceCache savedIrradiance = irradianceCache;
+	GroundLight savedGround = groundLight;
+	auto savedTransmittanceFrame = boltTransmittanceFrame;
+	auto savedIrradianceFrame = irradianceFrame;
+	auto savedGroundFrame = groundLightFrame;
+
+	int frame = glm::max((job.frameStart + job.frameEnd) / 2, 1);
+	auto frameJob = prepareFrame(frame);
+
+	std::vector<Tile> slice;
+	auto sliceTiles = [&](int size) {
+		slice.clear();
+		for (int b = 0; b < BANDS; ++b) {
+			int y = regionY + (regionH - BAND_ROWS) * (b + 1) / (BANDS + 1);
+			y = glm::clamp(y, regionY, regionY + regionH - 1);
+			std::vector<Tile> band = makeTiles(size, y, glm::min(y + BAND_ROWS, regionY + regionH));
+			slice.insert(slice.end(), band.begin(), band.end());
+		}
+	};
+	sliceTiles(BAND_ROWS);
+	long long pixels = 0;
+	for (const Tile& t : slice)
+		pixels += (long long)(t.x1 - t.x0) * (t.y1 - t.y0);
+
+	auto rate = [&](const TuneSettings& s) {
+		if (glowMode != GLOW_SPLAT)
+			frameJob->glowKernel.build(frameJob->segs, (GlowKernelKind)s.glowKernel);
+		sliceTiles(s.tileSize);
+		auto t0 = std::chrono::high_resolution_clock::now();
+		renderTiles(*frameJob, slice, s.threads);
+		double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count();
+		return pixels / std::max(seconds, 1e-6);
+	};
+
+	// Only the exact glow runs the kernel, and scalar is the only choice without AVX2
+	TuneSettings start;
+	start.threads = workerCount();
+	start.tileSize = tileSize;
+	start.glowKernel = glowMode != GLOW_SPLAT ? frameJob->glowKernel.kind() : GLOW_KERNEL_SCALAR;
+	std::vector<int> kernels = { start.glowKernel };
+	if (glowMode != GLOW_SPLAT && !frameJob->segs.empty() && GlowKernel::avx2Supported())
+		kernels = { GLOW_KERNEL_SCALAR, GLOW_KERNEL_AVX2 };
+
+	// Around the core count: no SMT, SMT, and oversubscribed for threads stalled on memory
+	int hardware = glm::max(1, (int)std::thread::hardware_concurrency());
+	std::vector<int> threadCounts;
+	for (int n : { hardware / 2, hardware, hardware * 3 / 2, hardware * 2 }) {
+		if (n >= 1 && std::find(threadCounts.begin(), threadCounts.end(), n) == threadCounts.end())
+			threadCounts.push_back(n);
+	}
+
+	ofLog() << "Auto-tune: calibrating on frame " << frame << ", " << pixels << " pixels in " << BANDS << " bands, "
+		<< frameJob->segs.size() << " segments, " << hardware << " hardware threads";
+	TuneSettings best = tuneSearch(start, kernels, threadCounts, { 16, 32, 64 }, rate);
+
+	boltTransmittance = savedTransmittance;
+	irradianceCache = savedIrradiance;
+	groundLight = savedGround;
+	boltTransmittanceFrame = savedTransmittanceFrame;
+	irradianceFrame = savedIrradianceFrame;
+	groundLightFrame = savedGroundFrame;
+	return best;
+}
+
+std::unique_ptr<FrameJob> ofApp::prepareFrame(int frame) {
+	auto frameJob = std::make_unique<FrameJob>();
+	frameJob->frame = frame;
+	frameJob->started = std::chrono::high_resolution_clock::now();
+
+	// Set the number of visible segments, capped at the whole strike
+	int visible = glm::min(frame * segmentsPerFrame, (int)lightningSegments.size());
+	if (visible > 0) {
+		frameJob->segs.assign(lightningSegments.begin(), lightningSegments.begin() + visible);
+	}
+
+	// One swept-sphere chain per visible branch for the camera and shadow ray tests
+	if (capsuleBolts)
+		frameJob->chains.build(frameJob->segs);
+
+	// Exact glow: the segments flattened for the batched kernel (tracing, smooth terms, the compare mode)
+	if (glowMode != GLOW_SPLAT)
+		frameJob->glowKernel.build(frameJob->segs, glowKernel);
 
-	// Copy thread buffers into shared pixels on main thread
-	for (const auto& tb : threadBufs) {
-		int yStart = tb.yStart;
-		int yEnd = tb.yEnd;
-		const auto& localBuf = tb.buf;
-		for (int yy = yStart; yy < yEnd; ++yy) {
-			int localRow = yy - yStart;
-			for (int xx = 0; xx < screenWidth; ++xx) {
-				int idx = localRow * screenWidth + xx;
-				pixels.setColor(xx, yy, localBuf[idx]);
+	// Screen-space glow is built once for the whole frame before tracing
+	if (glowMode != GLOW_EXACT) {
+		auto s0 = std::chrono::high_resolution_clock::now();
+		frameJob->glowSplat.build(cam, screenWidth, screenHeight, frameJob->segs);
+		double splatMs = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - s0).count() * 1000.0;
+		ofLog() << "Glow splat took " << splatMs << " ms (" << frameJob->segs.size() << " segments)";
+	}
+
+	// Bolt light through the clouds: only the newly revealed segments are added, frames in flight keep
+	// the snapshot they were prepared with
+	if (cloudShadows && boltTransmittance.valid()) {
+		auto c0 = std::chrono::high_resolution_clock::now();
+		if (boltTransmittance.update(frameJob->segs) || !boltTransmittanceFrame) {
+			boltTransmittanceFrame = std::make_shared<const BoltTransmittance>(boltTransmittance);
+			double updateMs = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - c0).count() * 1000.0;
+			ofLog() << "Cloud shadow update took " << updateMs << " ms";
+		}
+		frameJob->cloudShadow = boltTransmittanceFrame;
+	}
+
+	// Bounce light: records gather once, then only add the new segments; the view adds records where
+	// it shows surfaces none cover yet (the preview camera moving). Records come from the whole frame even
+	// for a tile, so every tile interpolates the same records and the merged frame has no seams. The
+	// gathers don't keep the light groups apart, so relighting renders without the bounce.
+	if (bounceLight && !lightGroups) {
+		auto b0 = std::chrono::high_resolution_clock::now();
+		if (irradianceCache.update(cam, world, frameJob->segs, screenWidth, screenHeight,
+			0, 0, screenWidth, screenHeight, frameJob->cloudShadow.get()) || !irradianceFrame) {
+			irradianceFrame = std::make_shared<const IrradianceLookup>(irradianceCache.lookup());
+			double updateMs = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - b0).count() * 1000.0;
+			ofLog() << "Irradiance cache update took " << updateMs << " ms (" << irradianceFrame->records.size() << " records)";
+		}
+		frameJob->bounce = irradianceFrame;
+	}
+
+	// Ground light in its own texture space, only the new segments are added to the texels. The light
+	// groups keep the segments apart, so they shade the ground per sample.
+	if (groundCache && !lightGroups && !world.planes.empty()) {
+		// The texel lattice comes from the ground the whole frame sees, the same in every tile. Dropping the
+		// last snapshot first lets update() write the levels no frame in flight still reads in place.
+		auto g0 = std::chrono::high_resolution_clock::now();
+		groundLightFrame.reset();
+		bool changed = groundLight.update(cam, world, 0, frameJob->segs, screenWidth, screenHeight, 0, 0, screenWidth, screenHeight);
+		groundLightFrame = std::make_shared<const GroundLight>(groundLight);  // shares the levels, no texel copy
+		if (changed) {
+			double updateMs = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - g0).count() * 1000.0;
+			ofLog() << "Ground light cache update took " << updateMs << " ms";
+		}
+		if (groundLightFrame->valid())
+			frameJob->ground = groundLightFrame;
+	}
+
+	// Clouds at reduced resolution, shared by every sample of the frame
+	if (volumeScale > 1 && !clouds.empty()) {
+		auto v0 = std::chrono::high_resolution_clock::now();
+		Tile traced = denoiseApron();
+		frameJob->volume.build(cam, world, cloudField, frameJob->segs, screenWidth, screenHeight,
+			traced.x0, traced.y0, traced.x1 - traced.x0, traced.y1 - traced.y0, volumeScale, frameJob->cloudShadow.get());
+		double volumeMs = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - v0).count() * 1000.0;
+		ofLog() << "Volume pass took " << volumeMs << " ms (1/" << volumeScale << " resolution)";
+	}
+
+	// Exact glow at every pixel centre for the comparison mode
+	if (glowMode == GLOW_COMPARE)
+		frameJob->exactGlow.resize(screenWidth * screenHeight);
+
+	if (denoise || aovs)
+		frameJob->gbuffer.resize(regionW * regionH);
+	if (lightGroups)
+		frameJob->groupBuffer.resize(regionW * regionH);
+
+	frameJob->pixels.allocate(regionW, regionH, OF_IMAGE_COLOR);
+	return frameJob;
+}
+
+void ofApp::renderTile(FrameJob& frameJob, const Tile& tile) {
+	if (wavefront) {
+		renderTileWavefront(frameJob, tile);
+		return;
+	}
+
+	long long tileSamples = 0;
+	std::vector<SmoothTerms> smoothCache;
+
+	for (int yy = tile.y0; yy < tile.y1; ++yy) {
+		for (int xx = tile.x0; xx < tile.x1; ++xx) {
+			PixelAccum acc;
+			samplePixel(frameJob, xx, yy, smoothTermsAt(smoothCache, tile, xx, yy, frameJob), acc);
+			tileSamples += acc.taken;
+
+			storePixel(frameJob, xx, yy, acc);
+		}
+	}
+
+	frameJob.samplesTaken += tileSamples;
+}
+
+// Adaptive anti-aliasing. Take minSamples, then keep going while the standard error of the
+// pixel's luminance is above the threshold, up to maxSamples.
+void ofApp::samplePixel(FrameJob& frameJob, int xx, int yy, const SmoothTerms* smooth, PixelAccum& acc) {
+	bool splatGlow = glowMode != GLOW_EXACT;
+	uint32_t seed = pixelSeed(xx, yy, frameJob.frame);
+	seedRandom(seed);
+
+	LightGroupSample groups;
+	while (!acc.converged(minSamples, maxSamples, aaErrorThreshold)) {
+		beginSample(seed, acc.taken);
+		glm::vec2 jitter = stream.get2D(DIM_PIXEL);
+		float ux = xx + jitter.x;
+		float vy = yy + jitter.y;
+		acc.add(traceSample(ux, vy, frameJob, !splatGlow, smooth,
+			lightGroups ? &groups : nullptr), denoise || aovs);
+		if (lightGroups)
+			acc.groups += groups;
+	}
+}
+
+void ofApp::renderTileWavefront(FrameJob& frameJob, const Tile& tile) {
+	// Same adaptive sampling as renderTile, but in rounds: every pixel of the tile gets minSamples in one
+	// batch, then pixels that haven't converged get one more sample per round until none are left.
+	thread_local WavefrontTracer tracer;
+	thread_local std::vector<CameraSample> batch;
+	thread_local std::vector<int> owners;
+	thread_local std::vector<ShadeSample> results;
+
+	bool splatGlow = glowMode != GLOW_EXACT;
+	SceneView scene;
+	scene.cam = &cam;
+	scene.world = &world;
+	scene.clouds = &cloudField;
+	scene.segs = &frameJob.segs;
+	scene.screenWidth = screenWidth;
+	scene.screenHeight = screenHeight;
+	scene.samplesPerLight = samplesPerLight;
+	scene.volume = &frameJob.volume;
+	scene.glow = &frameJob.glowKernel;
+	scene.chains = capsuleBolts ? &frameJob.chains : nullptr;
+	scene.lightShadow = frameJob.cloudShadow.get();
+	scene.bounce = frameJob.bounce.get();
+	scene.ground = frameJob.ground.get();
+	scene.sampler = sampler;
+	scene.analyticShadows = analyticShadows;
+
+	int tileW = tile.x1 - tile.x0;
+	int tileH = tile.y1 - tile.y0;
+	std::vector<PixelAccum> accs(tileW * tileH);
+	std::vector<SmoothTerms> smoothCache;
+
+	for (int round = 0; ; ++round) {
+		batch.clear();
+		owners.clear();
+		for (int i = 0; i < tileW * tileH; ++i) {
+			if (accs[i].converged(minSamples, maxSamples, aaErrorThreshold)) continue;
+			int xx = tile.x0 + i % tileW;
+			int yy = tile.y0 + i / tileW;
+			int count = round == 0 ? minSamples : 1;
+			for (int k = 0; k < count; ++k) {
+				// Jitter and the tracer's random stream both come from the pixel seed and sample index
+				uint32_t seed = pixelSeed(xx, yy, frameJob.frame) ^ ((uint32_t)(accs[i].taken + k + 1) * 0x9E3779B9u);
+				seedRandom(seed);
+				beginSample(pixelSeed(xx, yy, frameJob.frame), accs[i].taken + k);
+				glm::vec2 jitter = stream.get2D(DIM_PIXEL);
+				float ux = xx + jitter.x;
+				float vy = yy + jitter.y;
+
+				CameraSample cs = { ux, vy, seed * 0x85ebca6bu + 1u, smoothTermsAt(smoothCache, tile, xx, yy, frameJob) };
+				cs.pixel = stream.pixel;
+				cs.index = stream.index;
+				batch.push_back(cs);
+				owners.push_back(i);
 			}
 		}
+		if (batch.empty()) break;
+
+		tracer.trace(scene, batch, results, !splatGlow);
+		for (size_t k = 0; k < batch.size(); ++k)
+			accs[owners[k]].add(results[k], denoise || aovs);
 	}
 
-	// ---------- Timing and logging
-	auto t1 = std::chrono::high_resolution_clock::now();
-	std::chrono::duration<double> took = t1 - t0;
-	timeTotal += took;
-	ofLog() << "Render took " << (took.count() * 1000.0) << " ms (threads=" << numThreads << ", samples=" << samples << ")";
+	long long tileSamples = 0;
+	for (int i = 0; i < tileW * tileH; ++i) {
+		tileSamples += accs[i].taken;
+		storePixel(frameJob, tile.x0 + i % tileW, tile.y0 + i / tileW, accs[i]);
+	}
+	frameJob.samplesTaken += tileSamples;
+}
 
-	// ---------- Save the images to a folder named 'out'
-	namespace fs = std::filesystem;
-	fs::path cwd = fs::current_path();
-	fs::path search = cwd;
-	fs::path projectRoot;
-	bool found = false;
-	for (int i = 0; i < 10; ++i) {
-		if (fs::exists(search / "src")) {
-			projectRoot = search;
-			found = true;
-			break;
+const SmoothTerms* ofApp::smoothTermsAt(std::vector<SmoothTerms>& cache, const Tile& tile, int xx, int yy, const FrameJob& frameJob) {
+	if (smoothRate == SHADE_PER_SAMPLE)
+		return nullptr;
+
+	// Blocks are aligned to the image, so a quad split between two tiles gives the same terms in both
+	int rate = smoothRate == SHADE_PER_QUAD ? 2 : 1;
+	int bx0 = tile.x0 / rate;
+	int by0 = tile.y0 / rate;
+	int bw = (tile.x1 - 1) / rate - bx0 + 1;
+	int bh = (tile.y1 - 1) / rate - by0 + 1;
+	if (cache.empty())
+		cache.resize(bw * bh);
+
+	SmoothTerms& st = cache[(yy / rate - by0) * bw + (xx / rate - bx0)];
+	if (st.valid)
+		return &st;
+
+	float cx = (xx / rate + 0.5f) * rate;
+	float cy = (yy / rate + 0.5f) * rate;
+	Ray r = cam.getRay(cx / (screenWidth - 1), cy / (screenHeight - 1));
+	r.spread *= rate;
+	hit_record rec;
+	st.depth = world.hit(r, 0.001f, 1e20f, rec) ? rec.t : 1e20f;
+	if (glowMode == GLOW_EXACT)
+		st.glow = frameJob.glowKernel.glow(r, &st.glowAura, &st.glowCore);
+	if (!clouds.empty() && !frameJob.volume.valid()) {
+		float transmittance = 1.0f;
+		const BoltTransmittance* lightShadow = frameJob.cloudShadow.get();
+		st.volumeNear = renderVolume(r, cloudField, st.depth, glm::vec3(0.0f), frameJob.segs, &transmittance, nullptr, lightShadow);
+		st.volumeOpacity = 1.0f - transmittance;
+		st.volumeFar = renderVolume(r, cloudField, 100.0f, glm::vec3(0.0f), frameJob.segs, nullptr, nullptr, lightShadow);
+	}
+	st.valid = true;
+	return &st;
+}
+
+void ofApp::storePixel(FrameJob& frameJob, int xx, int yy, PixelAccum& acc) {
+	// Keep the averaged layers, finishFrame filters the direct light and composites again / writes the AOVs
+	if (denoise || aovs) {
+		acc.layers *= 1.0f / acc.taken;
+		if (glowMode != GLOW_EXACT)
+			acc.layers.glowAura = frameJob.glowSplat.linearGlowAt(xx, yy);
+		frameJob.gbuffer[(yy - regionY) * regionW + (xx - regionX)] = acc.layers;
+	}
+	if (lightGroups) {
+		acc.groups *= 1.0f / acc.taken;
+		frameJob.groupBuffer[(yy - regionY) * regionW + (xx - regionX)] = acc.groups;
+	}
+
+	glm::vec3 color = acc.color / float(acc.taken);
+	if (glowMode != GLOW_EXACT)
+		color += frameJob.glowSplat.glowAt(xx, yy);
+	color = glm::clamp(color, 0.0f, 1.0f);
+
+	if (glowMode == GLOW_COMPARE) {
+		Ray centre = cam.getRay((xx + 0.5f) / (screenWidth - 1), (yy + 0.5f) / (screenHeight - 1));
+		frameJob.exactGlow[yy * screenWidth + xx] = frameJob.glowKernel.glow(centre);
+	}
+
+	// Tiles never overlap, so writing straight into the frame is safe
+	frameJob.pixels.setColor(xx - regionX, yy - regionY, ofColor(
+		(unsigned char)(color.r * 255.0f),
+		(unsigned char)(color.g * 255.0f),
+		(unsigned char)(color.b * 255.0f)));
+}
+
+// What the denoiser has to see: the region, and for a tile the filter's reach around it, so a tile edge
+// isn't an image edge and the merged tiles match the whole frame denoised at once
+ofApp::Tile ofApp::denoiseApron() const {
+	Tile apron = { regionX, regionY, regionX + regionW, regionY + regionH };
+	if (denoise && job.isTile()) {
+		int margin = 2 << (denoiseSettings.iterations - 1);  // the last pass reaches 2 * 2^(iterations - 1)
+		apron.x0 = glm::max(apron.x0 - margin, 0);
+		apron.y0 = glm::max(apron.y0 - margin, 0);
+		apron.x1 = glm::min(apron.x1 + margin, screenWidth);
+		apron.y1 = glm::min(apron.y1 + margin, screenHeight);
+	}
+	return apron;
+}
+
+// G-buffer over the apron: the region's own layers, the pixels around it traced here. Same seeds and
+// per sample path as the neighbouring tiles' megakernel, so their layers come out the same (a wavefront
+// neighbour only has the same estimator).
+void ofApp::traceApron(FrameJob& frameJob, const Tile& apron, std::vector<ShadeSample>& layers) {
+	int width = apron.x1 - apron.x0;
+	int height = apron.y1 - apron.y0;
+	layers.assign(width * height, ShadeSample());
+	std::atomic<long long> apronSamples{ 0 };
+
+	parallelRows(height, [&](int r0, int r1) {
+		// One row band per thread, its own smooth term blocks (aligned to the image like every tile's)
+		Tile band = { apron.x0, apron.y0 + r0, apron.x1, apron.y0 + r1 };
+		std::vector<SmoothTerms> smoothCache;
+		long long bandSamples = 0;
+		for (int yy = band.y0; yy < band.y1; ++yy) {
+			for (int xx = band.x0; xx < band.x1; ++xx) {
+				ShadeSample& out = layers[(yy - apron.y0) * width + (xx - apron.x0)];
+				if (xx >= regionX && xx < regionX + regionW && yy >= regionY && yy < regionY + regionH) {
+					out = frameJob.gbuffer[(yy - regionY) * regionW + (xx - regionX)];
+					continue;
+				}
+				PixelAccum acc;
+				samplePixel(frameJob, xx, yy, smoothTermsAt(smoothCache, band, xx, yy, frameJob), acc);
+				bandSamples += acc.taken;
+				acc.layers *= 1.0f / acc.taken;
+				if (glowMode != GLOW_EXACT)
+					acc.layers.glowAura = frameJob.glowSplat.linearGlowAt(xx, yy);
+				out = acc.layers;
+			}
 		}
-		if (search.has_parent_path())
-			search = search.parent_path();
-		else
-			break;
+		apronSamples += bandSamples;
+	});
+	ofLog() << "Denoise apron: traced " << (width * height - regionW * regionH) << " pixels around the tile ("
+		<< apronSamples << " samples)";
+}
+
+void ofApp::finishFrame(FrameJob& frameJob) {
+	// ---------- Denoise the direct lighting and composite again
+	if (denoise) {
+		auto d0 = std::chrono::high_resolution_clock::now();
+		Tile apron = denoiseApron();
+		int apronW = apron.x1 - apron.x0;
+		int apronH = apron.y1 - apron.y0;
+		if (apronW == regionW && apronH == regionH) {
+			denoiseDirect(frameJob.gbuffer, regionW, regionH, denoiseSettings);
+		}
+		else {
+			// Filter the apron, keep the tile
+			std::vector<ShadeSample> layers;
+			traceApron(frameJob, apron, layers);
+			denoiseDirect(layers, apronW, apronH, denoiseSettings);
+			for (int yy = 0; yy < regionH; ++yy) {
+				for (int xx = 0; xx < regionW; ++xx)
+					frameJob.gbuffer[yy * regionW + xx] = layers[(yy + regionY - apron.y0) * apronW + (xx + regionX - apron.x0)];
+			}
+		}
+
+		for (int yy = 0; yy < regionH; ++yy) {
+			for (int xx = 0; xx < regionW; ++xx) {
+				glm::vec3 color = frameJob.gbuffer[yy * regionW + xx].compose();
+				if (glowMode != GLOW_EXACT)
+					color += frameJob.glowSplat.glowAt(xx + regionX, yy + regionY);
+				color = glm::clamp(color, 0.0f, 1.0f);
+				frameJob.pixels.setColor(xx, yy, ofColor(
+					(unsigned char)(color.r * 255.0f),
+					(unsigned char)(color.g * 255.0f),
+					(unsigned char)(color.b * 255.0f)));
+			}
+		}
+		double denoiseMs = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - d0).count() * 1000.0;
+		ofLog() << "Denoise took " << denoiseMs << " ms (" << denoiseSettings.iterations << " iterations)";
 	}
 
-	fs::path outPath = found ? (projectRoot / "out") : (cwd / "out");
+	// ---------- Save the images to a folder named 'out' (tiles go to out/tiles for the merge step)
+	namespace fs = std::filesystem;
+	fs::path cwd = fs::current_path();
+	fs::path outPath = job.outDir.empty() ? fs::path(defaultOutDir()) : fs::path(job.outDir);
+	if (job.isTile())
+		outPath /= "tiles";
 	std::error_code ec;
 	fs::create_directories(outPath, ec);
 
-	std::string filename = "output" + ofToString(frameCount, 5, '0') + ".png";
+	std::string filename = job.isTile() ? tileFileName(frameJob.frame, regionX, regionY) : frameFileName(frameJob.frame);
 	fs::path savePath = outPath / filename;
 
 	ofLog() << "CWD: " << cwd.string();
 	ofLog() << "Saving frame to (relative): " << (fs::relative(savePath, cwd)).string();
 	ofLog() << "Saving frame to (absolute): " << fs::absolute(savePath).string();
 
-	ofSaveImage(pixels, savePath.string());
-	frameCount++;
-	segmentsToShow += 48;
+	ofSaveImage(frameJob.pixels, savePath.string());
+
+	// ---------- Float layers for compositing, in an aov folder next to the PNG
+	if (aovs) {
+		auto a0 = std::chrono::high_resolution_clock::now();
+		AovFrame layers;
+		layers.fromSamples(frameJob.gbuffer, regionW, regionH);
+		layers.save((outPath / "aov").string(), savePath.stem().string());
+		if (lightGroups)
+			saveLightGroups((outPath / "aov").string(), savePath.stem().string(), regionW, regionH, frameJob.groupBuffer);
+		double aovMs = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - a0).count() * 1000.0;
+		ofLog() << "AOVs took " << aovMs << " ms (" << AOV_COUNT + (lightGroups ? LIGHT_GROUP_TERMS * LIGHT_GROUPS : 0) << " layers)";
+	}
 
-	if (frameCount >= totalFrames) {
-		ofLog() << "IN TOTAL Render took " << (timeTotal.count() * 1000.0) << " ms (threads=" << numThreads << ", samples=" << samples << ")";
-		ofExit();
+	// ---------- Splat vs exact glow, error stats and an amplified difference image
+	if (glowMode == GLOW_COMPARE) {
+		ofPixels diff;
+		diff.allocate(regionW, regionH, OF_IMAGE_COLOR);
+		double sumErr = 0.0;
+		float maxErr = 0.0f;
+		for (int yy = regionY; yy < regionY + regionH; ++yy) {
+			for (int xx = regionX; xx < regionX + regionW; ++xx) {
+				glm::vec3 d = glm::abs(frameJob.glowSplat.glowAt(xx, yy) - frameJob.exactGlow[yy * screenWidth + xx]);
+				float err = (d.r + d.g + d.b) / 3.0f;
+				sumErr += err;
+				maxErr = std::max(maxErr, err);
+				glm::vec3 c = glm::clamp(d * 4.0f, 0.0f, 1.0f);
+				diff.setColor(xx - regionX, yy - regionY, ofColor(c.r * 255.0f, c.g * 255.0f, c.b * 255.0f));
+			}
+		}
+		ofLog() << "Glow compare: mean abs error " << (sumErr / (regionW * regionH)) << ", max " << maxErr;
+		ofSaveImage(diff, (outPath / ("glowdiff_" + filename)).string());
 	}
+}
 
-	// Batch script
-	// Run this (on windows) with ffmpeg to generate a video using the frames
-	// https://ffmpeg.org/download.html
-	// C:\ffmpeg-8.0-essentials_build\bin\ffmpeg.exe -framerate 8 -i out\output%05d.png -c:v libx264 -pix_fmt yuv420p out.mp4
+void ofApp::renderPipelined() {
+	// Frames are prepared on their own thread and their tiles pushed onto one shared queue.
+	// Workers never wait for a frame to finish, when frame N runs out of tiles they move straight
+	// on to frame N+1, so there is no tail where most threads sit idle.
+	std::mutex mtx;
+	std::condition_variable workReady;   // new tiles or shutdown
+	std::condition_variable slotFree;    // a frame was saved, the producer can prepare another
+	std::condition_variable frameDone;   // a frame has no tiles left
+
+	struct WorkItem { FrameJob* frame; Tile tile; };
+	std::deque<WorkItem> queue;
+	std::deque<std::unique_ptr<FrameJob>> inFlight;
+	bool producerDone = false;
+	int numThreads = workerCount();
+	std::vector<Tile> tiles = makeTiles();
+
+	auto t0 = std::chrono::high_resolution_clock::now();
+
+	// ---------- Producer: segment activation, glow splat and tile queue for upcoming frames
+	std::thread producer([&]() {
+		for (int f = frameCount; f < totalFrames; ++f) {
+			{
+				std::unique_lock<std::mutex> lock(mtx);
+				slotFree.wait(lock, [&]() { return (int)inFlight.size() < pipelineDepth; });
+			}
+
+			auto frameJob = prepareFrame(f);
+			frameJob->tilesLeft = (int)tiles.size();
+
+			std::lock_guard<std::mutex> lock(mtx);
+			for (const auto& t : tiles)
+				queue.push_back({ frameJob.get(), t });
+			inFlight.push_back(std::move(frameJob));
+			workReady.notify_all();
+		}
+		std::lock_guard<std::mutex> lock(mtx);
+		producerDone = true;
+		workReady.notify_all();
+	});
+
+	// ---------- Workers: pull tiles from whichever frame is at the front of the queue
+	std::vector<std::thread> workers;
+	workers.reserve(numThreads);
+	for (int tid = 0; tid < numThreads; ++tid) {
+		workers.emplace_back([&]() {
+			while (true) {
+				WorkItem item;
+				{
+					std::unique_lock<std::mutex> lock(mtx);
+					workReady.wait(lock, [&]() { return !queue.empty() || producerDone; });
+					if (queue.empty()) return;
+					item = queue.front();
+					queue.pop_front();
+				}
+
+				renderTile(*item.frame, item.tile);
+
+				if (--item.frame->tilesLeft == 0) {
+					std::lock_guard<std::mutex> lock(mtx);
+					frameDone.notify_all();
+				}
+			}
+		});
+	}
+
+	// ---------- Main thread: save frames in order as they complete
+	for (int f = frameCount; f < totalFrames; ++f) {
+		std::unique_ptr<FrameJob> frameJob;
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			frameDone.wait(lock, [&]() { return !inFlight.empty() && inFlight.front()->tilesLeft == 0; });
+			frameJob = std::move(inFlight.front());
+			inFlight.pop_front();
+		}
+		slotFree.notify_all();
+
+		double latency = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - frameJob->started).count() * 1000.0;
+		ofLog() << "Frame " << frameJob->frame << " took " << latency << " ms in flight (pipeline depth=" << pipelineDepth
+			<< ", avg samples " << (double)frameJob->samplesTaken / (regionW * regionH) << ")";
+		finishFrame(*frameJob);
+	}
+
+	producer.join();
+	for (auto& w : workers) w.join();
+
+	renderMsTotal = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count() * 1000.0;
+	int frames = totalFrames - frameCount;
+	ofLog() << "IN TOTAL Render took " << renderMsTotal << " ms for " << frames << " frames (threads=" << numThreads << ", samples=" << minSamples << "-" << maxSamples << ", pipeline depth=" << pipelineDepth << ")";
+	frameCount = totalFrames;
+}
+
+void ofApp::restartPreview() {
+	previewFrame = glm::clamp(previewFrame, 0, totalFrames - 1);
+	previewJob = prepareFrame(previewFrame);
+	previewAccum.assign(screenWidth * screenHeight, glm::vec3(0.0f));
+	previewPasses = 0;
+	previewCoarse = previewStartScale;
+	previewStarted = std::chrono::high_resolution_clock::now();
+	if (!previewPixels.isAllocated()) {
+		previewPixels.allocate(screenWidth, screenHeight, OF_IMAGE_COLOR);
+		previewTex.allocate(previewPixels);
+	}
+}
+
+void ofApp::renderPreviewPass() {
+	// Coarse passes trace one sample per block and fill the block, they only show until the
+	// first full resolution pass lands. Full resolution passes add 1 spp to the float accumulator.
+	int block = previewCoarse;
+	bool coarse = block > 1;
+	bool splatGlow = glowMode != GLOW_EXACT;
+	int pass = previewPasses;
+	FrameJob& frameJob = *previewJob;
+
+	std::vector<Tile> tiles;
+	for (int y = 0; y < screenHeight; y += tileSize) {
+		for (int x = 0; x < screenWidth; x += tileSize) {
+			tiles.push_back({ x, y, glm::min(x + tileSize, screenWidth), glm::min(y + tileSize, screenHeight) });
+		}
+	}
+
+	int numThreads = workerCount();
+	std::atomic<int> nextTile{ 0 };
+	std::vector<std::thread> workers;
+	workers.reserve(numThreads);
+
+	for (int tid = 0; tid < numThreads; ++tid) {
+		workers.emplace_back([&]() {
+			int i;
+			while ((i = nextTile++) < (int)tiles.size()) {
+				const Tile& t = tiles[i];
+				for (int yy = t.y0; yy < t.y1; ++yy) {
+					for (int xx = t.x0; xx < t.x1; ++xx) {
+						// Coarse passes only trace the top left pixel of every block
+						if (coarse && (xx % block != 0 || yy % block != 0)) continue;
+
+						seedRandom(pixelSeed(xx, yy, frameJob.frame) ^ ((uint32_t)pass * 0x9E3779B9u));
+
+						glm::vec3 color;
+						if (coarse) {
+							// Centre of the block, no jitter. The light samples still need this pixel's stream.
+							beginSample(pixelSeed(xx, yy, frameJob.frame), pass);
+							color = tracePixel(xx + block * 0.5f, yy + block * 0.5f, frameJob, !splatGlow);
+						}
+						else {
+							beginSample(pixelSeed(xx, yy, frameJob.frame), pass);
+							glm::vec2 jitter = stream.get2D(DIM_PIXEL);
+							float ux = xx + jitter.x;
+							float vy = yy + jitter.y;
+							previewAccum[yy * screenWidth + xx] += tracePixel(ux, vy, frameJob, !splatGlow);
+							color = previewAccum[yy * screenWidth + xx] / float(pass + 1);
+						}
+
+						if (splatGlow)
+							color += frameJob.glowSplat.glowAt(xx, yy);
+						color = glm::clamp(color, 0.0f, 1.0f);
+						ofColor c((unsigned char)(color.r * 255.0f), (unsigned char)(color.g * 255.0f), (unsigned char)(color.b * 255.0f));
+
+						int bw = coarse ? glm::min(block, screenWidth - xx) : 1;
+						int bh = coarse ? glm::min(block, screenHeight - yy) : 1;
+						for (int by = 0; by < bh; ++by)
+							for (int bx = 0; bx < bw; ++bx)
+								previewPixels.setColor(xx + bx, yy + by, c);
+					}
+				}
+			}
+		});
+	}
+	for (auto& w : workers) w.join();
+
+	if (coarse)
+		previewCoarse /= 2;
+	else
+		previewPasses++;
 }
 
-glm::vec3 ofApp::tracePixel(float x, float y, int frame, const std::vector<std::shared_ptr<LightningSegment>> & segs) {
-	(void)frame;
+void ofApp::drawPreview() {
+	if (!previewJob)
+		restartPreview();
+
+	// Keep refining while nothing changes, stop once the offline sample count is well exceeded
+	if (previewPasses < previewMaxPasses) {
+		auto t0 = std::chrono::high_resolution_clock::now();
+		renderPreviewPass();
+		previewPassMs = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count() * 1000.0;
+		previewTex.loadData(previewPixels);
+	}
+
+	ofSetColor(255);
+	previewTex.draw(0, 0, screenWidth, screenHeight);
+
+	double sinceRestart = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - previewStarted).count() * 1000.0;
+	std::string info = "frame " + ofToString(previewFrame)
+		+ "  spp " + ofToString(previewPasses)
+		+ (previewPasses == 0 ? "  (coarse)" : "")
+		+ "  last pass " + ofToString((int)previewPassMs) + " ms"
+		+ "  since change " + ofToString((int)sinceRestart) + " ms";
+	ofDrawBitmapStringHighlight(info, 10, 20);
+	ofDrawBitmapStringHighlight("wasd/qe move, drag pan, , . frame, p exit preview", 10, 40);
+}
+
+void ofApp::moveCamera(const glm::vec3& delta) {
+	cam.camera_center += delta;
+	cam.lowerLeft += delta;
+	if (previewMode)
+		restartPreview();
+}
+
+glm::vec3 ofApp::tracePixel(float x, float y, const FrameJob& frameJob, bool includeGlow) {
+	return traceSample(x, y, frameJob, includeGlow).compose();
+}
+
+ShadeSample ofApp::traceSample(float x, float y, const FrameJob& frameJob, bool includeGlow, const SmoothTerms* smooth, LightGroupSample* groups) {
+	const auto& segs = frameJob.segs;
+	const VolumeBuffer* volume = &frameJob.volume;
+	const BoltTransmittance* lightShadow = frameJob.cloudShadow.get();
 	float u = x / (screenWidth - 1);
 	float v = y / (screenHeight - 1);
 
-	const int SAMPLES_PER_LIGHT = 4; // adjust for speed / accuracy
+	const int SAMPLES_PER_LIGHT = samplesPerLight;
 
 	const float EPS = 0.001f;
 
@@ -304,27 +1193,49 @@ glm::vec3 ofApp::tracePixel(float x, float y, int frame, const std::vector<std::
 	hit_record rec;
 	float closest = 1e20f;
 
-	glm::vec3 background(0.0f);
-	glm::vec3 pixelColor = background;
+	// The terms are kept apart, ShadeSample::compose adds them up in the original order
+	ShadeSample sample;
+	if (groups)
+		*groups = LightGroupSample();
 
 	// ---------- OBJECT INTERSECTION 
-	bool hitAnything = false;
-	for (auto& obj : world) {
-		if (obj->hit(r, EPS, closest, rec)) {
-			closest = rec.t;
-			hitAnything = true;
-		}
-	}
+	// Nearest t only, the full record is filled in once for the object that won
+	// (world.hit, with the object kept for the ground light cache)
+	float nearestT = closest;
+	float hitMax = closest;
+	PrimRef hitRef = world.nearest(r, EPS, nearestT, hitMax);
+	bool hitAnything = world.resolve(hitRef, r, EPS, hitMax, rec);
+	if (hitAnything)
+		closest = rec.t;
 
 	if (hitAnything) {
+		sample.coverage = 1.0f;
+		sample.normal = rec.normal;
+		sample.albedo = rec.color;
+		sample.depth = closest;
+
 		// Immediate return if the object is emissive
 		if (rec.emissive) {
-			return glm::clamp(rec.emissionColor, 0.0f, 1.0f);
+			sample.direct = rec.emissionColor;
+			sample.emissive = 1.0f;
+			return sample;
 		}
 
 		glm::vec3 totalLightRGB(0.0f);
+		thread_local std::vector<LightSpan> spans;
 
-		for (auto& lightningSegment : segs) {
+		// Share of the bolt light the clouds let through to this point
+		float cloudVisibility = lightShadow ? lightShadow->irradiance(rec.p) : 1.0f;
+
+		// Ground light from the texture space cache, the same sum without the shadow rays
+		const GroundLight* ground = frameJob.ground.get();
+		bool cached = ground && hitRef.kind == PrimRef::PLANE && hitRef.index == ground->planeIndex() &&
+			ground->lookup(rec.p, totalLightRGB);
+		if (cached)
+			totalLightRGB *= cloudVisibility;
+
+		for (uint32_t j = 0; j < segs.size() && !cached; ++j) {
+			const auto& lightningSegment = segs[j];
 			if (!lightningSegment->isEmissive()) continue;
 			auto& light = *(lightningSegment->lightSource);
 			glm::vec3 totalSampleColor(0.0f);
@@ -332,12 +1243,22 @@ glm::vec3 ofApp::tracePixel(float x, float y, int frame, const std::vector<std::
 			glm::vec3 segStart = lightningSegment->startPoint;
 			glm::vec3 segVec = lightningSegment->endPoint - lightningSegment->startPoint;
 
+			// Spheres and planes cut the segment down to its visible spans exactly, the samples only go there
+			float visible = 1.0f;
+			if (analyticShadows) {
+				visible = visibleSpans(world, rec.p, rec.p + rec.normal * EPS, segStart, lightningSegment->endPoint, spans);
+				if (visible <= 0.0f) continue;
+			}
+
 			for (int s = 0; s < SAMPLES_PER_LIGHT; s++) {
-				float tSample = glm::linearRand(0.0f, 1.0f);
+				// Position along the segment and radius jitter, each its own sample dimension per light
+				float tSample = stream.get1D(DIM_LIGHT + 2 * j, s, SAMPLES_PER_LIGHT);
+				if (analyticShadows)
+					tSample = spanParameter(spans, visible, tSample);
 				glm::vec3 samplePos = segStart + tSample * segVec;
 
 				if (light.radius > 0.0f) {
-					glm::vec3 jitter = glm::sphericalRand(light.radius * 0.5f);
+					glm::vec3 jitter = (light.radius * 0.5f) * uniformOnSphere(stream.get2D(DIM_LIGHT + 2 * j + 1, s, SAMPLES_PER_LIGHT));
 					samplePos += jitter;
 				}
 
@@ -351,22 +1272,20 @@ glm::vec3 ofApp::tracePixel(float x, float y, int frame, const std::vector<std::
 
 				Ray shadow(rec.p + rec.normal * EPS, lightDir);
 
-				bool inShadow = false;
-				hit_record shadowRec;
+				if (analyticShadows ? world.occludedThin(shadow, EPS, dist - EPS) : world.occluded(shadow, EPS, dist - EPS)) continue;
 
-				for (auto& obj2 : world) {
-					if (obj2->hit(shadow, EPS, dist - EPS, shadowRec)) {
-						inShadow = true;
-						break;
-					}
+				bool inShadow = false;
+				if (capsuleBolts) {
+					inShadow = frameJob.chains.occluded(shadow, EPS, dist - EPS);
 				}
-				if (inShadow) continue;
-
-				for (auto& otherSeg : segs) {
-					if (otherSeg.get() == lightningSegment.get()) continue;
-					if (otherSeg->hit(shadow, EPS, dist - EPS, shadowRec)) {
-						inShadow = true;
-						break;
+				else {
+					hit_record shadowRec;
+					for (auto& otherSeg : segs) {
+						if (otherSeg.get() == lightningSegment.get()) continue;
+						if (queryShape<HitQuery::Occlusion>(*otherSeg, shadow, EPS, dist - EPS, shadowRec)) {
+							inShadow = true;
+							break;
+						}
 					}
 				}
 				if (inShadow) continue;
@@ -375,120 +1294,144 @@ glm::vec3 ofApp::tracePixel(float x, float y, int frame, const std::vector<std::
 				float nDotL = glm::max(glm::dot(rec.normal, lightDir), 0.0f);
 				float attenuation = light.intensity / (dist2 + 1e-4f);
 
-				totalSampleColor += (light.color * attenuation) * nDotL;
+				totalSampleColor += (light.color * attenuation) * (nDotL * visible);
 			}
 
-			totalSampleColor /= float(SAMPLES_PER_LIGHT);
+			totalSampleColor *= cloudVisibility / float(SAMPLES_PER_LIGHT);
 			totalLightRGB += totalSampleColor;
+			if (groups)
+				groups->direct[lightGroup(*lightningSegment)] += rec.color * totalSampleColor * 0.09f;
 		}
 
 		glm::vec3 ambient = 0.004f * rec.color; // Very low ambient -> move to 0.005 if too low
 		glm::vec3 diffuse = rec.color * totalLightRGB * 0.09f; // Reduced diffuse -> move to 0.10 if too low
-		pixelColor = glm::clamp(ambient + diffuse, 0.0f, 1.0f);
+		sample.direct = ambient + diffuse;
+		if (frameJob.bounce)
+			sample.direct += rec.color * frameJob.bounce->indirect(rec.p, rec.normal);
 	}
 
 	// ---------- LIGHTNING BOLT HIT TEST
-	for (auto& seg : segs) {
+	auto addBolt = [&](const LightningSegment& seg) {
+		sample.bolt += seg.boltColor();
+		if (groups && seg.isEmissive())
+			groups->bolt[lightGroup(seg)] += seg.boltColor();
+	};
+	if (capsuleBolts) {
+		frameJob.chains.forEachHit(r, EPS, closest, addBolt);
+	}
+	else {
 		hit_record lrec;
-		if (seg->hit(r, EPS, closest, lrec)) {
-			if (seg->isEmissive() && seg->lightSource) {
-				float baseScale;
-				float depthFactor;
-				float fade;
-
-				if (seg->isMainBranchSegment) {
-					baseScale = 1.0f;
-					depthFactor = 1.0f;
-					fade = 1.0f;
-				} else if (seg->branchDepth == 1) {
-					baseScale = 0.3f;
-					depthFactor = 0.8f;
-					fade = 0.9f;
-				} else {
-					baseScale = 0.3f;
-					depthFactor = powf(0.6f, seg->branchDepth);
-					float t = glm::length(seg->midpoint() - seg->startPoint) / seg->length();
-					fade = powf(1.0f - t, 1.5f);
-				}
-
-				float intensityScale = baseScale * fade * depthFactor;
-				glm::vec3 emitted = seg->lightSource->color * seg->lightSource->intensity * intensityScale;
-
-				pixelColor += emitted;
-			} else {
-				float t = glm::length(seg->midpoint() - seg->startPoint) / seg->length();
-				float fade = seg->isMainBranchSegment ? 1.0f : powf(1.0f - t, 1.5f);
-				float intensityScale = seg->isMainBranchSegment ? 1.0f : 0.1f * fade;
-				pixelColor += lrec.color * intensityScale;
-			}
+		for (auto& seg : segs) {
+			if (queryShape<HitQuery::ClosestT>(*seg, r, EPS, closest, lrec))
+				addBolt(*seg);
 		}
 	}
 
-	if (!clouds.empty()) {
-		glm::vec3 withClouds = renderVolume(r, clouds, closest, pixelColor, segs);
-		pixelColor = glm::clamp(withClouds, 0.0f, 1.0f);
-	} else {
-		pixelColor = glm::clamp(pixelColor, 0.0f, 1.0f);
-	}
+	if (sample.bolt != glm::vec3(0.0f))
+		sample.emissive = 1.0f;
 
-	// 3. RENDER CLOUDS FIRST (if ray didn't hit anything)
+	// ---------- CLOUDS (renderVolume only adds in-scatter on top of the colour passed in)
 	if (!clouds.empty()) {
-		pixelColor = renderVolume(r, clouds, 100.0f, pixelColor, segs);
+		if (volume && volume->valid()) {
+			// Marched at lower resolution in prepareFrame, upsampled against this sample's depth
+			volume->sample(x, y, closest, sample.volumeNear, sample.volumeFar, &sample.volumeOpacity);
+		}
+		else if (smooth) {
+			// Shared with the rest of the pixel / quad, the near march only where the depth agrees
+			sample.volumeFar = smooth->volumeFar;
+			float transmittance = 1.0f - smooth->volumeOpacity;
+			if (smooth->matchesDepth(closest))
+				sample.volumeNear = smooth->volumeNear;
+			else
+				sample.volumeNear = renderVolume(r, cloudField, closest, glm::vec3(0.0f), segs, &transmittance, nullptr, lightShadow);
+			sample.volumeOpacity = 1.0f - transmittance;
+		}
+		else {
+			float transmittance = 1.0f;
+			sample.volumeNear = renderVolume(r, cloudField, closest, glm::vec3(0.0f), segs, &transmittance,
+				groups ? groups->volumeNear : nullptr, lightShadow);
+			sample.volumeOpacity = 1.0f - transmittance;
+
+			// 3. RENDER CLOUDS FIRST (if ray didn't hit anything)
+			sample.volumeFar = renderVolume(r, cloudField, 100.0f, glm::vec3(0.0f), segs, nullptr,
+				groups ? groups->volumeFar : nullptr, lightShadow);
+		}
 	}
 
 	// ---------- ADD GLOW ON TOP 
-	glm::vec3 glowTotal(0.0f);
-	glm::vec3 pinkGlow(1.0f, 0.5f, 0.8f);
-
-	for (const auto& seg : segs) {
-		float glow = seg->computeGlowForRay(r);
-
-		if (!seg->isMainBranchSegment && seg->branchDepth == 1)
-			glow *= 5.0f;
-
-		float t = glm::length(seg->midpoint() - seg->startPoint) / seg->length();
-		float tFade = seg->isMainBranchSegment ? 1.0f : (seg->branchDepth == 1 ? 1.0f : powf(1.0f - t, 1.5f));
-		float depthFade = seg->isMainBranchSegment ? 1.0f : (seg->branchDepth == 1 ? 1.0f : powf(0.45f, seg->branchDepth));
-		float finalScale = tFade * depthFade;
-
-		float auraMult = seg->isMainBranchSegment ? 0.6f : (seg->branchDepth == 1 ? 0.6f : 0.02f);
-		float coreMult = seg->isMainBranchSegment ? 0.15f : (seg->branchDepth == 1 ? 0.15f : 0.01f);
-
-		glm::vec3 aura = pinkGlow * glow * auraMult * finalScale;
-		glm::vec3 core = pinkGlow * glow * coreMult * finalScale;
-
-		if (!seg->isMainBranchSegment && seg->branchDepth == 1)
-			glowTotal += aura + core;
-		else
-			glowTotal += (aura + core) * glm::exp(-glowTotal);
+	// (Skipped when the glow comes from the screen-space splat instead)
+	if (includeGlow) {
+		if (smooth) {
+			sample.glow = smooth->glow;
+			sample.glowAura = smooth->glowAura;
+			sample.glowCore = smooth->glowCore;
+		}
+		else {
+			sample.glow = frameJob.glowKernel.glow(r, &sample.glowAura, &sample.glowCore, groups ? groups->glow : nullptr);
+		}
 	}
 
-	glowTotal = glm::pow(glowTotal, glm::vec3(0.6f));
-	glowTotal = glm::min(glowTotal, glm::vec3(1.0f));
-
-	pixelColor += glowTotal;
-	pixelColor = glm::clamp(pixelColor, 0.0f, 1.0f);
-	return pixelColor;
+	return sample;
 }
 
 float ofApp::fastRand() {
-		thread_local uint32_t state = make_seed_for_current_thread();
+	return stream.nextRandom();
+}
 
-		xorState ^= xorState << 13;
-		xorState ^= xorState >> 17;
-		xorState ^= xorState << 5;
-		return (xorState & 0x00FFFFFF) * (1.0f / 16777216.0f);
+void ofApp::seedRandom(uint32_t seed) {
+	// xorshift gets stuck on zero
+	stream.rng = seed ? seed : 0x9E3779B9u;
 }
 
-uint32_t ofApp::make_seed_for_current_thread() {
-	std::hash<std::thread::id> hasher;
-	auto thread_id = std::this_thread::get_id();
-	size_t hash = hasher(thread_id);
-	return static_cast<uint32_t>(hash ^ std::chrono::high_resolution_clock::now().time_since_epoch().count());
+void ofApp::beginSample(uint32_t pixel, uint32_t index) {
+	// The random stream keeps running across the pixel, the low discrepancy one is indexed by sample
+	stream.kind = sampler;
+	stream.pixel = pixel;
+	stream.index = index;
+}
+
+uint32_t ofApp::pixelSeed(int x, int y, int frame) const {
+	// Mix scene seed, frame and pixel (murmur3 finalizer) so neighbouring pixels get unrelated streams
+	uint32_t h = sceneSeed;
+	h ^= (uint32_t)x * 0x8da6b343u;
+	h ^= (uint32_t)y * 0xd8163841u;
+	h ^= (uint32_t)frame * 0xcb1ab31fu;
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+	return h;
 }
 
 //--------------------------------------------------------------
 void ofApp::keyPressed(int key) {
+	// Preview toggle and controls
+	if (key == 'p') {
+		previewMode = !previewMode;
+		if (previewMode)
+			restartPreview();
+		return;
+	}
+	if (!previewMode) return;
+
+	float step = 0.1f;
+	switch (key) {
+	case 'w': moveCamera(glm::vec3(0, 0, -step)); break;
+	case 's': moveCamera(glm::vec3(0, 0, step)); break;
+	case 'a': case OF_KEY_LEFT: moveCamera(glm::vec3(-step, 0, 0)); break;
+	case 'd': case OF_KEY_RIGHT: moveCamera(glm::vec3(step, 0, 0)); break;
+	case 'q': case OF_KEY_UP: moveCamera(glm::vec3(0, -step, 0)); break;
+	case 'e': case OF_KEY_DOWN: moveCamera(glm::vec3(0, step, 0)); break;
+	case ',':
+		previewFrame = glm::max(previewFrame - 1, 0);
+		restartPreview();
+		break;
+	case '.':
+		previewFrame = glm::min(previewFrame + 1, totalFrames - 1);
+		restartPreview();
+		break;
+	}
 }
 
 //--------------------------------------------------------------
@@ -501,10 +1444,20 @@ void ofApp::mouseMoved(int x, int y) {
 
 //--------------------------------------------------------------
 void ofApp::mouseDragged(int x, int y, int button) {
+	if (!previewMode) return;
+
+	// Pan the camera in the view plane, one pixel of drag is one pixel of image at the focal plane
+	float pixelSize = glm::length(cam.horizontal) / float(screenWidth - 1);
+	glm::vec3 delta(-(x - lastMouseX) * pixelSize, -(y - lastMouseY) * pixelSize, 0.0f);
+	lastMouseX = x;
+	lastMouseY = y;
+	moveCamera(delta);
 }
 
 //--------------------------------------------------------------
 void ofApp::mousePressed(int x, int y, int button) {
+	lastMouseX = x;
+	lastMouseY = y;
 }
 
 //--------------------------------------------------------------
@@ -8,7 +8,90 @@
 #include "lightningSegment.h"
 #include "branch.h"
 #include "Plane.h"
+#include "primitiveStore.h"
 #include "cloud.h"
+#include "cloudField.h"
+#include "glowSplat.h"
+#include "glowKernel.h"
+#include "capsuleChain.h"
+#include "boltTransmittance.h"
+#include "irradianceCache.h"
+#include "groundLight.h"
+#include "renderJob.h"
+#include "renderServer.h"
+#include "autoTune.h"
+#include "shadeSample.h"
+#include "denoise.h"
+#include "wavefront.h"
+#include "sceneCache.h"
+#include "volumePass.h"
+#include "sampler.h"
+#include "aovOutput.h"
+#include "lineLight.h"
+
+// How often the smooth terms (glow, clouds) are evaluated
+enum ShadingRate {
+	SHADE_PER_SAMPLE,  // with everything else, on every AA sample
+	SHADE_PER_PIXEL,   // once at the pixel centre
+	SHADE_PER_QUAD     // once at the centre of each 2x2 pixel quad
+};
+
+// How the bolt glow is produced
+enum GlowMode {
+	GLOW_EXACT,   // computeGlowForRay for every segment on every sample
+	GLOW_SPLAT,   // screen-space splat + blur, once per frame
+	GLOW_COMPARE  // render with the splat and log its error against the exact glow
+};
+
+// Everything one frame needs while it is being traced. Several can be alive at once in the pipelined renderer.
+struct FrameJob {
+	int frame = 0;
+	std::vector<std::shared_ptr<LightningSegment>> segs;  // segments visible in this frame
+	GlowSplatter glowSplat;
+	GlowKernel glowKernel;                                 // exact glow, one ray against all segments
+	BoltChains chains;                                     // the segments as one swept-sphere chain per branch, capsuleBolts only
+	std::shared_ptr<const BoltTransmittance> cloudShadow;  // bolt light through the clouds, cloudShadows only
+	std::shared_ptr<const IrradianceLookup> bounce;        // cached indirect light on the surfaces, bounceLight only
+	std::shared_ptr<const GroundLight> ground;             // ground light in texture space, groundCache only
+	VolumeBuffer volume;                                   // volumeScale > 1 only
+	std::vector<glm::vec3> exactGlow;                     // GLOW_COMPARE only
+	std::vector<ShadeSample> gbuffer;                     // averaged layers per pixel, denoiser / AOVs only
+	std::vector<LightGroupSample> groupBuffer;            // averaged light group terms per pixel, lightGroups only
+	ofPixels pixels;
+	std::atomic<int> tilesLeft{ 0 };
+	std::atomic<long long> samplesTaken{ 0 };             // adaptive AA statistics
+	std::chrono::high_resolution_clock::time_point started;
+};
+
+// Running per pixel statistics for adaptive anti-aliasing (Welford mean / variance of the luminance)
+struct PixelAccum {
+	glm::vec3 color = glm::vec3(0.0f);  // sum of composited samples
+	ShadeSample layers;                 // sum of the separate terms, only kept for the denoiser / AOVs
+	LightGroupSample groups;            // sum of the light group terms, lightGroups only
+	float lumMean = 0.0f;
+	float lumM2 = 0.0f;
+	int taken = 0;
+
+	void add(const ShadeSample& shade, bool keepLayers) {
+		glm::vec3 sample = shade.compose();
+		color += sample;
+		if (keepLayers)
+			layers += shade;
+		taken++;
+
+		float lum = glm::dot(sample, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+		float delta = lum - lumMean;
+		lumMean += delta / taken;
+		lumM2 += delta * (lum - lumMean);
+	}
+
+	bool converged(int minSamples, int maxSamples, float errorThreshold) const {
+		if (taken >= maxSamples) return true;
+		if (taken < minSamples) return false;
+		float variance = taken > 1 ? lumM2 / (taken - 1) : 0.0f;
+		return variance / taken <= errorThreshold * errorThreshold;
+	}
+};
 
 class ofApp : public ofBaseApp{
 
@@ -17,6 +100,13 @@ class ofApp : public ofBaseApp{
 		void update();
 		void draw();
 
+		// Scene
+		void loadScene();
+		void applyJob();
+		void saveRenderDefaults();
+		void restoreRenderDefaults();
+		void generateScene();
+
 		void keyPressed(int key);
 		void keyReleased(int key);
 		void mouseMoved(int x, int y );
@@ -29,33 +119,138 @@ class ofApp : public ofBaseApp{
 		void dragEvent(ofDragInfo dragInfo);
 		void gotMessage(ofMessage msg);
 
+		// Frame rendering, split so frames can be prepared while others are still tracing
+		struct Tile { int x0, y0, x1, y1; };
+		int workerCount() const;
+		std::vector<Tile> makeTiles() const;
+		std::vector<Tile> makeTiles(int size, int rowStart, int rowEnd) const;
+		void renderTiles(FrameJob& frameJob, const std::vector<Tile>& tiles, int numThreads);
+		void autoTune();
+		TuneSettings calibrate();
+		std::unique_ptr<FrameJob> prepareFrame(int frame);
+		void renderTile(FrameJob& frameJob, const Tile& tile);
+		void renderTileWavefront(FrameJob& frameJob, const Tile& tile);
+		void samplePixel(FrameJob& frameJob, int xx, int yy, const SmoothTerms* smooth, PixelAccum& acc);
+		void storePixel(FrameJob& frameJob, int xx, int yy, PixelAccum& acc);
+		Tile denoiseApron() const;
+		void traceApron(FrameJob& frameJob, const Tile& apron, std::vector<ShadeSample>& layers);
+		void finishFrame(FrameJob& frameJob);
+		void renderFrame(int frame);
+		void renderPipelined();
+
+		// Render server (--serve): jobs from stdin against the scene kept in memory
+		void serveNext();
+		void serveJob(const RenderJob& next);
+
+		// Interactive preview: 1 spp passes into a float accumulator, restarted on any change
+		void restartPreview();
+		void renderPreviewPass();
+		void drawPreview();
+		void moveCamera(const glm::vec3& delta);
+
 		// The Raytracing Algorithm
-		glm::vec3 tracePixel(float x, float y, int frame, const std::vector<std::shared_ptr<LightningSegment>>& segs);
+		glm::vec3 tracePixel(float x, float y, const FrameJob& frameJob, bool includeGlow = true);
+		ShadeSample traceSample(float x, float y, const FrameJob& frameJob, bool includeGlow = true, const SmoothTerms* smooth = nullptr, LightGroupSample* groups = nullptr);
+		const SmoothTerms* smoothTermsAt(std::vector<SmoothTerms>& cache, const Tile& tile, int xx, int yy, const FrameJob& frameJob);
 		
-		// Random number generator state
-		uint32_t xorState = 123456789;
+		// Random number generator (per thread state, see ofApp.cpp)
 		float fastRand();
-		uint32_t make_seed_for_current_thread();
+		void seedRandom(uint32_t seed);
+		void beginSample(uint32_t pixel, uint32_t index);
+		uint32_t pixelSeed(int x, int y, int frame) const;
 
 		// Objects
 		ofShader basic;
-		ofPixels pixels;
 		Camera cam;
 
 		// Scene Data structures
-		std::vector<Cloud> clouds;
-		std::vector<std::shared_ptr<hittable>> world;
-		std::vector<std::shared_ptr<Sphere>> strikeTargets;
+		std::vector<Cloud> clouds;  // scene description, traced through cloudField
+		CloudField cloudField;
+		BoltTransmittance boltTransmittance;                          // sums up to the last prepared frame
+		std::shared_ptr<const BoltTransmittance> boltTransmittanceFrame;  // snapshot handed to the frames
+		IrradianceCache irradianceCache;                              // records up to the last prepared frame
+		std::shared_ptr<const IrradianceLookup> irradianceFrame;      // snapshot handed to the frames
+		GroundLight groundLight;                                      // texels up to the last prepared frame
+		std::shared_ptr<const GroundLight> groundLightFrame;          // snapshot handed to the frames
+		PrimitiveStore world;
+		std::vector<Sphere> strikeTargets;
 		std::vector<LightSource> lightSources;
 		std::vector<std::shared_ptr<LightningSegment>> lightningSegments;
-		int segmentsToShow = 0;
 
 		
 		// Settings
+		RenderJob job;        // frame range / tile / seed, filled in from the command line
+		RenderJob sceneJob;   // the job the current scene was loaded / generated for
+		std::unique_ptr<RenderServer> server;  // --serve only
+		uint32_t sceneSeed = 0;
 		int screenWidth;
 		int screenHeight;
 		int frameCount = 0;
 		int totalFrames = 24; // 1 seconds at 24 fps
+		int segmentsPerFrame = 48; // bolt segments revealed each frame
+
+		// Part of the image this process renders (the whole screen unless rendering a tile)
+		int regionX = 0;
+		int regionY = 0;
+		int regionW = 0;
+		int regionH = 0;
+
+		// Quality / performance
+		GlowMode glowMode = GLOW_EXACT;
+		int minSamples = 2;        // anti-aliasing samples every pixel gets
+		int maxSamples = 16;       // cap for noisy pixels (bolt edges, cloud detail, soft shadows)
+		float aaErrorThreshold = 0.01f; // stop once the luminance standard error drops below this
+		SamplerKind sampler = SAMPLER_SOBOL;  // AA jitter and light sample positions, see sampler.h
+		int samplesPerLight = 4;   // shadow rays per segment light, adjust for speed / accuracy
+		GlowKernelKind glowKernel = GLOW_KERNEL_AUTO;  // exact glow, 8 segments at a time with AVX2, see glowKernel.h
+		bool cloudShadows = true;  // bolt light on the ground and in the clouds attenuated by the cloud in between, see boltTransmittance.h
+		bool groundCache = false;  // ground light from a texture space cache updated per revealed segment, no per sample shadow rays, see groundLight.h
+		bool bounceLight = true;   // one bounce of bolt light between the ground and the spheres, irradiance cached, see irradianceCache.h
+		bool capsuleBolts = true;  // bolt branches as round cone chains with per branch bounds, false = a flat capped cylinder per segment, see capsuleChain.h
+		bool analyticShadows = true;  // exact sphere / plane visibility per segment, rays only test cylinders, see lineLight.h
+		bool denoise = false;      // filter the direct lighting with the G-buffer, lets --spp 1 2 get close to 4 spp
+		DenoiseSettings denoiseSettings;
+		bool aovs = false;         // also write the float layers to out/aov for re-grading, see aovOutput.h
+		bool lightGroups = false;  // and the per light group layers for relighting, see lightGroups.h
+		bool wavefront = false;    // trace tiles as ray streams (WavefrontTracer) instead of one sample at a time
+		ShadingRate smoothRate = SHADE_PER_SAMPLE;  // glow / cloud shading rate, see ShadingRate
+		float noiseLodScale = 1.0f;  // cloud noise LOD footprint multiplier, 0 = always every octave
+		int volumeScale = 1;       // 1 = clouds marched per sample, 2 / 4 = once per 2x2 / 4x4 block with depth-aware upsampling
+		int tileSize = 32;         // work unit handed to the threads
+		int threads = 0;           // render workers, 0 = hardware threads * 1.9
+		TuneMode tuneMode = TUNE_OFF;  // measure threads / tile size / glow kernel at startup, cached per machine, see autoTune.h
+		int pipelineDepth = 1;     // frames in flight, 1 = render one frame per draw()
+		double renderMsTotal = 0.0;
+
+		// The settings above a job can change, as setup() found them (and as --tune picked them)
+		struct RenderDefaults {
+			GlowMode glowMode;
+			int minSamples, maxSamples;
+			SamplerKind sampler;
+			GlowKernelKind glowKernel;
+			bool cloudShadows, groundCache, bounceLight, capsuleBolts, analyticShadows;
+			bool denoise, aovs, lightGroups, wavefront;
+			ShadingRate smoothRate;
+			int volumeScale, tileSize, threads, pipelineDepth;
+			TuneMode tuneMode;
+		};
+		RenderDefaults renderDefaults;
+
+		// Preview settings and state
+		bool previewMode = false;     // 'p' or --preview
+		int previewStartScale = 8;    // first pass traces one pixel per 8x8 block, then 4x4, 2x2
+		int previewMaxPasses = 256;   // stop refining after this many spp
+		int previewFrame = 12;        // animation frame shown in the preview
+		std::unique_ptr<FrameJob> previewJob;
+		std::vector<glm::vec3> previewAccum;
+		ofPixels previewPixels;
+		ofTexture previewTex;
+		int previewPasses = 0;
+		int previewCoarse = 1;
+		double previewPassMs = 0.0;
+		std::chrono::high_resolution_clock::time_point previewStarted;
+		int lastMouseX = 0;
+		int lastMouseY = 0;
 
 		// Add this field to track if the main branch has hit a target
 		bool mainBranchHit = false;
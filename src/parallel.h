@@ -0,0 +1,21 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <thread>
+#include <vector>
+#include <algorithm>
+
+// Run fn(yStart, yEnd) over row bands on all cores
+template <class Fn>
+inline void parallelRows(int height, Fn fn) {
+    int numThreads = std::max(1, (int)std::thread::hardware_concurrency());
+    int rowsPerThread = (height + numThreads - 1) / numThreads;
+    std::vector<std::thread> workers;
+    for (int y = 0; y < height; y += rowsPerThread) {
+        int yEnd = std::min(y + rowsPerThread, height);
+        workers.emplace_back([=]() { fn(y, yEnd); });
+    }
+    for (auto& w : workers) w.join();
+}
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef PRIMITIVESTORE_H
+#define PRIMITIVESTORE_H
+
+#include "hittable.h"
+#include "sphere.h"
+#include "Plane.h"
+#include "cylinder.h"
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+// Intersection with the query picked at compile time. Concrete shapes call their intersect<Q>() directly
+// (no virtual call), anything behind a hittable pointer goes through the virtual interface.
+template <HitQuery Q, class Shape>
+inline bool queryShape(const Shape& s, const Ray& r, float tmin, float tmax, hit_record& rec) {
+    return s.template intersect<Q>(r, tmin, tmax, rec);
+}
+
+template <HitQuery Q>
+inline bool queryShape(const std::shared_ptr<hittable>& s, const Ray& r, float tmin, float tmax, hit_record& rec) {
+    if (Q == HitQuery::Occlusion)
+        return s->occluded(r, tmin, tmax);
+    if (Q == HitQuery::ClosestT)
+        return s->hitT(r, tmin, tmax, rec.t);
+    return s->hit(r, tmin, tmax, rec);
+}
+
+// Handle to one primitive in a PrimitiveStore
+struct PrimRef {
+    enum Kind : uint8_t { NONE, SPHERE, PLANE, CYLINDER, CUSTOM };
+    Kind kind = NONE;
+    uint32_t index = 0;
+};
+
+// The scene geometry, stored by type in contiguous arrays so every bucket is intersected in a tight loop
+// without pointer chasing or virtual calls. Custom shapes can still be added through the hittable
+// interface, they are tested last.
+class PrimitiveStore {
+public:
+    std::vector<Sphere> spheres;
+    std::vector<Plane> planes;
+    std::vector<Cylinder> cylinders;
+    std::vector<std::shared_ptr<hittable>> custom;
+
+    size_t size() const {
+        return spheres.size() + planes.size() + cylinders.size() + custom.size();
+    }
+
+    // Nearest primitive in (tmin, tmax) without filling in any attributes. tmax is lowered to the hit t and
+    // hitMax is the bound the winner was tested with, so resolve() reproduces exactly the same hit.
+    PrimRef nearest(const Ray& r, float tmin, float& tmax, float& hitMax) const {
+        PrimRef best;
+        nearestIn(spheres, PrimRef::SPHERE, r, tmin, tmax, hitMax, best);
+        nearestIn(planes, PrimRef::PLANE, r, tmin, tmax, hitMax, best);
+        nearestIn(cylinders, PrimRef::CYLINDER, r, tmin, tmax, hitMax, best);
+        nearestIn(custom, PrimRef::CUSTOM, r, tmin, tmax, hitMax, best);
+        return best;
+    }
+
+    // Full record for one primitive
+    bool resolve(PrimRef ref, const Ray& r, float tmin, float tmax, hit_record& rec) const {
+        switch (ref.kind) {
+        case PrimRef::SPHERE:   return queryShape<HitQuery::Closest>(spheres[ref.index], r, tmin, tmax, rec);
+        case PrimRef::PLANE:    return queryShape<HitQuery::Closest>(planes[ref.index], r, tmin, tmax, rec);
+        case PrimRef::CYLINDER: return queryShape<HitQuery::Closest>(cylinders[ref.index], r, tmin, tmax, rec);
+        case PrimRef::CUSTOM:   return queryShape<HitQuery::Closest>(custom[ref.index], r, tmin, tmax, rec);
+        default:                return false;
+        }
+    }
+
+    // Closest hit with the full record, only the winner's attributes are computed
+    bool hit(const Ray& r, float tmin, float tmax, hit_record& rec) const {
+        float hitMax = tmax;
+        PrimRef ref = nearest(r, tmin, tmax, hitMax);
+        return resolve(ref, r, tmin, hitMax, rec);
+    }
+
+    // Anything in (tmin, tmax)
+    bool occluded(const Ray& r, float tmin, float tmax) const {
+        return anyIn(spheres, r, tmin, tmax) || anyIn(planes, r, tmin, tmax) ||
+               anyIn(cylinders, r, tmin, tmax) || anyIn(custom, r, tmin, tmax);
+    }
+
+    // Only the shapes the analytic line light shadows (lineLight.h) don't handle
+    bool occludedThin(const Ray& r, float tmin, float tmax) const {
+        return anyIn(cylinders, r, tmin, tmax) || anyIn(custom, r, tmin, tmax);
+    }
+
+private:
+    template <class Bucket>
+    static void nearestIn(const Bucket& bucket, PrimRef::Kind kind, const Ray& r, float tmin, float& tmax,
+                          float& hitMax, PrimRef& best) {
+        hit_record rec;
+        for (uint32_t i = 0; i < bucket.size(); ++i) {
+            if (queryShape<HitQuery::ClosestT>(bucket[i], r, tmin, tmax, rec)) {
+                hitMax = tmax;
+                tmax = rec.t;
+                best.kind = kind;
+                best.index = i;
+            }
+        }
+    }
+
+    template <class Bucket>
+    static bool anyIn(const Bucket& bucket, const Ray& r, float tmin, float tmax) {
+        hit_record rec;
+        for (const auto& s : bucket) {
+            if (queryShape<HitQuery::Occlusion>(s, r, tmin, tmax, rec))
+                return true;
+        }
+        return false;
+    }
+};
+
+#endif
@@ -19,6 +19,7 @@ public:
     // Members
     glm::vec3 orig;
     glm::vec3 dir;
+    float spread = 0.0f;  // ray differential, width of the pixel footprint per unit of distance (0 = none)
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,433 @@
+#include "renderJob.h"
+#include "ofMain.h"
+#include <filesystem>
+#include <regex>
+#include <map>
+#include <sstream>
+#include <iomanip>
+
+namespace fs = std::filesystem;
+
+static const std::pair<const char*, float BranchSettings::*> BRANCH_SETTINGS[] = {
+	{ "radius", &BranchSettings::radius }, { "probability", &BranchSettings::probability },
+	{ "branch-length", &BranchSettings::branchLength }, { "segment-angle", &BranchSettings::segmentAngle },
+	{ "segment-length", &BranchSettings::segmentLength }, { "branch-angle", &BranchSettings::branchAngle } };
+
+float* branchSetting(BranchSettings& branch, const std::string& name) {
+	for (const auto& [settingName, field] : BRANCH_SETTINGS) {
+		if (name == settingName)
+			return &(branch.*field);
+	}
+	return nullptr;
+}
+
+bool parseRenderJob(int argc, char* argv[], RenderJob& job) {
+	if (argc > 0) job.exePath = argv[0];
+
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		int left = argc - i - 1;
+
+		if (arg == "--frames" && left >= 2) {
+			job.frameStart = std::atoi(argv[++i]);
+			job.frameEnd = std::atoi(argv[++i]);
+		}
+		else if (arg == "--tile" && left >= 4) {
+			job.tileX = std::atoi(argv[++i]);
+			job.tileY = std::atoi(argv[++i]);
+			job.tileW = std::atoi(argv[++i]);
+			job.tileH = std::atoi(argv[++i]);
+		}
+		else if (arg == "--seed" && left >= 1) {
+			job.seed = (uint32_t)std::stoul(argv[++i]);
+		}
+		else if (arg == "--out" && left >= 1) {
+			job.outDir = argv[++i];
+		}
+		else if (arg == "--merge") {
+			job.mode = RenderJob::MERGE;
+		}
+		else if (arg == "--launch" && left >= 1) {
+			job.mode = RenderJob::LAUNCH;
+			job.launchCount = std::atoi(argv[++i]);
+		}
+		else if (arg == "--pipeline" && left >= 1) {
+			job.pipelineDepth = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (arg == "--preview") {
+			job.preview = true;
+		}
+		else if (arg == "--spp" && left >= 2) {
+			job.minSamples = std::max(1, std::atoi(argv[++i]));
+			job.maxSamples = std::atoi(argv[++i]);
+		}
+		else if (arg == "--denoise") {
+			job.denoise = true;
+		}
+		else if (arg == "--wavefront") {
+			job.wavefront = true;
+		}
+		else if (arg == "--scene" && left >= 1) {
+			job.sceneIn = argv[++i];
+		}
+		else if (arg == "--save-scene" && left >= 1) {
+			job.sceneOut = argv[++i];
+		}
+		else if (arg == "--smooth-rate" && left >= 1) {
+			std::string rate = argv[++i];
+			job.smoothRate = rate == "quad" ? 2 : rate == "pixel" ? 1 : 0;
+		}
+		else if (arg == "--sampler" && left >= 1) {
+			std::string kind = argv[++i];
+			job.sampler = kind == "random" ? 0 : 1;
+		}
+		else if (arg == "--shadows" && left >= 1) {
+			std::string kind = argv[++i];
+			job.analyticShadows = kind == "sampled" ? 0 : 1;
+		}
+		else if (arg == "--glow-kernel" && left >= 1) {
+			std::string kind = argv[++i];
+			job.glowKernel = kind == "scalar" ? 1 : kind == "avx2" ? 2 : 0;
+		}
+		else if (arg == "--bolt-shape" && left >= 1) {
+			std::string shape = argv[++i];
+			job.capsuleBolts = shape == "cylinder" ? 0 : 1;
+		}
+		else if (arg == "--cloud-shadows" && left >= 1) {
+			std::string state = argv[++i];
+			job.cloudShadows = state == "off" ? 0 : 1;
+		}
+		else if (arg == "--bounce" && left >= 1) {
+			std::string state = argv[++i];
+			job.bounceLight = state == "off" ? 0 : 1;
+		}
+		else if (arg == "--ground-cache" && left >= 1) {
+			std::string state = argv[++i];
+			job.groundCache = state == "off" ? 0 : 1;
+		}
+		else if (arg == "--aov") {
+			job.aovs = true;
+		}
+		else if (arg == "--light-groups") {
+			job.lightGroups = true;
+		}
+		else if (arg == "--relight" && left >= 1) {
+			job.relightKeys = argv[++i];
+		}
+		else if (arg == "--composite") {
+			job.mode = RenderJob::COMPOSITE;
+		}
+		else if (arg == "--grade" && left >= 2) {
+			std::string name = argv[++i];
+			float value = (float)std::atof(argv[++i]);
+			float* target = name == "exposure" ? &job.grade.exposure
+				: name == "direct" ? &job.grade.direct
+				: name == "bolt" ? &job.grade.bolt
+				: name == "cloud" ? &job.grade.cloud
+				: name == "aura" ? &job.grade.aura
+				: name == "core" ? &job.grade.core
+				: name == "cloud-shadow" ? &job.grade.cloudShadow
+				: nullptr;
+			if (!target) {
+				ofLogError() << "Unknown grade: " << name;
+				return false;
+			}
+			*target = value;
+		}
+		else if (arg == "--volume-scale" && left >= 1) {
+			job.volumeScale = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (arg == "--size" && left >= 2) {
+			job.width = std::max(1, std::atoi(argv[++i]));
+			job.height = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (arg == "--branch" && left >= 2) {
+			std::string name = argv[++i];
+			float value = (float)std::atof(argv[++i]);
+			float* target = branchSetting(job.branch, name);
+			if (!target) {
+				ofLogError() << "Unknown branch setting: " << name;
+				return false;
+			}
+			*target = value;
+		}
+		else if (arg == "--sweep" && left >= 4) {
+			job.sweepName = argv[++i];
+			job.sweepFrom = (float)std::atof(argv[++i]);
+			job.sweepTo = (float)std::atof(argv[++i]);
+			job.sweepSteps = std::max(1, std::atoi(argv[++i]));
+			if (!branchSetting(job.branch, job.sweepName)) {
+				ofLogError() << "Unknown branch setting to sweep: " << job.sweepName;
+				return false;
+			}
+		}
+		else if (arg == "--serve") {
+			job.mode = RenderJob::SERVE;
+		}
+		else if (arg == "--threads" && left >= 1) {
+			job.threads = std::max(1, std::atoi(argv[++i]));
+		}
+		else if (arg == "--tune" && left >= 1) {
+			std::string state = argv[++i];
+			job.tune = state == "off" ? 0 : state == "force" ? 2 : 1;
+		}
+		else {
+			ofLogError() << "Unknown or incomplete argument: " << arg;
+			return false;
+		}
+	}
+
+	if (job.frameEnd <= job.frameStart) {
+		ofLogError() << "Empty frame range " << job.frameStart << " - " << job.frameEnd;
+		return false;
+	}
+	if (job.mode == RenderJob::LAUNCH && job.launchCount < 1) {
+		ofLogError() << "--launch needs at least one process";
+		return false;
+	}
+	return true;
+}
+
+// Floats with every digit, so a job read back from its arguments is the same job
+static std::string number(float v) {
+	std::ostringstream out;
+	out << std::setprecision(9) << v;
+	return out.str();
+}
+
+static const char* onOff(int state) {
+	return state ? "on" : "off";
+}
+
+std::vector<std::string> renderJobArgs(const RenderJob& job) {
+	std::vector<std::string> args;
+	auto add = [&](std::initializer_list<std::string> values) {
+		args.insert(args.end(), values.begin(), values.end());
+	};
+	const RenderJob defaults;
+
+	if (job.mode == RenderJob::MERGE)
+		add({ "--merge" });
+	if (job.mode == RenderJob::COMPOSITE)
+		add({ "--composite" });
+	if (job.mode == RenderJob::LAUNCH)
+		add({ "--launch", ofToString(job.launchCount) });
+	if (job.mode == RenderJob::SERVE)
+		add({ "--serve" });
+	if (job.frameStart != defaults.frameStart || job.frameEnd != defaults.frameEnd)
+		add({ "--frames", ofToString(job.frameStart), ofToString(job.frameEnd) });
+	if (job.isTile())
+		add({ "--tile", ofToString(job.tileX), ofToString(job.tileY), ofToString(job.tileW), ofToString(job.tileH) });
+	if (job.seed != 0)
+		add({ "--seed", ofToString(job.seed) });
+	if (!job.outDir.empty())
+		add({ "--out", job.outDir });
+	if (job.pipelineDepth != defaults.pipelineDepth)
+		add({ "--pipeline", ofToString(job.pipelineDepth) });
+	if (job.preview)
+		add({ "--preview" });
+	if (job.minSamples > 0)
+		add({ "--spp", ofToString(job.minSamples), ofToString(job.maxSamples) });
+	if (job.denoise)
+		add({ "--denoise" });
+	if (job.wavefront)
+		add({ "--wavefront" });
+	if (!job.sceneIn.empty())
+		add({ "--scene", job.sceneIn });
+	if (!job.sceneOut.empty())
+		add({ "--save-scene", job.sceneOut });
+	if (job.volumeScale > 0)
+		add({ "--volume-scale", ofToString(job.volumeScale) });
+	if (job.smoothRate >= 0)
+		add({ "--smooth-rate", job.smoothRate == 2 ? "quad" : job.smoothRate == 1 ? "pixel" : "sample" });
+	if (job.sampler >= 0)
+		add({ "--sampler", job.sampler == 0 ? "random" : "sobol" });
+	if (job.analyticShadows >= 0)
+		add({ "--shadows", job.analyticShadows ? "analytic" : "sampled" });
+	if (job.glowKernel >= 0)
+		add({ "--glow-kernel", job.glowKernel == 1 ? "scalar" : job.glowKernel == 2 ? "avx2" : "auto" });
+	if (job.capsuleBolts >= 0)
+		add({ "--bolt-shape", job.capsuleBolts ? "capsule" : "cylinder" });
+	if (job.cloudShadows >= 0)
+		add({ "--cloud-shadows", onOff(job.cloudShadows) });
+	if (job.bounceLight >= 0)
+		add({ "--bounce", onOff(job.bounceLight) });
+	if (job.groundCache >= 0)
+		add({ "--ground-cache", onOff(job.groundCache) });
+	if (job.width > 0)
+		add({ "--size", ofToString(job.width), ofToString(job.height) });
+	if (job.aovs)
+		add({ "--aov" });
+	if (job.lightGroups)
+		add({ "--light-groups" });
+	if (!job.relightKeys.empty())
+		add({ "--relight", job.relightKeys });
+
+	const std::pair<const char*, float GradeSettings::*> grades[] = {
+		{ "exposure", &GradeSettings::exposure }, { "direct", &GradeSettings::direct }, { "bolt", &GradeSettings::bolt },
+		{ "cloud", &GradeSettings::cloud }, { "aura", &GradeSettings::aura }, { "core", &GradeSettings::core },
+		{ "cloud-shadow", &GradeSettings::cloudShadow } };
+	for (const auto& [name, field] : grades) {
+		if (job.grade.*field != defaults.grade.*field)
+			add({ "--grade", name, number(job.grade.*field) });
+	}
+
+	for (const auto& [name, field] : BRANCH_SETTINGS) {
+		if (job.branch.*field != defaults.branch.*field)
+			add({ "--branch", name, number(job.branch.*field) });
+	}
+	if (!job.sweepName.empty())
+		add({ "--sweep", job.sweepName, number(job.sweepFrom), number(job.sweepTo), ofToString(job.sweepSteps) });
+
+	if (job.threads > 0)
+		add({ "--threads", ofToString(job.threads) });
+	if (job.tune >= 0)
+		add({ "--tune", job.tune == 0 ? "off" : job.tune == 2 ? "force" : "on" });
+	return args;
+}
+
+std::vector<RenderJob> expandSweep(const RenderJob& job) {
+	if (job.sweepName.empty())
+		return { job };
+
+	std::vector<RenderJob> jobs;
+	fs::path base = job.outDir.empty() ? fs::path(defaultOutDir()) : fs::path(job.outDir);
+	for (int s = 0; s < job.sweepSteps; ++s) {
+		RenderJob step = job;
+		step.sweepName.clear();
+		step.sweepSteps = 0;
+		float t = job.sweepSteps > 1 ? float(s) / float(job.sweepSteps - 1) : 0.0f;
+		float value = job.sweepFrom + (job.sweepTo - job.sweepFrom) * t;
+		*branchSetting(step.branch, job.sweepName) = value;
+		step.outDir = (base / (job.sweepName + "_" + ofToString(value))).string();
+		jobs.push_back(step);
+	}
+	return jobs;
+}
+
+std::string defaultOutDir() {
+	// Walk up from the working directory looking for the project root (the folder holding src)
+	fs::path cwd = fs::current_path();
+	fs::path search = cwd;
+	for (int i = 0; i < 10; ++i) {
+		if (fs::exists(search / "src"))
+			return (search / "out").string();
+		if (search.has_parent_path())
+			search = search.parent_path();
+		else
+			break;
+	}
+	return (cwd / "out").string();
+}
+
+std::string frameFileName(int frame) {
+	return "output" + ofToString(frame, 5, '0') + ".png";
+}
+
+std::string tileFileName(int frame, int x, int y) {
+	return "output" + ofToString(frame, 5, '0') + "_x" + ofToString(x, 4, '0') + "_y" + ofToString(y, 4, '0') + ".png";
+}
+
+int mergeTiles(const std::string& outDir) {
+	fs::path tileDir = fs::path(outDir) / "tiles";
+	if (!fs::exists(tileDir)) {
+		ofLogError() << "No tiles found in " << tileDir.string();
+		return 0;
+	}
+
+	// Group tiles by frame
+	struct Tile { int x, y; fs::path path; };
+	std::map<int, std::vector<Tile>> frames;
+	std::regex pattern("output(\\d{5})_x(\\d+)_y(\\d+)\\.png");
+
+	for (const auto& entry : fs::directory_iterator(tileDir)) {
+		std::smatch m;
+		std::string name = entry.path().filename().string();
+		if (!std::regex_match(name, m, pattern)) continue;
+		frames[std::stoi(m[1])].push_back({ std::stoi(m[2]), std::stoi(m[3]), entry.path() });
+	}
+
+	int written = 0;
+	for (auto& [frame, tiles] : frames) {
+		// Load all the tiles first, the frame size is the extent they cover
+		std::vector<ofPixels> loaded(tiles.size());
+		int width = 0;
+		int height = 0;
+		for (size_t i = 0; i < tiles.size(); ++i) {
+			if (!ofLoadImage(loaded[i], tiles[i].path.string())) {
+				ofLogError() << "Could not load tile " << tiles[i].path.string();
+				continue;
+			}
+			width = std::max(width, tiles[i].x + (int)loaded[i].getWidth());
+			height = std::max(height, tiles[i].y + (int)loaded[i].getHeight());
+		}
+		if (width == 0 || height == 0) continue;
+
+		ofPixels full;
+		full.allocate(width, height, OF_IMAGE_COLOR);
+		full.set(0);
+		for (size_t i = 0; i < tiles.size(); ++i) {
+			if (loaded[i].isAllocated())
+				loaded[i].pasteInto(full, tiles[i].x, tiles[i].y);
+		}
+
+		fs::path savePath = fs::path(outDir) / frameFileName(frame);
+		ofSaveImage(full, savePath.string());
+		ofLog() << "Merged " << tiles.size() << " tiles into " << savePath.string();
+		written++;
+	}
+
+	mergeAovTiles(outDir);
+	return written;
+}
+
+int launchLocal(const RenderJob& job, int width, int height) {
+	// Every child gets the same seed so they all build the same strike
+	uint32_t seed = job.seed ? job.seed : (uint32_t)time(nullptr);
+	std::string outDir = job.outDir.empty() ? defaultOutDir() : job.outDir;
+
+	int count = std::min(job.launchCount, height);
+	int rowsPerTile = height / count;
+
+	ofLog() << "Launching " << count << " processes (seed=" << seed << ", frames " << job.frameStart << "-" << job.frameEnd << ")";
+
+	std::vector<std::thread> children;
+	std::atomic<int> failures{ 0 };
+	for (int i = 0; i < count; ++i) {
+		int y = i * rowsPerTile;
+		int h = (i == count - 1) ? height - y : rowsPerTile;
+
+		// The child is this job as a plain render of one tile, every other setting passed on as given
+		RenderJob child = job;
+		child.mode = RenderJob::RENDER;
+		child.launchCount = 0;
+		child.tileX = 0;
+		child.tileY = y;
+		child.tileW = width;
+		child.tileH = h;
+		child.seed = seed;
+		child.outDir = outDir;
+		child.sceneOut.clear();  // one writer is enough, the parent's scene isn't built here
+		child.sweepName.clear();
+		child.sweepSteps = 0;
+
+		std::string cmd = "\"" + job.exePath + "\"";
+		for (const std::string& arg : renderJobArgs(child))
+			cmd += arg.find_first_of(" \t") == std::string::npos && !arg.empty() ? " " + arg : " \"" + arg + "\"";
+#ifdef _WIN32
+		// cmd.exe strips the outermost quotes, wrap once more so the exe path survives
+		cmd = "\"" + cmd + "\"";
+#endif
+
+		children.emplace_back([cmd, &failures]() {
+			if (std::system(cmd.c_str()) != 0)
+				failures++;
+		});
+	}
+	for (auto& c : children) c.join();
+
+	if (failures > 0)
+		ofLogError() << failures << " render processes failed";
+
+	return mergeTiles(outDir);
+}
@@ -0,0 +1,146 @@
+#ifndef RENDERJOB_H
+#define RENDERJOB_H
+
+#include "aovOutput.h"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Describes the slice of work a single process renders.
+// With a fixed seed the strike and every random sample are deterministic, so independent
+// processes can render disjoint frame ranges or tiles and the pieces line up afterwards.
+//
+// Command line:
+//   --frames A B       render frames [A, B)
+//   --tile X Y W H     only render this pixel rectangle, saved to out/tiles
+//   --seed S           scene seed (default: time based, logged so it can be reused)
+//   --out DIR          output folder (default: <project>/out)
+//   --merge            assemble out/tiles into full frames and exit
+//   --launch N         split the frame into N tiles, render them in N local processes, then merge
+//   --pipeline N       keep N frames in flight at once (default 1, one frame per draw)
+//   --preview          start in the interactive progressive preview
+//   --spp MIN MAX      adaptive anti-aliasing sample range (MIN = MAX gives a fixed count)
+//   --denoise          edge-aware filter over the direct lighting
+//   --wavefront        stream based tracer instead of the per sample megakernel
+//   --scene FILE       load the scene from a binary scene cache instead of generating it
+//   --save-scene FILE  write the scene (generated or loaded) to a scene cache
+//   --volume-scale N   march the clouds once per NxN block and upsample (1 = per sample)
+//   --smooth-rate R    glow / cloud shading rate: sample, pixel or quad
+//   --sampler S        random or sobol
+//   --shadows S        analytic (spheres / planes exact) or sampled
+//   --glow-kernel K    exact glow kernel: auto, scalar or avx2
+//   --bolt-shape S     capsule (one swept-sphere chain per branch) or cylinder (one per segment)
+//   --cloud-shadows S  on or off, bolt light attenuated by the clouds it passes through
+//   --bounce S         on or off, one bounce of bolt light off the ground and spheres (irradiance cache)
+//   --ground-cache S   on or off, ground light looked up from a texture space cache instead of shaded
+//   --aov              also write the float layers (PFM) to out/aov
+//   --composite        rebuild out/aov into out/graded with the --grade gains and exit
+//   --grade NAME X     exposure, direct, bolt, cloud, aura, core or cloud-shadow for --composite
+//   --light-groups     also write per light group layers (implies --aov)
+//   --relight FILE     intensity keyframes per light group for --composite, see lightGroups.h
+//   --size W H         image size (default: the window size in main.cpp)
+//   --branch NAME X    strike generation: radius, probability, branch-length, segment-angle,
+//                      segment-length or branch-angle (the Branch arguments in generateScene)
+//   --serve            stay running and take render jobs from stdin, see renderServer.h
+//   --sweep NAME A B N server jobs only: render the job N times with the --branch setting NAME going
+//                      from A to B, each into <out>/NAME_VALUE
+//   --threads N        render worker threads (default: hardware threads * 1.9)
+//   --tune S           off, on (tuned threads / tile size / glow kernel from tune.txt, calibrated
+//                      once per machine and settings) or force (calibrate again), see autoTune.h
+
+// Arguments of the main Branch, a different set makes a different strike from the same seed
+struct BranchSettings {
+    float radius = 0.05f;
+    float probability = 0.3f;     // chance of forking per step
+    float branchLength = 0.8f;    // mean length of a side branch
+    float segmentAngle = 30.0f;   // max turn per segment, degrees
+    float segmentLength = 0.08f;  // mean segment length
+    float branchAngle = 50.0f;    // max fork angle, degrees
+
+    bool operator==(const BranchSettings& o) const {
+        return radius == o.radius && probability == o.probability && branchLength == o.branchLength &&
+               segmentAngle == o.segmentAngle && segmentLength == o.segmentLength && branchAngle == o.branchAngle;
+    }
+};
+
+struct RenderJob {
+    enum Mode { RENDER, MERGE, LAUNCH, COMPOSITE, SERVE };
+
+    Mode mode = RENDER;
+    int frameStart = 0;
+    int frameEnd = 24;      // exclusive
+    int tileX = 0;
+    int tileY = 0;
+    int tileW = 0;          // 0 = full width
+    int tileH = 0;          // 0 = full height
+    uint32_t seed = 0;      // 0 = pick one from the clock
+    std::string outDir;     // empty = <project>/out
+    int launchCount = 0;
+    int pipelineDepth = 1;
+    bool preview = false;
+    bool denoise = false;
+    bool wavefront = false;
+    std::string sceneIn;    // scene cache to load
+    std::string sceneOut;   // scene cache to write
+    int volumeScale = 0;    // 0 = keep the default in ofApp.h
+    int smoothRate = -1;    // ShadingRate, -1 = keep the default in ofApp.h
+    int sampler = -1;       // SamplerKind, -1 = keep the default in ofApp.h
+    int analyticShadows = -1;  // -1 = keep the default in ofApp.h
+    int glowKernel = -1;    // GlowKernelKind, -1 = keep the default in ofApp.h
+    int capsuleBolts = -1;  // -1 = keep the default in ofApp.h
+    int cloudShadows = -1;  // -1 = keep the default in ofApp.h
+    int bounceLight = -1;   // -1 = keep the default in ofApp.h
+    int groundCache = -1;   // -1 = keep the default in ofApp.h
+    int threads = 0;        // 0 = keep the default in ofApp.h
+    int tune = -1;          // TuneMode, -1 = keep the default in ofApp.h
+    bool aovs = false;
+    bool lightGroups = false;
+    GradeSettings grade;    // --composite only
+    std::string relightKeys;
+    int minSamples = 0;     // 0 = keep the defaults in ofApp.h
+    int maxSamples = 0;
+    int width = 0;          // 0 = the window size
+    int height = 0;
+    BranchSettings branch;
+    std::string sweepName;  // --sweep: branch setting, empty = no sweep
+    float sweepFrom = 0.0f;
+    float sweepTo = 0.0f;
+    int sweepSteps = 0;
+    std::string exePath;    // argv[0], used by the launcher
+
+    bool isTile() const { return tileW > 0 && tileH > 0; }
+
+    // Would this job generate / load the same scene as other? A time based seed never matches.
+    bool sameScene(const RenderJob& other) const {
+        return seed != 0 && seed == other.seed && sceneIn == other.sceneIn && branch == other.branch;
+    }
+};
+
+// The BranchSettings field called name on the command line (radius, probability, ...), nullptr if none is
+float* branchSetting(BranchSettings& branch, const std::string& name);
+
+// The jobs of a --sweep, one per value with its own out folder. A job without a sweep comes back as is.
+std::vector<RenderJob> expandSweep(const RenderJob& job);
+
+// Returns false (and logs why) on a bad command line
+bool parseRenderJob(int argc, char* argv[], RenderJob& job);
+
+// The command line options that give back this job, every setting that isn't at its default (no argv[0]).
+// The launcher builds its child processes' command lines from it.
+std::vector<std::string> renderJobArgs(const RenderJob& job);
+
+// Default output folder, <project>/out when the project root can be found
+std::string defaultOutDir();
+
+// outputNNNNN.png and outputNNNNN_xXXXX_yYYYY.png
+std::string frameFileName(int frame);
+std::string tileFileName(int frame, int x, int y);
+
+// Assemble every tile in outDir/tiles into full frames in outDir (and the AOV tiles into outDir/aov).
+// Returns the number of frames written.
+int mergeTiles(const std::string& outDir);
+
+// Render the job split into job.launchCount horizontal tiles, one child process each, then merge
+int launchLocal(const RenderJob& job, int width, int height);
+
+#endif
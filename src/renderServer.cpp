@@ -0,0 +1,75 @@
+#include "renderServer.h"
+#include <iostream>
+#include <vector>
+
+RenderServer::~RenderServer() {
+	// A blocked getline can't be interrupted, the reader goes down with the process
+	if (reader.joinable())
+		reader.detach();
+}
+
+void RenderServer::start() {
+	reader = std::thread([this]() {
+		std::string line;
+		while (std::getline(std::cin, line)) {
+			if (!line.empty() && line.back() == '\r')
+				line.pop_back();
+			std::lock_guard<std::mutex> lock(mtx);
+			lines.push_back(line);
+		}
+		eof = true;
+	});
+}
+
+bool RenderServer::poll(std::string& line) {
+	std::lock_guard<std::mutex> lock(mtx);
+	if (lines.empty())
+		return false;
+	line = lines.front();
+	lines.pop_front();
+	return true;
+}
+
+bool RenderServer::closed() {
+	std::lock_guard<std::mutex> lock(mtx);
+	return eof && lines.empty();
+}
+
+void RenderServer::reply(const std::string& message) {
+	std::lock_guard<std::mutex> lock(mtx);
+	std::cout << "@" << message << std::endl;
+}
+
+bool RenderServer::parseLine(const std::string& line, RenderJob& job) {
+	std::vector<std::string> args(1, "serve");
+	std::string current;
+	bool quoted = false;
+	bool any = false;
+	for (char c : line) {
+		if (c == '#' && !quoted && !any)
+			break;  // the rest of the line is a comment
+		if (c == '"') {
+			quoted = !quoted;
+			any = true;
+		}
+		else if (!quoted && (c == ' ' || c == '\t')) {
+			if (any)
+				args.push_back(current);
+			current.clear();
+			any = false;
+		}
+		else {
+			current += c;
+			any = true;
+		}
+	}
+	if (any)
+		args.push_back(current);
+	if (quoted)
+		return false;
+
+	std::vector<char*> argv;
+	for (std::string& a : args)
+		argv.push_back(&a[0]);
+	return parseRenderJob((int)argv.size(), argv.data(), job);
+}
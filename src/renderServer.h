@@ -0,0 +1,47 @@
+#ifndef RENDERSERVER_H
+#define RENDERSERVER_H
+
+#include "renderJob.h"
+#include <string>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <atomic>
+
+// Job queue for --serve: one long running process keeps the scene, the strike and everything built from
+// them in memory, and renders job after job. A job is one line on stdin with the same options as the
+// command line, e.g.
+//   --seed 42 --frames 0 24 --spp 2 8 --out out/a
+//   --seed 42 --frames 12 13 --branch probability 0.5 --size 280 360 --out out/b
+//   --seed 42 --frames 12 13 --sweep probability 0.2 0.6 5 --out out/sweep
+// The scene is only rebuilt when the seed, --scene file or --branch settings differ from the job before
+// (seed 0 picks a new one every time); quality settings, frame range, size and tiles are just applied.
+// Every job starts from the default settings, a line fully describes its render, nothing carries over from
+// the line before. Frames go to the job's --out folder. A --sweep renders the job once per value of a
+// Branch argument, each value into its own folder with its own reply.
+//
+// Replies are single lines on stdout starting with '@' (everything else there is the log):
+//   @ready                             waiting for jobs
+//   @done A B MS warm|rebuilt DIR      frames [A, B) written to DIR
+//   @error LINE                        the job didn't parse or isn't a render job
+// "quit" or the end of stdin stops the server. A # outside quotes starts a comment.
+class RenderServer {
+public:
+    ~RenderServer();
+
+    void start();                   // reads stdin on its own thread from here on
+    bool poll(std::string& line);   // next job line, false if none is waiting
+    bool closed();                  // stdin ended and every line was taken
+    void reply(const std::string& message);
+
+    // Splits a job line like a shell would (whitespace, "quoted" arguments) and parses it as a command line
+    static bool parseLine(const std::string& line, RenderJob& job);
+
+private:
+    std::thread reader;
+    std::mutex mtx;
+    std::deque<std::string> lines;
+    std::atomic<bool> eof{ false };
+};
+
+#endif
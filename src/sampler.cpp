@@ -0,0 +1,69 @@
+#include "sampler.h"
+
+static uint32_t reverseBits(uint32_t x) {
+	x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+	x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+	x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+	x = ((x >> 8) & 0x00ff00ffu) | ((x & 0x00ff00ffu) << 8);
+	return (x >> 16) | (x << 16);
+}
+
+// Hash that only lets bits flow from low to high, so on bit reversed values it acts as a nested uniform
+// (Owen) scramble
+static uint32_t laineKarrasPermutation(uint32_t x, uint32_t seed) {
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return x;
+}
+
+static uint32_t nestedUniformScramble(uint32_t x, uint32_t seed) {
+	x = reverseBits(x);
+	x = laineKarrasPermutation(x, seed);
+	return reverseBits(x);
+}
+
+// First two Sobol dimensions: the van der Corput sequence, and the one built from v_k = v_k-1 ^ (v_k-1 >> 1)
+static uint32_t sobol0(uint32_t index) {
+	return reverseBits(index);
+}
+
+static uint32_t sobol1(uint32_t index) {
+	uint32_t result = 0;
+	uint32_t v = 0x80000000u;
+	for (; index; index >>= 1, v ^= v >> 1) {
+		if (index & 1)
+			result ^= v;
+	}
+	return result;
+}
+
+static float toUnitFloat(uint32_t x) {
+	// Top 24 bits, so the result is always below 1
+	return (x >> 8) * (1.0f / 16777216.0f);
+}
+
+uint32_t hashCombine(uint32_t seed, uint32_t v) {
+	seed ^= v + 0x9e3779b9u + (seed << 6) + (seed >> 2);
+	// murmur3 finalizer so nearby dimensions end up far apart
+	seed ^= seed >> 16;
+	seed *= 0x85ebca6bu;
+	seed ^= seed >> 13;
+	seed *= 0xc2b2ae35u;
+	seed ^= seed >> 16;
+	return seed;
+}
+
+float sobolOwen1D(uint32_t index, uint32_t seed) {
+	index = nestedUniformScramble(index, seed);
+	return toUnitFloat(nestedUniformScramble(sobol0(index), hashCombine(seed, 0)));
+}
+
+glm::vec2 sobolOwen2D(uint32_t index, uint32_t seed) {
+	index = nestedUniformScramble(index, seed);
+	uint32_t x = nestedUniformScramble(sobol0(index), hashCombine(seed, 0));
+	uint32_t y = nestedUniformScramble(sobol1(index), hashCombine(seed, 1));
+	return glm::vec2(toUnitFloat(x), toUnitFloat(y));
+}
@@ -0,0 +1,69 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include "ofMain.h"
+#include <glm/gtc/constants.hpp>
+#include <cstdint>
+
+// Where a camera sample's random numbers come from
+enum SamplerKind {
+    SAMPLER_RANDOM,  // xorshift, plain Monte Carlo
+    SAMPLER_SOBOL    // Owen-scrambled Sobol, stratified across the samples of a pixel
+};
+
+// Sample dimensions. Every dimension gets its own scramble of the sequence, so dimensions are uncorrelated
+// with each other while each one stays well stratified over a pixel's samples.
+enum SampleDim : uint32_t {
+    DIM_PIXEL = 0,  // 2D: AA jitter inside the pixel
+    DIM_LIGHT = 1   // light j uses DIM_LIGHT + 2j (1D: position along the segment) and + 1 (2D: radius jitter)
+};
+
+// Owen-scrambled, index-shuffled Sobol points (Burley 2020, "Practical Hash-based Owen Scrambling").
+// index is the sample number within the pixel, seed picks the scramble (pixel and dimension hashed together).
+float sobolOwen1D(uint32_t index, uint32_t seed);
+glm::vec2 sobolOwen2D(uint32_t index, uint32_t seed);
+
+uint32_t hashCombine(uint32_t seed, uint32_t v);
+
+// The random numbers of one camera sample. SAMPLER_SOBOL draws sample `index` of the pixel's scrambled
+// sequence in the requested dimension. subCount / sub split a dimension that is sampled several times per
+// camera sample (shadow rays per light), so all of a pixel's shadow rays form one stratified sequence.
+// SAMPLER_RANDOM ignores the dimension and just steps the xorshift.
+struct SampleStream {
+    SamplerKind kind = SAMPLER_SOBOL;
+    uint32_t pixel = 0;            // pixel seed
+    uint32_t index = 0;            // sample number within the pixel
+    uint32_t rng = 0x9E3779B9u;    // xorshift state, never zero
+
+    float nextRandom() {
+        rng ^= rng << 13;
+        rng ^= rng >> 17;
+        rng ^= rng << 5;
+        return (rng & 0x00FFFFFF) * (1.0f / 16777216.0f);
+    }
+
+    float get1D(uint32_t dim, uint32_t sub = 0, uint32_t subCount = 1) {
+        if (kind == SAMPLER_RANDOM)
+            return nextRandom();
+        return sobolOwen1D(index * subCount + sub, hashCombine(pixel, dim));
+    }
+
+    glm::vec2 get2D(uint32_t dim, uint32_t sub = 0, uint32_t subCount = 1) {
+        if (kind == SAMPLER_RANDOM) {
+            float a = nextRandom();
+            float b = nextRandom();
+            return glm::vec2(a, b);
+        }
+        return sobolOwen2D(index * subCount + sub, hashCombine(pixel, dim));
+    }
+};
+
+// Two uniforms to a uniform direction on the unit sphere (z from u.x, angle from u.y)
+inline glm::vec3 uniformOnSphere(const glm::vec2& u) {
+    float z = 1.0f - 2.0f * u.x;
+    float phi = glm::two_pi<float>() * u.y;
+    float r = sqrt(glm::max(0.0f, 1.0f - z * z));
+    return glm::vec3(r * cos(phi), r * sin(phi), z);
+}
+
+#endif
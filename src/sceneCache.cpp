@@ -0,0 +1,276 @@
+#include "sceneCache.h"
+#include "ofMain.h"
+#include <fstream>
+#include <cstring>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static_assert(sizeof(SceneCacheHeader) == 25 * 4, "scene cache header must not be padded");
+static_assert(sizeof(SphereRecord) == 7 * 4, "scene cache records must not be padded");
+static_assert(sizeof(PlaneRecord) == 9 * 4, "scene cache records must not be padded");
+static_assert(sizeof(CylinderRecord) == 11 * 4, "scene cache records must not be padded");
+static_assert(sizeof(CloudRecord) == 10 * 4, "scene cache records must not be padded");
+static_assert(sizeof(SegmentRecord) == 17 * 4, "scene cache records must not be padded");
+
+static void put(float* dst, const glm::vec3& v) {
+	dst[0] = v.x;
+	dst[1] = v.y;
+	dst[2] = v.z;
+}
+
+static glm::vec3 get(const float* src) {
+	return glm::vec3(src[0], src[1], src[2]);
+}
+
+// Appends the records of one array and returns where it starts
+template <class T>
+static uint32_t appendRecords(std::vector<unsigned char>& buffer, const std::vector<T>& records) {
+	uint32_t offset = (uint32_t)buffer.size();
+	if (!records.empty()) {
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(records.data());
+		buffer.insert(buffer.end(), bytes, bytes + records.size() * sizeof(T));
+	}
+	return offset;
+}
+
+bool writeSceneCache(const std::string& path, uint32_t seed, const Camera& cam, const PrimitiveStore& world,
+                     const std::vector<Cloud>& clouds,
+                     const std::vector<std::shared_ptr<LightningSegment>>& segs) {
+	if (!world.custom.empty())
+		ofLogWarning() << "Scene cache: " << world.custom.size() << " custom shapes can't be stored, skipping them";
+
+	std::vector<SphereRecord> spheres;
+	for (const Sphere& s : world.spheres) {
+		SphereRecord rec;
+		put(rec.center, s.center);
+		rec.radius = s.radius;
+		put(rec.color, s.color);
+		spheres.push_back(rec);
+	}
+
+	std::vector<PlaneRecord> planes;
+	for (const Plane& p : world.planes) {
+		PlaneRecord rec;
+		put(rec.point, p.point);
+		put(rec.normal, p.normal);
+		put(rec.color, p.color);
+		planes.push_back(rec);
+	}
+
+	std::vector<CylinderRecord> cylinders;
+	for (const Cylinder& c : world.cylinders) {
+		CylinderRecord rec;
+		put(rec.center, c.center);
+		put(rec.axis, c.axis);
+		rec.radius = c.radius;
+		rec.height = c.height;
+		put(rec.color, c.color);
+		cylinders.push_back(rec);
+	}
+
+	std::vector<CloudRecord> cloudRecords;
+	for (const Cloud& c : clouds) {
+		CloudRecord rec;
+		put(rec.center, c.center);
+		put(rec.size, c.size);
+		rec.density = c.density;
+		put(rec.color, c.color);
+		cloudRecords.push_back(rec);
+	}
+
+	std::vector<SegmentRecord> segments;
+	for (const auto& seg : segs) {
+		SegmentRecord rec;
+		put(rec.start, seg->startPoint);
+		put(rec.end, seg->endPoint);
+		rec.radius = seg->radius;
+		put(rec.color, seg->color);
+		LightSource light = seg->lightSource ? *seg->lightSource : LightSource();
+		put(rec.lightColor, light.color);
+		rec.lightIntensity = light.intensity;
+		rec.lightRadius = light.radius;
+		rec.branchDepth = seg->branchDepth;
+		rec.flags = (seg->hasEmission ? (uint32_t)SegmentRecord::EMISSIVE : 0u) |
+		            (seg->isMainBranchSegment ? (uint32_t)SegmentRecord::MAIN_BRANCH : 0u);
+		segments.push_back(rec);
+	}
+
+	SceneCacheHeader header;
+	std::memset(&header, 0, sizeof(header));
+	header.magic = SCENE_CACHE_MAGIC;
+	header.version = SCENE_CACHE_VERSION;
+	header.seed = seed;
+	header.sphereCount = (uint32_t)spheres.size();
+	header.planeCount = (uint32_t)planes.size();
+	header.cylinderCount = (uint32_t)cylinders.size();
+	header.cloudCount = (uint32_t)cloudRecords.size();
+	header.segmentCount = (uint32_t)segments.size();
+	put(header.camCenter, cam.camera_center);
+	put(header.camLowerLeft, cam.lowerLeft);
+	put(header.camHorizontal, cam.horizontal);
+	put(header.camVertical, cam.vertical);
+
+	std::vector<unsigned char> buffer(sizeof(header));
+	header.sphereOffset = appendRecords(buffer, spheres);
+	header.planeOffset = appendRecords(buffer, planes);
+	header.cylinderOffset = appendRecords(buffer, cylinders);
+	header.cloudOffset = appendRecords(buffer, cloudRecords);
+	header.segmentOffset = appendRecords(buffer, segments);
+	std::memcpy(buffer.data(), &header, sizeof(header));
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+	if (!file) {
+		ofLogError() << "Scene cache: could not write " << path;
+		return false;
+	}
+
+	ofLog() << "Scene cache: wrote " << path << " (" << segments.size() << " segments, " << buffer.size() << " bytes)";
+	return true;
+}
+
+SceneCache::~SceneCache() {
+	close();
+}
+
+bool SceneCache::open(const std::string& path) {
+	close();
+
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		ofLogError() << "Scene cache: could not open " << path;
+		return false;
+	}
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx(file, &fileSize);
+	HANDLE mapping = fileSize.QuadPart > 0 ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+	const void* view = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	fileHandle = file;
+	mappingHandle = mapping;
+	if (!view) {
+		ofLogError() << "Scene cache: could not map " << path;
+		close();
+		return false;
+	}
+	data = static_cast<const unsigned char*>(view);
+	size = (size_t)fileSize.QuadPart;
+#else
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		ofLogError() << "Scene cache: could not open " << path;
+		return false;
+	}
+	struct stat st;
+	void* view = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+		view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);  // the mapping keeps the file alive
+	if (view == MAP_FAILED) {
+		ofLogError() << "Scene cache: could not map " << path;
+		return false;
+	}
+	data = static_cast<const unsigned char*>(view);
+	size = (size_t)st.st_size;
+#endif
+
+	// ---------- Validate before anything reads the records
+	bool valid = size >= sizeof(SceneCacheHeader);
+	if (valid) {
+		const SceneCacheHeader& h = header();
+		auto fits = [&](uint32_t offset, uint32_t count, size_t recordSize) {
+			return offset % 4 == 0 && offset <= size && (size - offset) / recordSize >= count;
+		};
+		valid = h.magic == SCENE_CACHE_MAGIC && h.version == SCENE_CACHE_VERSION &&
+		        fits(h.sphereOffset, h.sphereCount, sizeof(SphereRecord)) &&
+		        fits(h.planeOffset, h.planeCount, sizeof(PlaneRecord)) &&
+		        fits(h.cylinderOffset, h.cylinderCount, sizeof(CylinderRecord)) &&
+		        fits(h.cloudOffset, h.cloudCount, sizeof(CloudRecord)) &&
+		        fits(h.segmentOffset, h.segmentCount, sizeof(SegmentRecord));
+	}
+	if (!valid) {
+		ofLogError() << "Scene cache: " << path << " is not a version " << SCENE_CACHE_VERSION << " scene cache";
+		close();
+		return false;
+	}
+	return true;
+}
+
+void SceneCache::close() {
+#ifdef _WIN32
+	if (data) UnmapViewOfFile(data);
+	if (mappingHandle) CloseHandle(mappingHandle);
+	if (fileHandle) CloseHandle(fileHandle);
+	mappingHandle = nullptr;
+	fileHandle = nullptr;
+#else
+	if (data) munmap(const_cast<unsigned char*>(data), size);
+#endif
+	data = nullptr;
+	size = 0;
+}
+
+void SceneCache::load(Camera& cam, PrimitiveStore& world, std::vector<Cloud>& cloudsOut,
+                      std::vector<std::shared_ptr<LightningSegment>>& segs) const {
+	const SceneCacheHeader& h = header();
+
+	cam.camera_center = get(h.camCenter);
+	cam.lowerLeft = get(h.camLowerLeft);
+	cam.horizontal = get(h.camHorizontal);
+	cam.vertical = get(h.camVertical);
+
+	for (uint32_t i = 0; i < h.sphereCount; ++i) {
+		const SphereRecord& rec = spheres()[i];
+		world.spheres.push_back(Sphere(get(rec.center), rec.radius, get(rec.color)));
+	}
+	for (uint32_t i = 0; i < h.planeCount; ++i) {
+		const PlaneRecord& rec = planes()[i];
+		world.planes.push_back(Plane(get(rec.point), get(rec.normal), get(rec.color)));
+	}
+	for (uint32_t i = 0; i < h.cylinderCount; ++i) {
+		const CylinderRecord& rec = cylinders()[i];
+		world.cylinders.push_back(Cylinder(get(rec.center), rec.radius, rec.height, get(rec.color), get(rec.axis)));
+	}
+	for (uint32_t i = 0; i < h.cloudCount; ++i) {
+		const CloudRecord& rec = clouds()[i];
+		cloudsOut.push_back(Cloud(get(rec.center), get(rec.size), rec.density, get(rec.color)));
+	}
+
+	// Same construction as Branch::generateBranch, from the stored end points
+	segs.reserve(segs.size() + h.segmentCount);
+	for (uint32_t i = 0; i < h.segmentCount; ++i) {
+		const SegmentRecord& rec = segments()[i];
+		glm::vec3 start = get(rec.start);
+		glm::vec3 end = get(rec.end);
+		glm::vec3 center = (start + end) * 0.5f;
+
+		LightSource light(center, rec.lightIntensity, get(rec.lightColor), rec.lightRadius);
+		auto seg = std::make_shared<LightningSegment>(
+			center,
+			rec.radius,
+			glm::distance(start, end),
+			get(rec.color),
+			glm::normalize(end - start),
+			(rec.flags & SegmentRecord::EMISSIVE) != 0,
+			light,
+			(rec.flags & SegmentRecord::MAIN_BRANCH) != 0
+		);
+		seg->startPoint = start;
+		seg->endPoint = end;
+		seg->branchDepth = rec.branchDepth;
+		segs.push_back(seg);
+	}
+}
@@ -0,0 +1,126 @@
+#ifndef SCENECACHE_H
+#define SCENECACHE_H
+
+#include "camera.h"
+#include "primitiveStore.h"
+#include "lightningSegment.h"
+#include "cloud.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+// Binary scene cache.
+// Everything setup() builds (camera, spheres, planes, cylinders, clouds and the full strike) written as
+// flat records in host byte order after a small header, so a strike can be reloaded exactly and startup is a
+// file map instead of a regeneration. Every record is made of 4 byte fields only, there is no padding. A file
+// from a machine of the other byte order fails the magic check and is rejected.
+//
+// Layout: SceneCacheHeader, then spheres, planes, cylinders, clouds, segments, each array starting at the
+// offset stored in the header.
+
+static const uint32_t SCENE_CACHE_MAGIC = 0x3143534c;  // "LSC1"
+static const uint32_t SCENE_CACHE_VERSION = 1;
+
+struct SceneCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seed;          // the scene seed, keeps the per pixel random streams identical after a reload
+    uint32_t sphereCount;
+    uint32_t planeCount;
+    uint32_t cylinderCount;
+    uint32_t cloudCount;
+    uint32_t segmentCount;
+    uint32_t sphereOffset;  // byte offsets from the start of the file
+    uint32_t planeOffset;
+    uint32_t cylinderOffset;
+    uint32_t cloudOffset;
+    uint32_t segmentOffset;
+    float camCenter[3];
+    float camLowerLeft[3];
+    float camHorizontal[3];
+    float camVertical[3];
+};
+
+struct SphereRecord {
+    float center[3];
+    float radius;
+    float color[3];
+};
+
+struct PlaneRecord {
+    float point[3];
+    float normal[3];
+    float color[3];
+};
+
+struct CylinderRecord {
+    float center[3];
+    float axis[3];
+    float radius;
+    float height;
+    float color[3];
+};
+
+struct CloudRecord {
+    float center[3];
+    float size[3];
+    float density;
+    float color[3];
+};
+
+struct SegmentRecord {
+    enum Flags : uint32_t { EMISSIVE = 1, MAIN_BRANCH = 2 };
+
+    float start[3];
+    float end[3];
+    float radius;
+    float color[3];
+    float lightColor[3];
+    float lightIntensity;
+    float lightRadius;
+    int32_t branchDepth;
+    uint32_t flags;
+};
+
+// Writes the scene to path. Custom shapes in world.custom can't be stored and are skipped with a warning.
+bool writeSceneCache(const std::string& path, uint32_t seed, const Camera& cam, const PrimitiveStore& world,
+                     const std::vector<Cloud>& clouds,
+                     const std::vector<std::shared_ptr<LightningSegment>>& segs);
+
+// Read-only memory map of a cache file. The record accessors point straight into the mapping.
+class SceneCache {
+public:
+    SceneCache() = default;
+    ~SceneCache();
+    SceneCache(const SceneCache&) = delete;
+    SceneCache& operator=(const SceneCache&) = delete;
+
+    // Maps the file and checks the header and that every array fits. Logs and returns false otherwise.
+    bool open(const std::string& path);
+    void close();
+
+    const SceneCacheHeader& header() const { return *reinterpret_cast<const SceneCacheHeader*>(data); }
+    const SphereRecord* spheres() const { return records<SphereRecord>(header().sphereOffset); }
+    const PlaneRecord* planes() const { return records<PlaneRecord>(header().planeOffset); }
+    const CylinderRecord* cylinders() const { return records<CylinderRecord>(header().cylinderOffset); }
+    const CloudRecord* clouds() const { return records<CloudRecord>(header().cloudOffset); }
+    const SegmentRecord* segments() const { return records<SegmentRecord>(header().segmentOffset); }
+
+    // Builds the renderer's objects from the mapped records
+    void load(Camera& cam, PrimitiveStore& world, std::vector<Cloud>& clouds,
+              std::vector<std::shared_ptr<LightningSegment>>& segs) const;
+
+private:
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#endif
+
+    template <class T>
+    const T* records(uint32_t offset) const { return reinterpret_cast<const T*>(data + offset); }
+};
+
+#endif
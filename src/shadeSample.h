@@ -0,0 +1,91 @@
+#ifndef SHADESAMPLE_H
+#define SHADESAMPLE_H
+
+#include "ofMain.h"
+
+// One camera sample split into the terms tracePixel adds up, plus the primary hit G-buffer.
+// Post passes (the denoiser) work on one term and then composite everything again.
+// Every field is a plain sum so samples can be added up and averaged per pixel.
+struct ShadeSample {
+    glm::vec3 direct = glm::vec3(0.0f);     // ambient + diffuse surface lighting (or the emission of an emissive surface)
+    glm::vec3 bolt = glm::vec3(0.0f);       // bolt emission where the ray hits segments
+    glm::vec3 volumeNear = glm::vec3(0.0f); // cloud in-scatter up to the first surface
+    glm::vec3 volumeFar = glm::vec3(0.0f);  // second cloud march out to 100
+    glm::vec3 glow = glm::vec3(0.0f);       // aura + core, tone mapped (zero when the screen-space splat supplies it)
+
+    // Linear versions of the clamped / tone mapped terms, only used by the AOV output (aovOutput.h)
+    glm::vec3 glowAura = glm::vec3(0.0f);   // glow before the tone curve, split into aura and core
+    glm::vec3 glowCore = glm::vec3(0.0f);
+    float volumeOpacity = 0.0f;             // 1 - cloud transmittance up to the first surface
+
+    // Primary hit G-buffer, only accumulated on samples that hit a surface (weighted by coverage)
+    glm::vec3 normal = glm::vec3(0.0f);
+    glm::vec3 albedo = glm::vec3(0.0f);
+    float depth = 0.0f;
+    float coverage = 0.0f;   // 1 when the sample hit a surface
+    float emissive = 0.0f;   // 1 when the sample hit the bolt or an emissive surface
+
+    // Same order of adds and clamps as the single pass version of tracePixel
+    glm::vec3 compose() const {
+        glm::vec3 c = glm::clamp(direct, 0.0f, 1.0f) + bolt;
+        c = glm::clamp(c + volumeNear, 0.0f, 1.0f);
+        c += volumeFar + glow;
+        return glm::clamp(c, 0.0f, 1.0f);
+    }
+
+    ShadeSample& operator+=(const ShadeSample& o) {
+        direct += o.direct;
+        bolt += o.bolt;
+        volumeNear += o.volumeNear;
+        volumeFar += o.volumeFar;
+        glow += o.glow;
+        glowAura += o.glowAura;
+        glowCore += o.glowCore;
+        volumeOpacity += o.volumeOpacity;
+        normal += o.normal;
+        albedo += o.albedo;
+        depth += o.depth;
+        coverage += o.coverage;
+        emissive += o.emissive;
+        return *this;
+    }
+
+    ShadeSample& operator*=(float s) {
+        direct *= s;
+        bolt *= s;
+        volumeNear *= s;
+        volumeFar *= s;
+        glow *= s;
+        glowAura *= s;
+        glowCore *= s;
+        volumeOpacity *= s;
+        normal *= s;
+        albedo *= s;
+        depth *= s;
+        coverage *= s;
+        emissive *= s;
+        return *this;
+    }
+};
+
+// Smooth terms evaluated once at the centre of a pixel or 2x2 quad and shared by all of its samples.
+// The glow and the far cloud march only depend on the ray direction. The near cloud march also depends on
+// where the primary ray stops, so a sample only reuses it when its own hit is at about the same depth.
+struct SmoothTerms {
+    glm::vec3 glow = glm::vec3(0.0f);
+    glm::vec3 volumeNear = glm::vec3(0.0f);
+    glm::vec3 volumeFar = glm::vec3(0.0f);
+    glm::vec3 glowAura = glm::vec3(0.0f);
+    glm::vec3 glowCore = glm::vec3(0.0f);
+    float volumeOpacity = 0.0f;
+    float depth = 1e20f;   // primary hit at the centre, 1e20 for no hit
+    bool valid = false;
+
+    bool matchesDepth(float sampleDepth) const {
+        float a = glm::min(depth, 100.0f);
+        float b = glm::min(sampleDepth, 100.0f);
+        return fabs(a - b) <= 0.02f * glm::max(a, b);
+    }
+};
+
+#endif
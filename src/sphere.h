@@ -5,7 +5,7 @@
 #include "ray.h"
 #include "hittable.h"
 
-class Sphere : public hittable {
+class Sphere : public hittableShape<Sphere> {
 public:
     Sphere(glm::vec3 c, float r, glm::vec3 col) 
         : center(c), radius(r), color(col) {
@@ -16,33 +16,36 @@ public:
     glm::vec3 color;
 
     // Sphere intersection
-    bool hit(const Ray& r, float t_min, float t_max, hit_record& rec) const override {
+    template <HitQuery Q>
+    bool intersect(const Ray& r, float t_min, float t_max, hit_record& rec) const {
         glm::vec3 oc = r.orig - center;
         float a = glm::dot(r.dir, r.dir);
         float b = glm::dot(oc, r.dir); 
         float c = glm::dot(oc, oc) - radius * radius;
         float discriminant = b * b - a * c;
 
-        if (discriminant > 0) {
-            float sqrtDisc = sqrt(discriminant);
-            float temp = (-b - sqrtDisc) / a;
-            if (temp < t_max && temp > t_min) {
-                rec.t = temp;
-                rec.p = r.orig + rec.t * r.dir;
-                rec.normal = (rec.p - center) / (float)radius;
-                rec.color = color;
-                return true;
-            }
+        if (discriminant <= 0)
+            return false;
+
+        // Near root first, the far one only if the near one is out of range
+        float sqrtDisc = sqrt(discriminant);
+        float temp = (-b - sqrtDisc) / a;
+        if (!(temp < t_max && temp > t_min)) {
             temp = (-b + sqrtDisc) / a;
-            if (temp < t_max && temp > t_min) {
-                rec.t = temp;
-                rec.p = r.orig + rec.t * r.dir;
-                rec.normal = (rec.p - center) / (float)radius;
-                rec.color = color;
-                return true;
-            }
+            if (!(temp < t_max && temp > t_min))
+                return false;
+        }
+
+        if (Q == HitQuery::Occlusion)
+            return true;
+
+        rec.t = temp;
+        if (Q == HitQuery::Closest) {
+            rec.p = r.orig + rec.t * r.dir;
+            rec.normal = (rec.p - center) / (float)radius;
+            rec.color = color;
         }
-        return false;
+        return true;
     }
 };
 
@@ -0,0 +1,103 @@
+#include "volumePass.h"
+#include "parallel.h"
+#include <cmath>
+
+// Same far distances as tracePixel: 100 for the second march, and no hit is treated as that far away
+static const float FAR_DISTANCE = 100.0f;
+
+void VolumeBuffer::build(const Camera& cam, const PrimitiveStore& world, const CloudField& clouds,
+                         const std::vector<std::shared_ptr<LightningSegment>>& segs, int screenWidth, int screenHeight,
+                         int regionX, int regionY, int regionW, int regionH, int blockScale,
+                         const BoltTransmittance* lightShadow) {
+	const float EPS = 0.001f;
+	scale = glm::max(1, blockScale);
+
+	int gridW = (screenWidth + scale - 1) / scale;
+	int gridH = (screenHeight + scale - 1) / scale;
+	originX = glm::max(0, regionX / scale - 1);
+	originY = glm::max(0, regionY / scale - 1);
+	width = glm::min(gridW, (regionX + regionW + scale - 1) / scale + 1) - originX;
+	height = glm::min(gridH, (regionY + regionH + scale - 1) / scale + 1) - originY;
+
+	nearColor.assign(width * height, glm::vec3(0.0f));
+	farColor.assign(width * height, glm::vec3(0.0f));
+	nearOpacity.assign(width * height, 0.0f);
+	depth.assign(width * height, FAR_DISTANCE);
+
+	parallelRows(height, [&](int yStart, int yEnd) {
+		for (int j = yStart; j < yEnd; ++j) {
+			for (int i = 0; i < width; ++i) {
+				float px = (originX + i + 0.5f) * scale;
+				float py = (originY + j + 0.5f) * scale;
+				Ray r = cam.getRay(px / (screenWidth - 1), py / (screenHeight - 1));
+				r.spread *= scale;  // one march stands for the whole block
+
+				hit_record rec;
+				float closest = world.hit(r, EPS, 1e20f, rec) ? rec.t : 1e20f;
+
+				int k = j * width + i;
+				depth[k] = glm::min(closest, FAR_DISTANCE);
+				float transmittance = 1.0f;
+				nearColor[k] = renderVolume(r, clouds, closest, glm::vec3(0.0f), segs, &transmittance, nullptr, lightShadow);
+				nearOpacity[k] = 1.0f - transmittance;
+				farColor[k] = renderVolume(r, clouds, FAR_DISTANCE, glm::vec3(0.0f), segs, nullptr, nullptr, lightShadow);
+			}
+		}
+	});
+}
+
+void VolumeBuffer::sample(float x, float y, float sampleDepth, glm::vec3& volumeNear, glm::vec3& volumeFar,
+                          float* volumeOpacity) const {
+	float d = glm::min(sampleDepth, FAR_DISTANCE);
+
+	// Position in the block grid, relative to the block centres
+	float fx = x / scale - 0.5f - originX;
+	float fy = y / scale - 0.5f - originY;
+	int i0 = (int)floor(fx);
+	int j0 = (int)floor(fy);
+	float tx = fx - i0;
+	float ty = fy - j0;
+
+	glm::vec3 nearSum(0.0f);
+	glm::vec3 farSum(0.0f);
+	float opacitySum = 0.0f;
+	float wSum = 0.0f;
+	float bilinearSum = 0.0f;
+	int bestK = -1;
+	float bestDiff = 1e30f;
+
+	for (int dj = 0; dj <= 1; ++dj) {
+		for (int di = 0; di <= 1; ++di) {
+			int i = glm::clamp(i0 + di, 0, width - 1);
+			int j = glm::clamp(j0 + dj, 0, height - 1);
+			int k = j * width + i;
+			float bilinear = (di ? tx : 1.0f - tx) * (dj ? ty : 1.0f - ty);
+
+			// The far march doesn't depend on depth, plain bilinear
+			farSum += farColor[k] * bilinear;
+			bilinearSum += bilinear;
+
+			float diff = fabs(d - depth[k]);
+			float w = bilinear * expf(-diff / (depthSigma * d + 1e-3f));
+			nearSum += nearColor[k] * w;
+			opacitySum += nearOpacity[k] * w;
+			wSum += w;
+
+			if (diff < bestDiff) {
+				bestDiff = diff;
+				bestK = k;
+			}
+		}
+	}
+
+	volumeFar = farSum / glm::max(bilinearSum, 1e-6f);
+
+	// No block at a similar depth (a thin edge between block centres): take the closest match in depth
+	if (wSum > 1e-4f)
+		volumeNear = nearSum / wSum;
+	else
+		volumeNear = nearColor[bestK];
+
+	if (volumeOpacity)
+		*volumeOpacity = wSum > 1e-4f ? opacitySum / wSum : nearOpacity[bestK];
+}
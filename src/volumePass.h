@@ -0,0 +1,46 @@
+#ifndef VOLUMEPASS_H
+#define VOLUMEPASS_H
+
+#include "camera.h"
+#include "primitiveStore.h"
+#include "lightningSegment.h"
+#include "cloudField.h"
+#include <vector>
+#include <memory>
+
+// Mixed resolution cloud pass.
+// The clouds and the light they scatter from the bolt are smooth, so instead of two marches per camera
+// sample they are marched once per scale x scale block, through the block centre. Every sample then takes
+// its volume terms from the four nearest blocks with a joint-bilateral upsample: bilinear weights times a
+// depth weight against the sample's own primary hit, so the cloud in front of a sphere doesn't bleed past
+// its silhouette. renderVolume only returns the added in-scatter, so colour (plus the near opacity for the
+// AOV output) is all that needs storing.
+class VolumeBuffer {
+public:
+    float depthSigma = 0.05f;  // relative depth difference at which a block's weight falls to 1/e
+
+    // Marches the blocks covering the region, plus a one block border for the upsample
+    void build(const Camera& cam, const PrimitiveStore& world, const CloudField& clouds,
+               const std::vector<std::shared_ptr<LightningSegment>>& segs, int screenWidth, int screenHeight,
+               int regionX, int regionY, int regionW, int regionH, int blockScale,
+               const BoltTransmittance* lightShadow = nullptr);
+
+    bool valid() const { return !nearColor.empty(); }
+
+    // Volume terms for a sample at pixel position (x, y) whose primary ray stopped at depth
+    void sample(float x, float y, float depth, glm::vec3& volumeNear, glm::vec3& volumeFar,
+                float* volumeOpacity = nullptr) const;
+
+private:
+    int scale = 1;
+    int originX = 0;  // block grid, block (i, j) covers pixels from (originX + i) * scale
+    int originY = 0;
+    int width = 0;
+    int height = 0;
+    std::vector<glm::vec3> nearColor;  // in-scatter up to the block centre's primary hit
+    std::vector<glm::vec3> farColor;   // in-scatter out to the far distance
+    std::vector<float> nearOpacity;    // 1 - transmittance of the near march
+    std::vector<float> depth;          // primary hit depth of the block centre
+};
+
+#endif
@@ -0,0 +1,254 @@
+#include "wavefront.h"
+
+static const float EPS = 0.001f;
+
+void WavefrontTracer::trace(const SceneView& scene, const std::vector<CameraSample>& samples,
+                            std::vector<ShadeSample>& out, bool includeGlow) {
+	const auto& world = *scene.world;
+	const auto& segs = *scene.segs;
+	const auto& clouds = *scene.clouds;
+	size_t n = samples.size();
+
+	out.assign(n, ShadeSample());
+	rays.resize(n);
+	hits.resize(n);
+	closest.assign(n, 1e20f);
+	surfaceHit.assign(n, 0);
+	streams.resize(n);
+	lightSum.assign(n, glm::vec3(0.0f));
+
+	// ---------- Stage 1: generate camera rays
+	for (size_t i = 0; i < n; ++i) {
+		float u = samples[i].x / (scene.screenWidth - 1);
+		float v = samples[i].y / (scene.screenHeight - 1);
+		rays[i] = scene.cam->getRay(u, v);
+		streams[i].kind = scene.sampler;
+		streams[i].pixel = samples[i].pixel;
+		streams[i].index = samples[i].index;
+		streams[i].rng = samples[i].seed ? samples[i].seed : 0x9E3779B9u;
+	}
+
+	// ---------- Stage 2: primary intersection, one object against the whole batch at a time.
+	// Only t is tracked here, the full record is filled in afterwards for the object that won.
+	nearest.assign(n, PrimRef());
+	nearestMax.resize(n);
+	auto primaryPass = [&](const auto& bucket, PrimRef::Kind kind) {
+		hit_record rec;
+		for (uint32_t o = 0; o < bucket.size(); ++o) {
+			for (size_t i = 0; i < n; ++i) {
+				if (queryShape<HitQuery::ClosestT>(bucket[o], rays[i], EPS, closest[i], rec)) {
+					nearestMax[i] = closest[i];
+					closest[i] = rec.t;
+					nearest[i] = { kind, o };
+				}
+			}
+		}
+	};
+	primaryPass(world.spheres, PrimRef::SPHERE);
+	primaryPass(world.planes, PrimRef::PLANE);
+	primaryPass(world.cylinders, PrimRef::CYLINDER);
+	primaryPass(world.custom, PrimRef::CUSTOM);
+
+	for (size_t i = 0; i < n; ++i) {
+		if (!world.resolve(nearest[i], rays[i], EPS, nearestMax[i], hits[i])) continue;
+		surfaceHit[i] = 1;
+		ShadeSample& s = out[i];
+		s.coverage = 1.0f;
+		s.normal = hits[i].normal;
+		s.albedo = hits[i].color;
+		s.depth = closest[i];
+
+		// Emissive surfaces skip everything else, like the early return in tracePixel
+		if (hits[i].emissive) {
+			s.direct = hits[i].emissionColor;
+			s.emissive = 1.0f;
+			surfaceHit[i] = 2;
+		}
+		// Ground with cached light skips the shadow stream (3), stored times samplesPerLight like the sums
+		else if (scene.ground && nearest[i].kind == PrimRef::PLANE && nearest[i].index == scene.ground->planeIndex() &&
+		         scene.ground->lookup(hits[i].p, lightSum[i])) {
+			lightSum[i] *= float(scene.samplesPerLight);
+			surfaceHit[i] = 3;
+		}
+	}
+
+	// ---------- Stage 3: shadow ray stream, generated light by light and traced in bounded chunks
+	shadows.clear();
+	for (uint32_t j = 0; j < segs.size(); ++j) {
+		const auto& seg = segs[j];
+		if (!seg->isEmissive()) continue;
+		const LightSource& light = *seg->lightSource;
+		glm::vec3 segStart = seg->startPoint;
+		glm::vec3 segVec = seg->endPoint - seg->startPoint;
+
+		for (size_t i = 0; i < n; ++i) {
+			if (surfaceHit[i] != 1) continue;
+			const hit_record& rec = hits[i];
+
+			float visible = 1.0f;
+			if (scene.analyticShadows) {
+				visible = visibleSpans(world, rec.p, rec.p + rec.normal * EPS, segStart, seg->endPoint, spans);
+				if (visible <= 0.0f) continue;
+			}
+
+			for (int s = 0; s < scene.samplesPerLight; s++) {
+				float tSample = streams[i].get1D(DIM_LIGHT + 2 * j, s, scene.samplesPerLight);
+				if (scene.analyticShadows)
+					tSample = spanParameter(spans, visible, tSample);
+				glm::vec3 samplePos = segStart + tSample * segVec;
+				if (light.radius > 0.0f)
+					samplePos += (light.radius * 0.5f) * uniformOnSphere(streams[i].get2D(DIM_LIGHT + 2 * j + 1, s, scene.samplesPerLight));
+
+				glm::vec3 L = samplePos - rec.p;
+				float dist2 = glm::dot(L, L);
+				float dist = sqrt(dist2);
+				if (dist <= 0.0f) continue;
+				glm::vec3 lightDir = L / dist;
+
+				float nDotL = glm::dot(lightDir, rec.normal);
+				if (nDotL <= 0.0f) continue;
+
+				// Lambertian shading, only counted if the shadow ray gets through
+				float attenuation = light.intensity / (dist2 + 1e-4f);
+
+				ShadowRay sr;
+				sr.ray = Ray(rec.p + rec.normal * EPS, lightDir);
+				sr.maxT = dist - EPS;
+				sr.owner = (uint32_t)i;
+				sr.light = seg.get();
+				sr.contribution = (light.color * attenuation) * (nDotL * visible);
+				shadows.push_back(sr);
+			}
+
+			if (shadows.size() >= maxShadowStream)
+				flushShadows(scene);
+		}
+	}
+	flushShadows(scene);
+
+	for (size_t i = 0; i < n; ++i) {
+		if (surfaceHit[i] != 1 && surfaceHit[i] != 3) continue;
+		glm::vec3 totalLightRGB = lightSum[i] / float(scene.samplesPerLight);
+		if (scene.lightShadow)
+			totalLightRGB *= scene.lightShadow->irradiance(hits[i].p);
+		glm::vec3 ambient = 0.004f * hits[i].color;
+		glm::vec3 diffuse = hits[i].color * totalLightRGB * 0.09f;
+		out[i].direct = ambient + diffuse;
+		if (scene.bounce)
+			out[i].direct += hits[i].color * scene.bounce->indirect(hits[i].p, hits[i].normal);
+	}
+
+	// ---------- Stage 4: bolt hits, one segment (or branch chain) against the whole batch
+	if (scene.chains) {
+		for (size_t i = 0; i < n; ++i) {
+			if (surfaceHit[i] == 2) continue;
+			scene.chains->forEachHit(rays[i], EPS, closest[i], [&](const LightningSegment& seg) {
+				out[i].bolt += seg.boltColor();
+			});
+		}
+	}
+	else {
+		hit_record lrec;
+		for (const auto& seg : segs) {
+			glm::vec3 boltColor = seg->boltColor();
+			for (size_t i = 0; i < n; ++i) {
+				if (surfaceHit[i] == 2) continue;
+				if (queryShape<HitQuery::ClosestT>(*seg, rays[i], EPS, closest[i], lrec))
+					out[i].bolt += boltColor;
+			}
+		}
+	}
+	for (size_t i = 0; i < n; ++i) {
+		if (out[i].bolt != glm::vec3(0.0f))
+			out[i].emissive = 1.0f;
+	}
+
+	// ---------- Stage 5: cloud march, or the upsampled low resolution pass
+	if (!clouds.empty() && scene.volume && scene.volume->valid()) {
+		for (size_t i = 0; i < n; ++i) {
+			if (surfaceHit[i] == 2) continue;
+			scene.volume->sample(samples[i].x, samples[i].y, closest[i], out[i].volumeNear, out[i].volumeFar,
+				&out[i].volumeOpacity);
+		}
+	}
+	else if (!clouds.empty()) {
+		for (size_t i = 0; i < n; ++i) {
+			if (surfaceHit[i] == 2) continue;
+			const SmoothTerms* smooth = samples[i].smooth;
+			float transmittance = smooth ? 1.0f - smooth->volumeOpacity : 1.0f;
+			out[i].volumeNear = smooth && smooth->matchesDepth(closest[i]) ? smooth->volumeNear
+				: renderVolume(rays[i], clouds, closest[i], glm::vec3(0.0f), segs, &transmittance, nullptr, scene.lightShadow);
+			out[i].volumeOpacity = 1.0f - transmittance;
+			out[i].volumeFar = smooth ? smooth->volumeFar
+				: renderVolume(rays[i], clouds, 100.0f, glm::vec3(0.0f), segs, nullptr, nullptr, scene.lightShadow);
+		}
+	}
+
+	// ---------- Stage 6: glow, one ray at a time against the whole segment block (GlowKernel)
+	if (includeGlow) {
+		for (size_t i = 0; i < n; ++i) {
+			if (surfaceHit[i] == 2) {
+				out[i].glow = glm::vec3(0.0f);
+				out[i].glowAura = glm::vec3(0.0f);
+				out[i].glowCore = glm::vec3(0.0f);
+			}
+			else if (samples[i].smooth) {
+				out[i].glow = samples[i].smooth->glow;
+				out[i].glowAura = samples[i].smooth->glowAura;
+				out[i].glowCore = samples[i].smooth->glowCore;
+			}
+			else {
+				out[i].glow = scene.glow->glow(rays[i], &out[i].glowAura, &out[i].glowCore);
+			}
+		}
+	}
+}
+
+void WavefrontTracer::flushShadows(const SceneView& scene) {
+	size_t count = shadows.size();
+	if (count == 0) return;
+	blocked.assign(count, 0);
+
+	hit_record rec;
+
+	// Scene objects against the whole stream, bucket by bucket
+	auto occlusionPass = [&](const auto& bucket) {
+		for (const auto& obj : bucket) {
+			for (size_t k = 0; k < count; ++k) {
+				if (blocked[k]) continue;
+				if (queryShape<HitQuery::Occlusion>(obj, shadows[k].ray, EPS, shadows[k].maxT, rec))
+					blocked[k] = 1;
+			}
+		}
+	};
+	// Spheres and planes were already taken care of by the visible spans
+	if (!scene.analyticShadows) {
+		occlusionPass(scene.world->spheres);
+		occlusionPass(scene.world->planes);
+	}
+	occlusionPass(scene.world->cylinders);
+	occlusionPass(scene.world->custom);
+
+	// Then every other bolt segment
+	if (scene.chains) {
+		for (size_t k = 0; k < count; ++k) {
+			if (!blocked[k] && scene.chains->occluded(shadows[k].ray, EPS, shadows[k].maxT))
+				blocked[k] = 1;
+		}
+	}
+	else {
+		for (const auto& seg : *scene.segs) {
+			for (size_t k = 0; k < count; ++k) {
+				if (blocked[k] || shadows[k].light == seg.get()) continue;
+				if (queryShape<HitQuery::Occlusion>(*seg, shadows[k].ray, EPS, shadows[k].maxT, rec))
+					blocked[k] = 1;
+			}
+		}
+	}
+
+	for (size_t k = 0; k < count; ++k) {
+		if (!blocked[k])
+			lightSum[shadows[k].owner] += shadows[k].contribution;
+	}
+	shadows.clear();
+}
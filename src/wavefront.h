@@ -0,0 +1,90 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "camera.h"
+#include "primitiveStore.h"
+#include "lightningSegment.h"
+#include "cloudField.h"
+#include "volumePass.h"
+#include "sampler.h"
+#include "lineLight.h"
+#include "glowKernel.h"
+#include "capsuleChain.h"
+#include "boltTransmittance.h"
+#include "irradianceCache.h"
+#include "groundLight.h"
+#include "shadeSample.h"
+#include <vector>
+#include <memory>
+
+// Read only view of everything needed to trace camera samples
+struct SceneView {
+    const Camera* cam = nullptr;
+    const PrimitiveStore* world = nullptr;
+    const CloudField* clouds = nullptr;
+    const std::vector<std::shared_ptr<LightningSegment>>* segs = nullptr;
+    int screenWidth = 0;
+    int screenHeight = 0;
+    int samplesPerLight = 4;
+    const VolumeBuffer* volume = nullptr;  // low resolution clouds, marched per sample when null / empty
+    const GlowKernel* glow = nullptr;      // exact glow, needed when trace is asked for it
+    const BoltChains* chains = nullptr;    // bolt as swept-sphere chains, one cylinder per segment when null
+    const BoltTransmittance* lightShadow = nullptr;  // bolt light through the clouds, unattenuated when null
+    const IrradianceLookup* bounce = nullptr;        // cached indirect light on the surfaces, none when null
+    const GroundLight* ground = nullptr;             // ground light from its texture space cache, shaded when null
+    SamplerKind sampler = SAMPLER_SOBOL;
+    bool analyticShadows = true;           // spheres / planes through lineLight.h, shadow rays only test cylinders
+};
+
+// One camera sample to trace, in pixel coordinates, with its own random stream
+struct CameraSample {
+    float x, y;
+    uint32_t seed;
+    const SmoothTerms* smooth = nullptr;  // glow / clouds shared with the pixel or quad, evaluated here when null
+    uint32_t pixel = 0;                   // pixel seed and sample number for the low discrepancy sampler
+    uint32_t index = 0;
+};
+
+// Stream based version of tracePixel.
+// Instead of running every stage for one sample before starting the next (a megakernel), a whole batch of
+// camera samples goes through one stage at a time: primary hits, then a shadow ray stream, then the bolt
+// test, the cloud march and the glow. Each stage is a tight loop with the object in the outer loop and the
+// rays in the inner one, so the same geometry and code stay hot in cache. The shadow stream is generated
+// light by light, which already keeps it coherent and is where ray sorting / SIMD would slot in.
+//
+// Keep one tracer per thread, the streams are reused between batches.
+class WavefrontTracer {
+public:
+    size_t maxShadowStream = 1 << 15;  // shadow rays buffered before they are traced
+
+    void trace(const SceneView& scene, const std::vector<CameraSample>& samples,
+               std::vector<ShadeSample>& out, bool includeGlow);
+
+private:
+    struct ShadowRay {
+        Ray ray;
+        float maxT;
+        uint32_t owner;                 // index of the camera sample
+        const LightningSegment* light;  // the light itself can't occlude its own ray
+        glm::vec3 contribution;         // added to the owner if the ray is unoccluded
+    };
+
+    // Camera ray stream
+    std::vector<Ray> rays;
+    std::vector<hit_record> hits;
+    std::vector<float> closest;
+    std::vector<PrimRef> nearest;          // object with the nearest t so far
+    std::vector<float> nearestMax;         // tmax it was hit with, to fill in its record afterwards
+    std::vector<uint8_t> surfaceHit;
+    std::vector<SampleStream> streams;
+    std::vector<glm::vec3> lightSum;
+
+    // Shadow ray stream
+    std::vector<ShadowRay> shadows;
+    std::vector<uint8_t> blocked;
+    std::vector<LightSpan> spans;
+
+    void flushShadows(const SceneView& scene);
+};
+
+#endif
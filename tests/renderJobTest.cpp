@@ -0,0 +1,137 @@
+// Round trip of RenderJob through its command line: renderJobArgs, then parseRenderJob, has to give back the
+// same job. The launcher depends on it, a setting the serialiser forgets renders the child tiles wrong.
+// Built by tests/Makefile (make -C tests test) from this file, src/renderJob.cpp, src/aovOutput.cpp and
+// src/lightGroups.cpp with openFrameworks. Returns non-zero on a failure.
+#include "renderJob.h"
+#include <iostream>
+
+static int failures = 0;
+
+static void check(bool ok, const std::string& what) {
+	if (!ok) {
+		std::cerr << "FAIL " << what << std::endl;
+		failures++;
+	}
+}
+
+static bool parseArgs(const std::vector<std::string>& args, RenderJob& job) {
+	std::vector<std::string> owned(1, "renderJobTest");
+	owned.insert(owned.end(), args.begin(), args.end());
+	std::vector<char*> argv;
+	for (std::string& a : owned)
+		argv.push_back(&a[0]);
+	return parseRenderJob((int)argv.size(), argv.data(), job);
+}
+
+static std::string joined(const std::vector<std::string>& args) {
+	std::string s;
+	for (const std::string& a : args)
+		s += (s.empty() ? "" : " ") + a;
+	return s;
+}
+
+// job -> args -> job -> args, both jobs' arguments have to match
+static RenderJob roundTrip(const RenderJob& job, const std::string& name) {
+	std::vector<std::string> args = renderJobArgs(job);
+	RenderJob back;
+	check(parseArgs(args, back), name + ": parse \"" + joined(args) + "\"");
+	check(renderJobArgs(back) == args, name + ": \"" + joined(args) + "\" came back as \"" + joined(renderJobArgs(back)) + "\"");
+	return back;
+}
+
+int main() {
+	// Defaults write nothing
+	check(renderJobArgs(RenderJob()).empty(), "default job has no arguments");
+	roundTrip(RenderJob(), "defaults");
+
+	// Every render setting away from its default
+	RenderJob job;
+	job.frameStart = 3;
+	job.frameEnd = 17;
+	job.tileX = 0;
+	job.tileY = 180;
+	job.tileW = 560;
+	job.tileH = 180;
+	job.seed = 4000000000u;
+	job.outDir = "out dir/with spaces";
+	job.pipelineDepth = 3;
+	job.minSamples = 2;
+	job.maxSamples = 48;
+	job.denoise = true;
+	job.wavefront = true;
+	job.sceneIn = "strike.lsc";
+	job.volumeScale = 4;
+	job.smoothRate = 2;
+	job.sampler = 0;
+	job.analyticShadows = 0;
+	job.glowKernel = 1;
+	job.capsuleBolts = 0;
+	job.cloudShadows = 0;
+	job.bounceLight = 0;
+	job.groundCache = 1;
+	job.aovs = true;
+	job.width = 280;
+	job.height = 360;
+	job.threads = 12;
+	job.tune = 2;
+	job.branch.probability = 0.45f;
+	job.branch.segmentAngle = 22.5f;
+
+	RenderJob back = roundTrip(job, "render settings");
+	check(back.frameStart == 3 && back.frameEnd == 17, "frames");
+	check(back.isTile() && back.tileY == 180 && back.tileH == 180, "tile");
+	check(back.seed == 4000000000u, "seed");
+	check(back.outDir == job.outDir, "out");
+	check(back.minSamples == 2 && back.maxSamples == 48, "spp");
+	check(back.denoise && back.wavefront && back.aovs, "flags");
+	check(back.volumeScale == 4 && back.smoothRate == 2 && back.sampler == 0, "volume / shading rate / sampler");
+	check(back.analyticShadows == 0 && back.glowKernel == 1 && back.capsuleBolts == 0, "shadows / glow kernel / bolt shape");
+	check(back.cloudShadows == 0 && back.bounceLight == 0 && back.groundCache == 1, "cloud shadows / bounce / ground cache");
+	check(back.width == 280 && back.height == 360, "size");
+	check(back.threads == 12 && back.tune == 2, "threads / tune");
+	check(back.branch == job.branch && back.sameScene(job), "branch");
+
+	// The other modes
+	RenderJob composite;
+	composite.mode = RenderJob::COMPOSITE;
+	composite.lightGroups = true;
+	composite.relightKeys = "keys.txt";
+	composite.grade.exposure = 1.25f;
+	composite.grade.cloudShadow = 0.3f;
+	back = roundTrip(composite, "composite");
+	check(back.mode == RenderJob::COMPOSITE && back.lightGroups && back.relightKeys == "keys.txt", "composite mode");
+	check(back.grade.exposure == 1.25f && back.grade.cloudShadow == 0.3f, "grade");
+
+	RenderJob launch;
+	launch.mode = RenderJob::LAUNCH;
+	launch.launchCount = 4;
+	back = roundTrip(launch, "launch");
+	check(back.mode == RenderJob::LAUNCH && back.launchCount == 4, "launch mode");
+
+	RenderJob serve;
+	serve.mode = RenderJob::SERVE;
+	back = roundTrip(serve, "serve");
+	check(back.mode == RenderJob::SERVE, "serve mode");
+
+	// A sweep round trips, and expands into one job per value with its own folder
+	RenderJob sweep;
+	sweep.seed = 7;
+	sweep.outDir = "out/sweep";
+	sweep.sweepName = "probability";
+	sweep.sweepFrom = 0.2f;
+	sweep.sweepTo = 0.6f;
+	sweep.sweepSteps = 5;
+	back = roundTrip(sweep, "sweep");
+	check(back.sweepName == "probability" && back.sweepSteps == 5 && back.sweepTo == 0.6f, "sweep");
+	std::vector<RenderJob> steps = expandSweep(sweep);
+	check(steps.size() == 5, "sweep steps");
+	if (steps.size() == 5) {
+		check(steps[0].branch.probability == 0.2f && steps[4].branch.probability == 0.6f, "sweep range");
+		check(steps[2].sweepName.empty() && steps[2].outDir != steps[3].outDir, "sweep step jobs");
+		check(!steps[1].sameScene(steps[2]), "sweep steps are different scenes");
+	}
+
+	if (failures == 0)
+		std::cout << "renderJobTest: all passed" << std::endl;
+	return failures == 0 ? 0 : 1;
+}